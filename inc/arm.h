@@ -94,6 +94,15 @@ relr()
     return r;
 }
 
+/* Read Fault Address Register (EL1). */
+static inline uint64_t
+rfar()
+{
+    uint64_t r;
+    asm volatile("mrs %[x], far_el1" : [x] "=r"(r));
+    return r;
+}
+
 /* Load Exception Syndrome Register (EL1). */
 static inline void
 lesr(uint64_t r)
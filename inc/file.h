@@ -4,10 +4,12 @@
 #include <sys/stat.h>
 
 #include "fs.h"
+#include "pcache.h"
 #include "sleeplock.h"
 #include "types.h"
 
-#define NFILE 100  // Open files per system
+#define NFILE         100  // Open files per system
+#define PIPE_MAXPAGES 16   // Most pages in a pipe, see F_SETPIPE_SZ
 
 struct file {
     enum { FD_NONE, FD_PIPE, FD_INODE } type;
@@ -19,6 +21,16 @@ struct file {
     size_t off;
 };
 
+/*
+ * Part of one page held by a pipe, see kern/pipe.c.
+ */
+struct pipe_buf {
+    char* data;       // The page
+    struct page* pg;  // Page cache page lent to the pipe, or NULL
+    uint32_t off;     // First byte in the page
+    uint32_t len;     // Bytes from off
+};
+
 /*
  * In-memory copy of an inode.
  */
@@ -26,7 +38,13 @@ struct inode {
     uint32_t dev;           // Device number
     uint32_t inum;          // Inode number
     int ref;                // Reference count
-    struct sleeplock lock;  // Protects everything below here
+    struct inode* hnext;    // Hash chain, protected by icache.lock
+    struct inode* prev;     // Unreferenced entries, less recent
+    struct inode* next;     // Unreferenced entries, more recent
+    struct inode* dnext;    // Dirty inodes awaiting iflush()
+    int dirty;              // Disk copy is stale, don't recycle
+    struct sleeplock fill;  // Taken by readpage() to fill a page
+    struct sleeplock lock;  // Protects everything below here, shared to read
     int valid;              // Inode has been read from disk?
 
     uint16_t type;  // Copy of disk inode
@@ -42,7 +60,7 @@ struct inode {
  * device functions
  */
 struct devsw {
-    ssize_t (*read)(struct inode*, char*, ssize_t);
+    ssize_t (*read)(struct inode*, char*, size_t, ssize_t);
     ssize_t (*write)(struct inode*, char*, ssize_t);
 };
 
@@ -57,26 +75,51 @@ void file_close(struct file*);
 int file_stat(struct file*, struct stat*);
 ssize_t file_read(struct file*, char*, ssize_t);
 ssize_t file_write(struct file*, char*, ssize_t);
+ssize_t file_pread(struct file*, char*, ssize_t, size_t);
+ssize_t file_pwrite(struct file*, char*, ssize_t, size_t);
+ssize_t file_splice_read(struct file*, size_t*, struct pipe*, size_t);
+ssize_t file_splice_write(struct pipe*, struct file*, size_t*, size_t);
+ssize_t file_sendfile(struct file*, struct file*, size_t*, size_t);
+
+// kern/pipe.c
+
+int pipe_alloc(struct file**, struct file**);
+void pipe_close(struct pipe*, int);
+ssize_t pipe_read(struct pipe*, char*, size_t);
+ssize_t pipe_write(struct pipe*, char*, size_t);
+int pipe_give(struct pipe*, struct pipe_buf*);
+ssize_t pipe_take(struct pipe*, struct pipe_buf*, size_t, int);
+void pipe_buf_release(struct pipe_buf*);
+size_t pipe_size(struct pipe*);
+ssize_t pipe_resize(struct pipe*, size_t);
 
 // kern/fs.c
 
 void readsb(int, struct superblock*);
 
+void icache_init();
+void icache_dump();
 void iinit(int);
 struct inode* ialloc(uint32_t, uint16_t);
 void iupdate(struct inode*);
+void iflush();
 struct inode* idup(struct inode*);
 void ilock(struct inode*);
 void iunlock(struct inode*);
+void ilock_shared(struct inode*);
+void iunlock_shared(struct inode*);
 void iput(struct inode*);
 void iunlockput(struct inode*);
+struct page* readpage(struct inode*, uint32_t);
 void stati(struct inode*, struct stat*);
 ssize_t readi(struct inode*, char*, size_t, size_t);
 ssize_t writei(struct inode*, char*, size_t, size_t);
 
 int namecmp(const char*, const char*);
+void dirinit(struct inode*);
 struct inode* dirlookup(struct inode*, char*, size_t*);
 int dirlink(struct inode*, char*, uint32_t);
+ssize_t getdents(struct inode*, char*, size_t*, size_t);
 
 struct inode* namei(char*);
 struct inode* nameiparent(char*, char*);
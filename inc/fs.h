@@ -11,12 +11,12 @@
 
 // Kernel only
 #define NDEV        10                 // Maximum major device number
-#define NINODE      50                 // Maximum number of active i-nodes
+#define NINODE      50                 // Initial number of cached i-nodes
 #define MAXOPBLOCKS 10                 // Max # of blocks any FS op writes
 #define NBUF        (MAXOPBLOCKS * 3)  // Size of disk block cache
 
 // mkfs only
-#define FSSIZE 1000  // Size of file system in blocks
+#define FSSIZE 2000  // Size of file system in blocks
 
 // Belows are used by both
 #define LOGSIZE (MAXOPBLOCKS * 3)  // Max data blocks in on-disk log
@@ -40,8 +40,13 @@ struct superblock {
     uint32_t logstart;    // Block number of first log block
     uint32_t inodestart;  // Block number of first inode block
     uint32_t bmapstart;   // Block number of first free map block
+    uint32_t features;    // Optional format features (FEAT_*)
 };
 
+/* Format features recorded in sb.features by mkfs. */
+#define FEAT_DIRHASH  0x1  // New directories are created hashed
+#define FEAT_LONGNAME 0x2  // Directory names are 30 bytes instead of 14
+
 #define NDIRECT   12
 #define NINDIRECT (BSIZE / sizeof(uint32_t))
 #define MAXFILE   (NDIRECT + NINDIRECT)
@@ -68,14 +73,61 @@ struct dinode {
 /* Block of free map containing bit for block b. */
 #define BBLOCK(b, sb) (b / BPB + sb.bmapstart)
 
-/* Directory is a file containing a sequence of dirent structures. */
-#define DIRSIZ 14
+/*
+ * Directory is a file containing a sequence of dirent structures.
+ * Build with -DFS_LONGNAME for 30-byte names; the kernel refuses to
+ * mount an image whose FEAT_LONGNAME bit disagrees with DIRSIZ.
+ */
+#ifdef FS_LONGNAME
+#    define DIRSIZ      30
+#    define FEAT_DIRSIZ FEAT_LONGNAME
+#else
+#    define DIRSIZ      14
+#    define FEAT_DIRSIZ 0
+#endif
 
 struct dirent {
     uint16_t inum;
     char name[DIRSIZ];
 };
 
+/* Directory entries per block. */
+#define DPB (BSIZE / sizeof(struct dirent))
+
+/*
+ * Hashed directory: a T_DIR whose major (unused by directories) has
+ * DIR_HASHED set. Block 0 is the index, mapping each of DXNBUCKET
+ * buckets to the first block of its chain. Every other block belongs
+ * to one chain and holds DPB - 1 entries after a one-slot header
+ * whose ent[0] is the next block of the chain, 0 at the end.
+ *
+ * All bookkeeping lives in slots whose first halfword is 0, so a reader
+ * that scans the file linearly sees nothing but free entries there.
+ *
+ * DXNBUCKET is kept well below MAXFILE so that every bucket can grow a
+ * chain of several blocks before the directory reaches its size limit.
+ */
+#define DIR_HASHED 0x1
+
+#define DXMAGIC   0xd1c7
+#define DXSLOTN   (sizeof(struct dirent) / sizeof(uint16_t) - 1)
+#define DXNBUCKET 32
+
+struct dxslot {
+    uint16_t zero;  // Always 0, aliases dirent.inum
+    uint16_t ent[DXSLOTN];
+};
+
+/* FNV-1a hash of a directory entry name, reduced to a bucket. */
+static inline uint32_t
+dxhash(const char* name)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < DIRSIZ && name[i]; ++i)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h % DXNBUCKET;
+}
+
 struct stat;
 
 #define T_DIR  1  // Directory
@@ -0,0 +1,9 @@
+#ifndef INC_FUTEX_H_
+#define INC_FUTEX_H_
+
+#include <stdint.h>
+
+void futex_init();
+int futex_wakeup(uint64_t, int);
+
+#endif  // INC_FUTEX_H_
@@ -0,0 +1,15 @@
+#ifndef INC_IPI_H_
+#define INC_IPI_H_
+
+/* Reasons for an IPI, the bits of mailbox 0. */
+#define IPI_WAKE (1 << 0) /* Something became runnable */
+#define IPI_CALL (1 << 1) /* Run the calls queued for this CPU */
+
+void ipi_init();
+void ipi_send(int, int);
+void ipi_handle();
+void smp_call_function_single(int, void (*)(void*), void*, int);
+void smp_call_function(void (*)(void*), void*, int);
+void ipi_test();
+
+#endif  // INC_IPI_H_
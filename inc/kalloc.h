@@ -1,10 +1,18 @@
 #ifndef INC_KALLOC_H_
 #define INC_KALLOC_H_
 
+#ifndef NHUGEPAGE
+#    define NHUGEPAGE 32  // 2 MiB blocks kept for huge user pages
+#endif
+
 void alloc_init();
 char* kalloc();
+char* kalloc_zeroed();
 void kfree(char*);
 void free_range(void*, void*);
+char* kalloc_huge();
+void kfree_huge(char*);
+void register_shrinker(int (*)());
 void check_free_list();
 
 #endif  // INC_KALLOC_H_
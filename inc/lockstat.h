@@ -0,0 +1,22 @@
+#ifndef INC_LOCKSTAT_H_
+#define INC_LOCKSTAT_H_
+
+#include <stdint.h>
+
+/*
+ * Lock contention statistics, kept per lock class, which is all the
+ * spinlocks or all the sleeplocks of one name. Built in with
+ * `make LOCKSTAT=1`, and read from device LOCKSTAT_MAJOR, sorted by
+ * contention. Times are in CNTPCT ticks.
+ */
+
+#define LOCKSTAT_MAJOR 2
+
+struct lockstat;
+
+void lockstat_init();
+struct lockstat* lockstat_class(char* name, int sleep);
+void lockstat_acquired(struct lockstat* ls, int contended, uint64_t wait);
+void lockstat_released(struct lockstat* ls, uint64_t hold);
+
+#endif  // INC_LOCKSTAT_H_
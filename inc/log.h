@@ -5,6 +5,7 @@ struct buf;
 
 void initlog(int);
 void log_write(struct buf*);
+void log_defer();
 void begin_op();
 void end_op();
 
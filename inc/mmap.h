@@ -0,0 +1,31 @@
+#ifndef INC_MMAP_H_
+#define INC_MMAP_H_
+
+#include <stdint.h>
+
+#define NVMA     32          // Mapped regions per address space
+#define MMAPBASE 0x40000000  // Lowest address mmap() picks, top of the heap
+#define MMAPTOP  0x70000000  // Top of the mmap() area
+#define VDSOBASE 0x70000000  // vDSO page, see kern/vdso.c
+#define VDSOTOP  0x70001000  // Top of user memory
+
+struct inode;
+struct mm;
+
+/*
+ * A region created by mmap(), [start, end) page aligned.
+ * Unused when end is 0.
+ */
+struct vma {
+    uint64_t start;
+    uint64_t end;
+    int prot;
+    int flags;
+    struct inode* ip;  // File mapped, or NULL for anonymous memory
+    uint64_t off;      // File offset of start
+};
+
+int vma_copy(struct mm*, struct mm*);
+void vma_free(struct mm*);
+
+#endif  // INC_MMAP_H_
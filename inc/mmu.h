@@ -42,6 +42,7 @@
 #define PTE_RO     (1 << 7)  /* read-only */
 #define PTE_SH     (3 << 8)  /* Shareability */
 #define PTE_AF     (1 << 10) /* P2066 access flags */
+#define PTE_SHARED (1UL << 55) /* software: page belongs to the page cache */
 /* Address in page table or page directory entry */
 #define PTE_ADDR(pte)      ((uint64_t)(pte) & ~(PGSIZE - 1))
 #define PTE_FLAGS(pte)     ((uint64_t)(pte) & (PGSIZE - 1))
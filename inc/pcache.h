@@ -0,0 +1,38 @@
+#ifndef INC_PCACHE_H_
+#define INC_PCACHE_H_
+
+#include <stdint.h>
+
+#include "types.h"
+
+#define NPAGE 256  // Page cache descriptors
+
+/*
+ * A page of file data, PGSIZE bytes starting at index * PGSIZE.
+ * Pages are keyed by (dev, inum) rather than by inode cache entry,
+ * so they outlive the entry. inum is 0 once the page has been dropped.
+ */
+struct page {
+    uint32_t dev;
+    uint32_t inum;
+    uint32_t index;      // File offset / PGSIZE
+    int ref;             // Users, including every user mapping
+    int valid;           // data has been read from the file?
+    char* data;          // Page from kalloc(), or NULL
+    struct page* hnext;  // Hash chain
+    struct page* dnext;  // Chain of pages by data address
+    struct page* prev;   // Unreferenced pages, less recent
+    struct page* next;   // Unreferenced pages, more recent
+};
+
+void pcache_init();
+void pcache_dump();
+struct page* pcache_get(uint32_t, uint32_t, uint32_t);
+void pcache_dup(struct page*);
+void pcache_put(struct page*);
+void pcache_write(uint32_t, uint32_t, size_t, char*, size_t);
+void pcache_drop(uint32_t, uint32_t);
+void pcache_pin(char*);
+void pcache_unpin(char*);
+
+#endif  // INC_PCACHE_H_
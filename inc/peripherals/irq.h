@@ -25,6 +25,7 @@
 #define IRQ_SRC_CORE(i)         (LOCAL_BASE + 0x60 + 4*(i))
 #define IRQ_TIMER               (1 << 11)   /* Local Timer */
 #define IRQ_GPU                 (1 << 8)
+#define IRQ_MBOX(m)             (1 << (4 + (m)))
 #define IRQ_CNTPNSIRQ           (1 << 1)    /* Core Timer */
 
 /* Local timer */
@@ -44,4 +45,10 @@
 #define CORE_TIMER_CTRL(i)      (LOCAL_BASE + 0x40 + 4*(i))
 #define CORE_TIMER_ENABLE       (1 << 1)    /* CNTPNSIRQ */
 
+/* Core mailboxes: writing sets bits, writing to clear clears them */
+#define CORE_MBOX_CTRL(i)       (LOCAL_BASE + 0x50 + 4*(i))
+#define CORE_MBOX_SET(i, m)     (LOCAL_BASE + 0x80 + 16*(i) + 4*(m))
+#define CORE_MBOX_CLR(i, m)     (LOCAL_BASE + 0xC0 + 16*(i) + 4*(m))
+#define MBOX_IRQ(m)             (1 << (m))
+
 #endif  // INC_PERIPHERALS_IRQ_H_
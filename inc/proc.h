@@ -4,6 +4,8 @@
 #include <stddef.h>
 
 #include "arm.h"
+#include "mmap.h"
+#include "sleeplock.h"
 #include "spinlock.h"
 #include "trap.h"
 
@@ -12,11 +14,28 @@
 #define NOFILE     16   /* open files per process */
 #define KSTACKSIZE 4096 /* size of per-process kernel stack */
 
+/* Flags of clone(), as in Linux. */
+#define CSIGNAL              0xff     /* Signal sent to the parent at exit */
+#define CLONE_VM             0x100    /* Share the address space */
+#define CLONE_FS             0x200    /* Share cwd; ignored */
+#define CLONE_FILES          0x400    /* Share the file descriptor table */
+#define CLONE_SIGHAND        0x800    /* Share signal handlers; ignored */
+#define CLONE_VFORK          0x4000   /* Parent sleeps until exec or exit */
+#define CLONE_THREAD         0x10000  /* Join the caller's thread group */
+#define CLONE_SYSVSEM        0x40000  /* Share semaphore undo; ignored */
+#define CLONE_SETTLS         0x80000  /* Set tpidr_el0 */
+#define CLONE_PARENT_SETTID  0x100000 /* Store the child's tid for the caller */
+#define CLONE_CHILD_CLEARTID 0x200000 /* Clear the child's tid at its exit */
+#define CLONE_DETACHED       0x400000 /* Ignored */
+
 #define thiscpu (&cpus[cpuid()])
 
 struct cpu {
     struct context* scheduler; /* swtch() here to enter scheduler */
     struct proc* proc;         /* The process running on this cpu or null */
+    uint64_t epoch;            /* Passes through the scheduler, see rcu.c */
+    int idle;                  /* In wfi with nothing to run, see proc.c */
+    int resched;               /* Quantum is up, see timer.c */
 };
 
 extern struct cpu cpus[];
@@ -38,6 +57,28 @@ struct context {
     uint64_t x30;  // Procedure Link Register
 };
 
+/*
+ * An address space, shared by the threads of a process, and by a
+ * vfork() child until it calls exec() or exit().
+ */
+struct mm {
+    int ref;                // Processes using it
+    struct sleeplock lock;  // Held to change the fields below
+    uint64_t* pgdir;        // Page table
+    uint64_t sz;            // Size of memory below MMAPBASE (bytes)
+    struct vma vma[NVMA];   // Regions created by mmap()
+};
+
+/*
+ * A file descriptor table, shared by the threads of a process.
+ */
+struct fdtable {
+    int ref;                     // Processes using it
+    struct spinlock lock;        // Held to change the fields below
+    struct file* ofile[NOFILE];  // Open files
+    uint32_t cloexec;            // Bit fd set: exec() closes ofile[fd]
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 struct proc {
@@ -48,20 +89,24 @@ struct proc {
     void* chan;            // If non-zero, sleeping on chan
     int killed;            // If non-zero, have been killed
     int xstate;            // Exit status to be returned to parent's wait
-    int pid;               // Process ID
+    int pid;               // Process ID, the thread ID to user code
+    int tgid;              // Thread group ID, the pid of its first thread
+    struct proc* vfork;    // Parent asleep in clone(), whose memory we use
+    int cpu;               // CPU to run on only, or -1 for any
 
     // wait_lock must be held when using these:
     struct proc* parent;  // Parent process
 
     // no lock needs to be held when using these:
-    char* kstack;                // Bottom of kernel stack for this process
-    uint64_t sz;                 // Size of process memory (bytes)
-    uint64_t* pgdir;             // Page table
-    struct trapframe* tf;        // Trapframe for current syscall
-    struct context* context;     // swtch() here to run process
-    struct file* ofile[NOFILE];  // Open files
-    struct inode* cwd;           // Current directory
-    char name[16];               // Process name (debugging)
+    char* kstack;             // Bottom of kernel stack for this process
+    struct mm* mm;            // Address space, NULL for a kernel thread
+    struct fdtable* files;    // Open files
+    struct trapframe* tf;     // Trapframe for current syscall
+    struct context* context;  // swtch() here to run process
+    struct inode* cwd;        // Current directory
+    uint64_t clear_tid;       // User address exit() zeroes, if not 0
+    uint64_t splitseq;        // Block splits seen at its last fault
+    char name[16];            // Process name (debugging)
 };
 
 static inline struct proc*
@@ -73,13 +118,22 @@ thisproc()
 void proc_init();
 void user_init();
 void scheduler();
+int idle_claim();
 void exit(int);
+void exit_group(int);
 void sleep(void*, struct spinlock*);
+void sleep_until(void*, struct spinlock*, uint64_t);
 void wakeup(void*);
 void yield();
 int growproc(int);
-int fork();
-int wait();
+int clone(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+struct proc* kthread_create(void (*)(void*), void*, int, char*);
+void vfork_done(struct proc*);
+int wait(int, int*);
+struct mm* mm_alloc();
+void mm_put(struct mm*);
+struct fdtable* fdtable_copy(struct fdtable*);
+void fdtable_put(struct fdtable*);
 void proc_dump();
 void trapframe_dump(struct proc*);
 
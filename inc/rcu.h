@@ -0,0 +1,7 @@
+#ifndef INC_RCU_H_
+#define INC_RCU_H_
+
+void rcu_quiescent();
+void synchronize_rcu();
+
+#endif  // INC_RCU_H_
@@ -1,19 +1,34 @@
 #ifndef INC_SLEEPLOCK_H_
 #define INC_SLEEPLOCK_H_
 
-#include "proc.h"
 #include "spinlock.h"
 
-/* Long-term locks for processes */
+struct sleepwaiter;
+
+/*
+ * Long-term locks for processes, held by one process, or shared by
+ * any number of readers. acquiresleep() spins for a while if the
+ * owner is running on another CPU, and only then sleeps, in line;
+ * a release wakes the first process in line, or the first readers.
+ * A reader doesn't pass processes in line, so writers don't starve.
+ */
 struct sleeplock {
-    int locked;         /* Is the lock held? */
-    struct spinlock lk; /* Spinlock protecting this sleep lock */
-    int pid;
+    int locked;                  /* Is the lock held? */
+    int readers;                 /* Readers sharing the lock */
+    struct spinlock lk;          /* Spinlock protecting this sleep lock */
+    struct proc* owner;          /* Process holding the lock */
+    struct sleepwaiter* waiters; /* Processes asleep on the lock */
+#ifdef LOCKSTAT
+    struct lockstat* stat;
+    uint64_t since;
+#endif
 };
 
 void initsleeplock(struct sleeplock* lk, char* name);
 void acquiresleep(struct sleeplock* lk);
 void releasesleep(struct sleeplock* lk);
 int holdingsleep(struct sleeplock* lk);
+void acquiresleep_shared(struct sleeplock* lk);
+void releasesleep_shared(struct sleeplock* lk);
 
 #endif  // INC_SLEEPLOCK_H_
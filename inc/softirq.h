@@ -0,0 +1,29 @@
+#ifndef INC_SOFTIRQ_H_
+#define INC_SOFTIRQ_H_
+
+#include <stdint.h>
+
+/*
+ * A tasklet is work an interrupt handler defers, to run soon after
+ * with interrupts masked but outside the handler, on an idle CPU if
+ * there is one. A tasklet scheduled again before it runs runs once,
+ * and never runs on two CPUs at once. It must not sleep.
+ */
+struct tasklet {
+    void (*fn)(void*);
+    void* arg;
+    struct tasklet* next;
+    int state;        /* TASKLET_SCHED and TASKLET_RUN */
+    uint64_t queued;  /* When it was scheduled */
+};
+
+#define TASKLET_SCHED 1 /* Queued to run */
+#define TASKLET_RUN   2 /* Running */
+
+#define TASKLET_INIT(fn, arg) {(fn), (arg)}
+
+void softirq_init();
+void tasklet_schedule(struct tasklet*);
+void softirq_run();
+
+#endif  // INC_SOFTIRQ_H_
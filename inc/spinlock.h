@@ -1,17 +1,37 @@
 #ifndef INC_SPINLOCK_H_
 #define INC_SPINLOCK_H_
 
+#include <stdint.h>
+
+struct lockstat;
+
+/*
+ * A ticket lock: acquire() takes the next ticket and waits until the
+ * owner count comes round to it, so CPUs get the lock in the order
+ * they asked for it. The lock is free when owner equals next.
+ */
 struct spinlock {
-    volatile int locked;
+    union {
+        volatile uint32_t ticket; /* Both counts, owner in the low half. */
+        struct {
+            volatile uint16_t owner; /* Ticket holding the lock. */
+            volatile uint16_t next;  /* Next ticket to hand out. */
+        };
+    };
 
     /* For debugging: */
     char* name;      /* Name of lock. */
     struct cpu* cpu; /* The cpu holding the lock. */
+#ifdef LOCKSTAT
+    struct lockstat* stat; /* Counters for the name, see lockstat.h. */
+    uint64_t since;        /* When the lock was taken. */
+#endif
 };
 
 int holding(struct spinlock*);
 void acquire(struct spinlock*);
 void release(struct spinlock*);
 void initlock(struct spinlock*, char*);
+void lock_test();
 
 #endif  // INC_SPINLOCK_H_
@@ -110,51 +110,22 @@ strfind(const char* s, char c)
     return (char*)s;
 }
 
-static inline void*
-memset(void* v, int c, size_t n)
-{
-    char* p = (char*)v;
-    int m = n;
-    while (--m >= 0) *p++ = c;
-    return v;
-}
-
-static inline void*
-memmove(void* dst, const void* src, size_t n)
-{
-    const char* s = (char*)src;
-    char* d = (char*)dst;
-
-    if (s < d && s + n > d) {
-        s += n;
-        d += n;
-        while (n-- > 0) *--d = *--s;
-    } else {
-        while (n-- > 0) *d++ = *s++;
-    }
-
-    return dst;
-}
-
-static inline void*
-memcpy(void* dst, const void* src, size_t n)
-{
-    return memmove(dst, src, n);
-}
-
-static inline int
-memcmp(const void* v1, const void* v2, size_t n)
-{
-    const uint8_t* s1 = (const uint8_t*)v1;
-    const uint8_t* s2 = (const uint8_t*)v2;
-
-    while (n-- > 0) {
-        if (*s1 != *s2) return (int)*s1 - (int)*s2;
-        s1++, s2++;
-    }
-
-    return 0;
-}
+/*
+ * Memory routines in kern/string.S.
+ * copy_page() and clear_page() take page-aligned addresses.
+ * The _neon variants move 64 bytes per iteration through q registers;
+ * they save the registers they use and mask IRQs while they run,
+ * so any kernel code may call them.
+ */
+void* memset(void*, int, size_t);
+void* memmove(void*, const void*, size_t);
+void* memcpy(void*, const void*, size_t);
+int memcmp(const void*, const void*, size_t);
+void copy_page(void*, const void*);
+void clear_page(void*);
+void* memcpy_neon(void*, const void*, size_t);
+void* memset_neon(void*, int, size_t);
+void string_test();
 
 static inline void*
 memfind(const void* s, int c, size_t n)
@@ -209,4 +180,25 @@ strtol(const char* s, char** endptr, int base)
     return (neg ? -val : val);
 }
 
+/* Append s to the line at *p, padded or cut to w columns. */
+static inline void
+put_str(char** p, const char* s, int w)
+{
+    int i = 0;
+    for (; i < w && s[i]; i++) *(*p)++ = s[i];
+    for (; i < w; i++) *(*p)++ = ' ';
+}
+
+/* Append x to the line at *p, right-aligned in w columns. */
+static inline void
+put_num(char** p, uint64_t x, int w)
+{
+    char d[20];
+    int n = 0;
+    do d[n++] = '0' + x % 10;
+    while (x /= 10);
+    while (w-- > n) *(*p)++ = ' ';
+    while (n) *(*p)++ = d[--n];
+}
+
 #endif  // INC_STRING_H_
@@ -7,20 +7,24 @@
 #include "types.h"
 
 #define MAXARG   32
+#define MAXPATH  128  // Longest path name a system call takes
 
 // kern/syscall.c
 
 int fetchint(uint64_t, int64_t*);
-int fetchstr(uint64_t, char**);
+int fetchstr(uint64_t, char*, size_t);
 int argint(int, uint64_t*);
-int argptr(int, char**, int);
-int argstr(int, char**);
+int argstr(int, char*, size_t);
 
 // kern/syscall1.c
 
 int sys_gettid();
+int sys_getpid();
+int sys_set_tid_address();
+int sys_madvise();
 int sys_ioctl();
 int sys_rt_sigprocmask();
+int sys_rt_sigaction();
 
 // kern/sysproc.c
 
@@ -30,13 +34,21 @@ size_t sys_brk();
 int sys_clone();
 int sys_wait4();
 int sys_exit();
+int sys_exit_group();
+int sys_clock_gettime();
 
 // kern/sysfile.c
 
 int sys_dup();
 ssize_t sys_read();
 ssize_t sys_write();
+ssize_t sys_pread64();
+ssize_t sys_pwrite64();
 ssize_t sys_writev();
+ssize_t sys_splice();
+ssize_t sys_vmsplice();
+ssize_t sys_sendfile();
+ssize_t sys_getdents64();
 int sys_close();
 int sys_fstat();
 int sys_fstatat();
@@ -44,6 +56,21 @@ int sys_openat();
 int sys_mkdirat();
 int sys_mknodat();
 int sys_chdir();
+int sys_pipe2();
+int sys_fcntl();
+
+// kern/futex.c
+int sys_futex();
+
+// kern/timer.c
+int sys_nanosleep();
+int sys_clock_nanosleep();
+
+// kern/mmap.c
+
+uint64_t sys_mmap();
+int sys_munmap();
+int sys_mprotect();
 
 // kern/exec.c
 
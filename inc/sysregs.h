@@ -24,6 +24,10 @@
 #define CPACR_TRACE_EN (0 << 28)
 #define CPACR_VALUE    (CPACR_FP_EN | CPACR_TRACE_EN)
 
+/* CNTKCTL_EL1, Counter-timer Kernel Control Register. */
+#define CNTKCTL_EL0VCTEN (1 << 1) /* EL0 may read CNTVCT_EL0 and CNTFRQ_EL0 */
+#define CNTKCTL_VALUE    CNTKCTL_EL0VCTEN
+
 /* SCR_EL3, Secure Configuration Register (EL3). */
 #define SCR_RESERVED (3 << 4)
 #define SCR_RW       (1 << 10)
@@ -40,11 +44,12 @@
 #define SPSR_EL2_VALUE (SPSR_MASK_ALL | SPSR_EL1h)
 
 /* Exception Class in ESR_EL1. */
-#define EC_SHIFT   26
-#define EC_UNKNOWN 0x00
-#define EC_SVC64   0x15
-#define EC_DABORT  0x24
-#define EC_IABORT  0x20
+#define EC_SHIFT      26
+#define EC_UNKNOWN    0x00
+#define EC_SVC64      0x15
+#define EC_DABORT     0x24
+#define EC_DABORT_EL1 0x25 /* Data abort without a change of EL */
+#define EC_IABORT     0x20
 
 #define ISS_MASK 0xFFFFFF
 
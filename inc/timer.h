@@ -1,8 +1,35 @@
 #ifndef INC_TIMER_H_
 #define INC_TIMER_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef QUANTUM_US
+#    define QUANTUM_US 10000  // Time slice of a process, in microseconds
+#endif
+
+/*
+ * A one-shot timer, which calls fn(arg) from the timer interrupt of
+ * the CPU it was started on once the system counter reaches expires.
+ * fn runs with interrupts masked, must not sleep, and must not start
+ * its own timer again.
+ */
+struct hrtimer {
+    uint64_t expires;
+    void (*fn)(void*);
+    void* arg;
+    struct hrtimer* next;
+    int cpu;  // CPU it is queued or running on, or -1
+};
+
+#define HRTIMER_INIT(fn, arg) {0, (fn), (arg), NULL, -1}
+
 void timer_init();
-void timer_reset();
-void timer();
+void hrtimer_start(struct hrtimer*, uint64_t);
+void hrtimer_cancel(struct hrtimer*);
+void hrtimer_run();
+void tick_start();
+void tick_stop();
+uint64_t timer_quantum(uint64_t);
 
 #endif  // INC_TIMER_H_
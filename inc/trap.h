@@ -48,8 +48,37 @@ struct trapframe {
     uint64_t x30;  // Procedure Link Register
 };
 
+/* Device of the interrupt statistics and routing, see kern/trap.c. */
+#define IRQSTAT_MAJOR 3
+
+/* Sources of interrupts counted in struct irqstat. */
+enum {
+    ISRC_TIMER,  // Core timer, the scheduler tick
+    ISRC_CLOCK,  // Local timer
+    ISRC_IPI,
+    ISRC_UART,
+    ISRC_SD,
+    ISRC_OTHER,
+    NISRC
+};
+
+/*
+ * Interrupts taken by a CPU, by source, how late its core timer's
+ * were handled, and the tasklets it ran. Times are in CNTPCT ticks.
+ */
+struct irqstat {
+    uint64_t count[NISRC];
+    uint64_t late, maxlate;    // From the core timer firing to its handler
+    uint64_t tasklets;         // Tasklets run
+    uint64_t delay, maxdelay;  // From tasklet_schedule() to running
+} __attribute__((aligned(64)));
+
+extern struct irqstat irqstat[];
+
 void trap(struct trapframe*);
 void irq_init();
+int irq_handle();
+void irq_idle(int);
 void irq_error();
 
 #endif  // INC_TRAP_H_
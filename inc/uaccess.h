@@ -0,0 +1,39 @@
+#ifndef INC_UACCESS_H_
+#define INC_UACCESS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Copies between the kernel and the user memory of the current
+ * process, in kern/uaccess.S. A user address that user code could not
+ * access itself makes them return -EFAULT rather than fault; what was
+ * copied before the bad byte is left in place.
+ */
+
+/* Copy n bytes from user address usrc to dst. Return 0 or -EFAULT. */
+long copy_from_user(void* dst, const void* usrc, size_t n);
+
+/* Copy n bytes from src to user address udst. Return 0 or -EFAULT. */
+long copy_to_user(void* udst, const void* src, size_t n);
+
+/*
+ * Copy the string at user address usrc to dst, at most n bytes with
+ * the nul. Return its length without the nul, n if it has no nul in
+ * the first n bytes (dst is not terminated then), or -EFAULT.
+ */
+long strncpy_from_user(char* dst, const char* usrc, size_t n);
+
+/*
+ * An entry of the exception table, which the linker gathers into
+ * [ex_table, eex_table): a user access instruction and where to go
+ * when it faults.
+ */
+struct exentry {
+    uint64_t insn;
+    uint64_t fixup;
+};
+
+void uaccess_test();
+
+#endif  // INC_UACCESS_H_
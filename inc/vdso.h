@@ -0,0 +1,10 @@
+#ifndef INC_VDSO_H_
+#define INC_VDSO_H_
+
+struct mm;
+
+void vdso_init();
+int vdso_map(struct mm*);
+void vdso_unmap(struct mm*);
+
+#endif  // INC_VDSO_H_
@@ -6,17 +6,27 @@
 #include "file.h"
 #include "proc.h"
 
-void vm_free(uint64_t*, int);
+int map_region(uint64_t*, void*, uint64_t, uint64_t, int64_t);
+char* uvm_page(uint64_t*, uint64_t, uint64_t*);
+char* uvm_addr(uint64_t*, uint64_t);
+char* uvm_unmap_page(uint64_t*, uint64_t, uint64_t*);
+void vm_free(uint64_t*);
 void uvm_clear(uint64_t*, char*);
 uint64_t* pgdir_init();
 void uvm_init(uint64_t*, char*, uint64_t);
 int uvm_load(uint64_t*, char*, struct inode*, uint64_t, uint64_t);
+int uvm_share(uint64_t*, char*, struct inode*, uint64_t, uint64_t);
 uint64_t uvm_alloc(uint64_t*, uint64_t, uint64_t);
 uint64_t uvm_dealloc(uint64_t*, uint64_t, uint64_t);
 void uvm_switch(struct proc*);
+void flush_tlb();
+void tlb_shootdown(uint64_t, uint64_t);
+int uvm_split_fault(uint32_t);
 int uvm_copy(uint64_t*, uint64_t*, uint64_t);
 int copyout(uint64_t*, uint64_t, char*, uint64_t);
 
 void check_map_region();
+void check_huge_pages();
+void check_uvm_range();
 
 #endif  // INC_VM_H_
@@ -0,0 +1,27 @@
+#ifndef INC_WORKQUEUE_H_
+#define INC_WORKQUEUE_H_
+
+/*
+ * Work is deferred to a kernel thread, unlike a tasklet's, so it may
+ * sleep: take sleeplocks, wait for the disk, or allocate memory. Work
+ * queued again before it starts runs once.
+ */
+struct work {
+    void (*fn)(void*);
+    void* arg;
+    struct work* next;
+    int pending;  // Queued and not yet started
+};
+
+#define WORK_INIT(fn, arg) {(fn), (arg)}
+
+struct workqueue;
+
+extern struct workqueue* system_wq;
+
+void workqueue_init();
+struct workqueue* workqueue_create(char*);
+int queue_work(struct workqueue*, struct work*);
+int queue_work_on(int, struct workqueue*, struct work*);
+
+#endif  // INC_WORKQUEUE_H_
@@ -47,7 +47,7 @@ console_write(struct inode* ip, char* buf, ssize_t n)
 }
 
 static ssize_t
-console_read(struct inode* ip, char* dst, ssize_t n)
+console_read(struct inode* ip, char* dst, size_t off, ssize_t n)
 {
     iunlock(ip);
     size_t target = n;
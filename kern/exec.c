@@ -4,6 +4,7 @@
 #include "file.h"
 #include "log.h"
 #include "memlayout.h"
+#include "mmap.h"
 #include "mmu.h"
 #include "proc.h"
 #include "string.h"
@@ -25,12 +26,18 @@ execve(char* path, char* const argv[], char* const envp[])
         cprintf("exec: failed to read program file at '%s'.\n", path);
         return -1;
     }
-    ilock(ip);
+    ilock_shared(ip);
 
     // Check ELF header.
 
+    struct mm* mm = NULL;
+    struct fdtable* files = NULL;
     uint64_t* pgdir = NULL;
     Elf64_Ehdr elf;
+    if (ip->type != T_FILE) {
+        cprintf("exec: not a regular file.\n");
+        goto bad;
+    }
     if (readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf)) {
         cprintf("exec: failed to read ELF.\n");
         goto bad;
@@ -39,11 +46,11 @@ execve(char* path, char* const argv[], char* const envp[])
         cprintf("exec: check ELF header failed.\n");
         goto bad;
     }
-    pgdir = pgdir_init();
-    if (!pgdir) {
+    if (!(mm = mm_alloc())) {
         cprintf("exec: failed to init pgdir.\n");
         goto bad;
     }
+    pgdir = mm->pgdir;
 
     // Load program into memory.
 
@@ -64,22 +71,45 @@ execve(char* path, char* const argv[], char* const envp[])
             cprintf("exec: addr overflowed.\n");
             goto bad;
         }
+        if (ph.p_vaddr % PGSIZE) {
+            cprintf("exec: addr not page aligned.\n");
+            goto bad;
+        }
+
+        // The whole pages of a read-only segment are shared from the
+        // page cache, if no earlier segment reaches into them; the
+        // rest is copied into private memory.
+        uint64_t shared = 0;
+        if (!(ph.p_flags & PF_W) && ph.p_offset % PGSIZE == 0
+            && ROUNDUP(sz, PGSIZE) <= ph.p_vaddr) {
+            if (sz < ph.p_vaddr) sz = uvm_alloc(pgdir, sz, ph.p_vaddr);
+            if (!sz) {
+                cprintf("exec: failed to allocate uvm.\n");
+                goto bad;
+            }
+            shared = ROUNDDOWN(ph.p_filesz, PGSIZE);
+            if (uvm_share(pgdir, (char*)ph.p_vaddr, ip, ph.p_offset, shared)
+                < 0) {
+                cprintf("exec: failed to share text.\n");
+                goto bad;
+            }
+            sz = ph.p_vaddr + shared;
+        }
         sz = uvm_alloc(pgdir, sz, ph.p_vaddr + ph.p_memsz);
         if (!sz) {
             cprintf("exec: failed to allocate uvm.\n");
             goto bad;
         }
-        if (ph.p_vaddr % PGSIZE) {
-            cprintf("exec: addr not page aligned.\n");
-            goto bad;
-        }
-        if (uvm_load(pgdir, (char*)ph.p_vaddr, ip, ph.p_offset, ph.p_filesz)
+        if (uvm_load(
+                pgdir, (char*)ph.p_vaddr + shared, ip, ph.p_offset + shared,
+                ph.p_filesz - shared)
             < 0) {
             cprintf("exec: failed to load uvm.\n");
             goto bad;
         }
     }
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     end_op();
     ip = NULL;
 
@@ -96,53 +126,60 @@ execve(char* path, char* const argv[], char* const envp[])
     uvm_clear(pgdir, (char*)(sz - 2 * PGSIZE));
     uint64_t sp = sz;
 
-    // Push auxiliary vectors.
-
-    uint64_t auxv[] = {0, AT_PAGESZ, PGSIZE, AT_NULL};
-    sp -= sizeof(auxv);
-    sp -= sp % 0x10;  // 16-byte aligned
-    if (copyout(pgdir, sp, (char*)auxv, sizeof(auxv)) < 0) {
-        cprintf("exec: failed to push auxiliary vectors.\n");
-        goto bad;
-    }
-
-    // FIXME: Push environment pointers.
-    sp -= 8;
-    sp -= sp % 0x10;
-    if (copyout(pgdir, sp, (char*)envp, 8) < 0) {
-        cprintf("exec: failed to push environment pointers.\n");
-        goto bad;
-    }
-
     // Push argument strings.
 
     uint64_t argc = 0;
-    uint64_t ustack[MAXARG + 1];
+    uint64_t ustack[MAXARG + 9];
     for (; argv[argc]; ++argc) {
         if (argc >= MAXARG) {
             cprintf("exec: too many arguments.\n");
             goto bad;
         }
-        sp -= strlen(argv[argc]) + 1;
-        sp -= sp % 0x10;
-        if (copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0) {
+        uint64_t n = strlen(argv[argc]) + 1;
+        if (n > sp - (sz - PGSIZE)) {
+            cprintf("exec: arguments too long.\n");
+            goto bad;
+        }
+        sp -= n;
+        if (copyout(pgdir, sp, argv[argc], n) < 0) {
             cprintf("exec: failed to push argument strings.\n");
             goto bad;
         }
-        ustack[argc] = sp;
+        ustack[1 + argc] = sp;
     }
-    ustack[argc] = 0;
-    ustack[0] = argc;
 
-    uint64_t stack_size = (argc + 1) * sizeof(uint64_t);
-    sp -= stack_size;
-    sp -= sp % 0x10;
+    // Push argc, argv[], an empty envp[] and auxv[],
+    // where the C library's _start looks for them.
+    // FIXME: Push environment strings.
+    uint64_t* u = ustack;
+    *u++ = argc;
+    u += argc;
+    *u++ = 0;
+    *u++ = 0;
+    *u++ = AT_PAGESZ;
+    *u++ = PGSIZE;
+    *u++ = AT_SYSINFO_EHDR;
+    *u++ = VDSOBASE;
+    *u++ = AT_NULL;
+    *u++ = 0;
+
+    uint64_t stack_size = (u - ustack) * sizeof(uint64_t);
+    if (stack_size + 0x10 > sp - (sz - PGSIZE)) {
+        cprintf("exec: arguments too long.\n");
+        goto bad;
+    }
+    sp = ROUNDDOWN(sp - stack_size, 0x10);  // 16-byte aligned
     if (copyout(pgdir, sp, (char*)ustack, stack_size) < 0) {
         cprintf("exec: failed to push argv[] pointers.\n");
         goto bad;
     }
 
+    // Close-on-exec must not close the files of other threads.
     struct proc* p = thisproc();
+    if (p->files->ref > 1 && !(files = fdtable_copy(p->files))) {
+        cprintf("exec: failed to copy file table.\n");
+        goto bad;
+    }
     p->tf->x1 = sp;
 
     // Save program name for debugging.
@@ -152,22 +189,38 @@ execve(char* path, char* const argv[], char* const envp[])
         if (*s == '/') last = s + 1;
     strncpy(p->name, last, sizeof(p->name));
 
-    // Commit to the user image.
-    uint64_t* old_pgdir = p->pgdir;
-    p->pgdir = pgdir;
-    p->sz = sz;
+    // Commit to the user image. Memory shared with other threads,
+    // or with a vfork() parent, stays theirs.
+    struct mm* old = p->mm;
+    mm->sz = sz;
+    p->mm = mm;
     p->tf->sp_el0 = sp;
     p->tf->elr_el1 = elf.e_entry;
     uvm_switch(p);
-    if (old_pgdir) vm_free(old_pgdir, 4);
+    mm_put(old);
+    if (p->vfork) vfork_done(p);
+
+    // Close the files marked close-on-exec.
+    if (files) {
+        fdtable_put(p->files);
+        p->files = files;
+    }
+    for (int fd = 0; fd < NOFILE; ++fd) {
+        if (p->files->cloexec >> fd & 1) {
+            file_close(p->files->ofile[fd]);
+            p->files->ofile[fd] = NULL;
+        }
+    }
+    p->files->cloexec = 0;
 
     cprintf("exec: end '%s'.\n", path);
     return argc;
 
 bad:
-    if (pgdir) vm_free(pgdir, 4);
+    if (mm) mm_put(mm);
     if (ip) {
-        iunlockput(ip);
+        iunlock_shared(ip);
+        iput(ip);
         end_op();
     }
 
@@ -4,7 +4,10 @@
 
 #include "file.h"
 #include "console.h"
+#include "kalloc.h"
 #include "log.h"
+#include "mmu.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "spinlock.h"
 #include "types.h"
@@ -72,12 +75,12 @@ file_close(struct file* f)
     f->type = FD_NONE;
     release(&ftable.lock);
 
-    if (ff.type == FD_INODE) {
+    if (ff.type == FD_PIPE) {
+        pipe_close(ff.pipe, ff.writable);
+    } else if (ff.type == FD_INODE) {
         begin_op();
         iput(ff.ip);
         end_op();
-    } else {
-        panic("\tfile_close: unsupported type.\n");
     }
 }
 
@@ -88,14 +91,54 @@ int
 file_stat(struct file* f, struct stat* st)
 {
     if (f->type == FD_INODE) {
-        ilock(f->ip);
+        ilock_shared(f->ip);
         stati(f->ip, st);
-        iunlock(f->ip);
+        iunlock_shared(f->ip);
         return 0;
     }
     return -1;
 }
 
+/*
+ * Lock inode ip of an open file to read it: shared, so that readers
+ * of one file don't wait for each other, unless excl is set or ip is
+ * a device, whose read may unlock and relock it. ip->type is fixed
+ * while the file holds a reference. Returns whether it is exclusive.
+ */
+static int
+ilock_read(struct inode* ip, int excl)
+{
+    if (excl || ip->type == T_DEV) {
+        ilock(ip);
+        return 1;
+    }
+    ilock_shared(ip);
+    return 0;
+}
+
+static void
+iunlock_read(struct inode* ip, int excl)
+{
+    if (excl)
+        iunlock(ip);
+    else
+        iunlock_shared(ip);
+}
+
+/*
+ * Read n bytes of inode file f at *off into addr, in kernel
+ * memory, and advance *off.
+ */
+static ssize_t
+inode_read(struct file* f, char* addr, size_t* off, ssize_t n, int excl)
+{
+    excl = ilock_read(f->ip, excl);
+    ssize_t r = readi(f->ip, addr, *off, n);
+    if (r > 0) *off += r;
+    iunlock_read(f->ip, excl);
+    return r;
+}
+
 /*
  * Read from file f.
  */
@@ -103,17 +146,60 @@ ssize_t
 file_read(struct file* f, char* addr, ssize_t n)
 {
     if (!f->readable) return -1;
+    if (f->type == FD_PIPE) return pipe_read(f->pipe, addr, n);
+    // Reads of a file shared by several descriptors, or by threads
+    // sharing a descriptor table, lock it exclusive, so that they
+    // don't read at one f->off at once.
     if (f->type == FD_INODE) {
-        ilock(f->ip);
-        int r = readi(f->ip, addr, f->off, n);
-        if (r > 0) f->off += r;
-        iunlock(f->ip);
-        return r;
+        int excl = f->ref > 1 || thisproc()->files->ref > 1;
+        return inode_read(f, addr, &f->off, n, excl);
     }
     panic("\tfile_read: unsupported type.\n");
     return 0;
 }
 
+/*
+ * Read from file f at off, leaving f->off alone.
+ */
+ssize_t
+file_pread(struct file* f, char* addr, ssize_t n, size_t off)
+{
+    if (!f->readable || f->type != FD_INODE) return -1;
+    return inode_read(f, addr, &off, n, 0);
+}
+
+/*
+ * Write n bytes at addr, in kernel memory, to inode file f
+ * at *off, and advance *off.
+ */
+static ssize_t
+inode_write(struct file* f, char* addr, size_t* off, ssize_t n)
+{
+    // Write a few blocks at a time to avoid exceeding the maximum log
+    // transaction size, including i-node, indirect block, allocation
+    // blocks, and 2 blocks of slop for non-aligned writes. This really
+    // belongs lower down, since writei() might be writing a device like the
+    // console.
+    int max = ((MAXOPBLOCKS - 4) / 2) * 512;
+    int i = 0;
+    while (i < n) {
+        int n1 = n - i;
+        if (n1 > max) n1 = max;
+
+        begin_op();
+        ilock(f->ip);
+        int r = writei(f->ip, addr + i, *off, n1);
+        if (r > 0) *off += r;
+        iunlock(f->ip);
+        end_op();
+
+        if (r < 0) break;
+        if (r != n1) panic("\tinode_write: partial data written.\n");
+        i += r;
+    }
+    return i == n ? n : -1;
+}
+
 /*
  * Write to file f.
  */
@@ -121,31 +207,136 @@ ssize_t
 file_write(struct file* f, char* addr, ssize_t n)
 {
     if (!f->writable) return -1;
-    if (f->type == FD_INODE) {
-        // Write a few blocks at a time to avoid exceeding the maximum log
-        // transaction size, including i-node, indirect block, allocation
-        // blocks, and 2 blocks of slop for non-aligned writes. This really
-        // belongs lower down, since writei() might be writing a device like the
-        // console.
-        int max = ((MAXOPBLOCKS - 4) / 2) * 512;
-        int i = 0;
-        while (i < n) {
-            int n1 = n - i;
-            if (n1 > max) n1 = max;
-
-            begin_op();
-            ilock(f->ip);
-            int r = writei(f->ip, addr + i, f->off, n1);
-            if (r > 0) f->off += r;
-            iunlock(f->ip);
-            end_op();
-
-            if (r < 0) break;
-            if (r != n1) panic("\tfile_write: partial data written.\n");
-            i += r;
-        }
-        return i == n ? n : -1;
-    }
+    if (f->type == FD_PIPE) return pipe_write(f->pipe, addr, n);
+    if (f->type == FD_INODE) return inode_write(f, addr, &f->off, n);
     panic("\tfile_write: unsupported type.\n");
     return 0;
 }
+
+/*
+ * Write to file f at off, leaving f->off alone.
+ */
+ssize_t
+file_pwrite(struct file* f, char* addr, ssize_t n, size_t off)
+{
+    if (!f->writable || f->type != FD_INODE) return -1;
+    return inode_write(f, addr, &off, n);
+}
+
+/*
+ * Get up to n bytes of inode file f at off as a buffer b, without
+ * copying them if they are in a page cache page, which b then holds
+ * a reference to. Release b with pipe_buf_release().
+ * Returns the length of b, 0 at end of file, or -1.
+ */
+static ssize_t
+inode_getbuf(struct file* f, size_t off, size_t n, struct pipe_buf* b)
+{
+    struct inode* ip = f->ip;
+    struct page* pg = NULL;
+    ssize_t r = -1;
+
+    int excl = ilock_read(ip, 0);
+    if (ip->type == T_FILE) {
+        if (off >= ip->size) {
+            iunlock_read(ip, excl);
+            return 0;
+        }
+        n = MIN(n, MIN(ip->size - off, PGSIZE - off % PGSIZE));
+        if ((pg = readpage(ip, off / PGSIZE))) {
+            *b = (struct pipe_buf){pg->data, pg, off % PGSIZE, n};
+            r = n;
+        }
+    }
+    if (!pg) {
+        // A device, or the page cache is exhausted: copy.
+        char* page = kalloc();
+        if (page && (r = readi(ip, page, off, MIN(n, PGSIZE))) > 0)
+            *b = (struct pipe_buf){page, NULL, 0, r};
+        else if (page)
+            kfree(page);
+    }
+    iunlock_read(ip, excl);
+    return r;
+}
+
+/*
+ * Move up to n bytes of file f at *off into pipe pi, advancing *off,
+ * lending it the page cache pages. Returns the number of bytes moved,
+ * or -1 if none could be.
+ */
+ssize_t
+file_splice_read(struct file* f, size_t* off, struct pipe* pi, size_t n)
+{
+    if (!f->readable || f->type != FD_INODE) return -1;
+
+    size_t tot = 0;
+    while (tot < n) {
+        struct pipe_buf b;
+        ssize_t r = inode_getbuf(f, *off, n - tot, &b);
+        if (r <= 0) return tot ? tot : r;
+        if (pipe_give(pi, &b) < 0) {
+            pipe_buf_release(&b);
+            return tot ? tot : -1;
+        }
+        *off += r;
+        tot += r;
+        // Devices return what they have; don't wait for more.
+        if (f->ip->type != T_FILE) break;
+    }
+    return tot;
+}
+
+/*
+ * Move up to n bytes out of pipe pi into file f, at *off if f is not
+ * a pipe, sleeping only while pi is empty at first. Buffers move to a
+ * pipe as they are, and are copied once into any other file.
+ * Returns the number of bytes moved, 0 at end of file, or -1.
+ */
+ssize_t
+file_splice_write(struct pipe* pi, struct file* f, size_t* off, size_t n)
+{
+    if (!f->writable) return -1;
+
+    size_t tot = 0;
+    while (tot < n) {
+        struct pipe_buf b;
+        ssize_t r = pipe_take(pi, &b, n - tot, !tot);
+        if (r <= 0) return tot ? tot : r;
+        if (f->type == FD_PIPE) {
+            if (pipe_give(f->pipe, &b) < 0) r = -1;
+        } else {
+            r = inode_write(f, b.data + b.off, off, b.len);
+        }
+        if (r < 0 || f->type != FD_PIPE) pipe_buf_release(&b);
+        if (r < 0) return tot ? tot : -1;
+        tot += r;
+    }
+    return tot;
+}
+
+/*
+ * Copy up to n bytes of file in at *off to file out, advancing *off,
+ * straight from the page cache, or lend the pages if out is a pipe.
+ * Returns the number of bytes copied, or -1 if none could be.
+ */
+ssize_t
+file_sendfile(struct file* out, struct file* in, size_t* off, size_t n)
+{
+    if (!out->writable || !in->readable || in->type != FD_INODE) return -1;
+    if (out->type == FD_PIPE) return file_splice_read(in, off, out->pipe, n);
+
+    size_t tot = 0;
+    while (tot < n) {
+        struct pipe_buf b;
+        ssize_t r = inode_getbuf(in, *off, n - tot, &b);
+        if (r <= 0) return tot ? tot : r;
+        r = inode_write(out, b.data + b.off, &out->off, b.len);
+        pipe_buf_release(&b);
+        if (r < 0) return tot ? tot : -1;
+        *off += r;
+        tot += r;
+        if (in->ip->type != T_FILE) break;
+    }
+    return tot;
+}
@@ -4,7 +4,8 @@
  *   Log: crash recovery for multi-step updates.
  *   Files: inode allocator, reading, writing, metadata.
  *   Directories: inode with special contents (list of other inodes!)
- *   Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
+ *   Names: paths like /usr/rtm/xv6/fs.c for convenient naming,
+ *     looked up without locks when every element is cached.
  *
  * This file contains the low-level file system manipulation
  * routines.  The (higher-level) system call implementations
@@ -16,9 +17,12 @@
 #include "buf.h"
 #include "console.h"
 #include "file.h"
+#include "kalloc.h"
 #include "log.h"
 #include "mmu.h"
+#include "pcache.h"
 #include "proc.h"
+#include "rcu.h"
 #include "sleeplock.h"
 #include "spinlock.h"
 #include "string.h"
@@ -27,6 +31,7 @@
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 static void itrunc(struct inode*);
+static void dcache_init();
 
 // There should be one superblock per disk device,
 // but we run with only one device.
@@ -122,18 +127,20 @@ bfree(int dev, uint32_t b)
  *   is non-zero. ialloc() allocates, and iput() frees if
  *   the reference and link counts have fallen to zero.
  *
- * * Referencing in cache: an entry in the inode cache
- *   is free if ip->ref is zero. Otherwise ip->ref tracks
- *   the number of in-memory pointers to the entry (open
- *   files and current directories). iget() finds or
- *   creates a cache entry and increments its ref; iput()
- *   decrements ref.
+ * * Referencing in cache: ip->ref tracks the number of
+ *   in-memory pointers to the entry (open files and current
+ *   directories). iget() finds or creates a cache entry and
+ *   increments its ref; iput() decrements ref. An entry whose
+ *   ref has fallen to zero keeps its contents and waits on an
+ *   LRU list, so that the next iget() of the same inode finds
+ *   it already valid.
  *
  * * Valid: the information (type, size, &c) in an inode
  *   cache entry is only correct when ip->valid is 1.
- *   ilock() reads the inode from
- *   the disk and sets ip->valid, while iput() clears
- *   ip->valid if ip->ref has fallen to zero.
+ *   ilock() reads the inode from the disk and sets ip->valid,
+ *   while iput() clears ip->valid when it frees the inode on
+ *   disk. An entry taken off the LRU list for another inode
+ *   starts out invalid.
  *
  * * Locked: file system code may only examine and modify
  *   the information in an inode and its content if it
@@ -157,33 +164,196 @@ bfree(int dev, uint32_t b)
  * have locked the inodes involved; this lets callers create
  * multi-step atomic operations.
  *
+ * The cache starts with NINODE static entries and grows a page
+ * of entries at a time while kalloc() can supply one. When memory
+ * runs out, kalloc() calls icache_shrink(), which gives back every
+ * grown page whose entries are all unreferenced.
+ *
  * The icache.lock spin-lock protects the allocation of icache
- * entries. Since ip->ref indicates whether an entry is free,
- * and ip->dev and ip->inum indicate which i-node an entry
- * holds, one must hold icache.lock while using any of those fields.
+ * entries, the hash chains and the LRU list. Since ip->ref
+ * indicates whether an entry is in use, and ip->dev and ip->inum
+ * indicate which i-node an entry holds, one must hold icache.lock
+ * while using any of those fields.
  *
  * An ip->lock sleep-lock protects all ip-> fields other than ref,
- * dev, and inum.  One must hold ip->lock in order to
+ * dev, inum and the list links. One must hold ip->lock in order to
  * read or write that inode's ip->valid, ip->size, ip->type, &c.
  */
 
+#define NIHASH 61  // Buckets in the inode hash table
+
+#define IPAGE_NINODE ((PGSIZE - sizeof(struct ipage*)) / sizeof(struct inode))
+
+/*
+ * A page of inode cache entries obtained from kalloc().
+ */
+struct ipage {
+    struct ipage* next;
+    struct inode inode[IPAGE_NINODE];
+};
+
 struct {
     struct spinlock lock;
     struct inode inode[NINODE];
+    struct inode* hash[NIHASH];
+    struct ipage* pages;  // Grown entries, returned under pressure
+    struct inode* dirty;  // Inodes updated since the last commit
+
+    // Linked list of unreferenced entries.
+    // head.next is most recent, head.prev is least.
+    // Entries that hold no inode are kept at the least-recent end.
+    struct inode head;
+
+    int ninode;        // Cache entries, static and grown
+    uint64_t nget;     // Calls to iget()
+    uint64_t nhit;     // iget() found the inode cached
+    uint64_t nread;    // Inode blocks read from disk by ilock()
+    uint64_t nahead;   // Inodes filled from a block read for another
+    uint64_t nflush;   // Inode blocks logged by iflush()
+    uint64_t nshrink;  // Pages given back to kalloc()
 } icache;
 
+static struct inode**
+ihash(uint32_t dev, uint32_t inum)
+{
+    return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+static struct inode*
+ifind(uint32_t dev, uint32_t inum)
+{
+    for (struct inode* ip = *ihash(dev, inum); ip; ip = ip->hnext)
+        if (ip->dev == dev && ip->inum == inum) return ip;
+    return NULL;
+}
+
+static void
+ihashin(struct inode* ip, uint32_t dev, uint32_t inum)
+{
+    struct inode** pp = ihash(dev, inum);
+    ip->dev = dev;
+    ip->inum = inum;
+    ip->hnext = *pp;
+    *pp = ip;
+}
+
+static void
+iunhash(struct inode* ip)
+{
+    struct inode** pp = ihash(ip->dev, ip->inum);
+    while (*pp != ip) pp = &(*pp)->hnext;
+    *pp = ip->hnext;
+    ip->hnext = NULL;
+    ip->dev = ip->inum = 0;
+}
+
+/* Remove ip from the list of unreferenced entries. */
+static void
+lru_remove(struct inode* ip)
+{
+    ip->next->prev = ip->prev;
+    ip->prev->next = ip->next;
+}
+
+/* Insert ip at the most recent end if it holds an inode, else at the least. */
+static void
+lru_insert(struct inode* ip)
+{
+    struct inode* at = ip->inum ? &icache.head : icache.head.prev;
+    ip->next = at->next;
+    ip->prev = at;
+    at->next->prev = ip;
+    at->next = ip;
+}
+
+static void
+ientry_init(struct inode* ip)
+{
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->fill, "inode fill");
+    initsleeplock(&ip->lock, "inode");
+    lru_insert(ip);
+    icache.ninode++;
+}
+
+/*
+ * Give back every grown page whose entries are all unreferenced.
+ * Called by kalloc() when memory runs out, never with icache.lock held.
+ * Returns the number of pages freed.
+ */
+static int
+icache_shrink()
+{
+    struct ipage *pg, **pp, *freed = NULL;
+
+    acquire(&icache.lock);
+    for (pp = &icache.pages; (pg = *pp);) {
+        int busy = 0;
+        for (int i = 0; i < IPAGE_NINODE; ++i)
+            busy |= pg->inode[i].ref | pg->inode[i].dirty;
+        if (busy) {
+            pp = &pg->next;
+            continue;
+        }
+        for (int i = 0; i < IPAGE_NINODE; ++i) {
+            struct inode* ip = &pg->inode[i];
+            if (ip->inum) iunhash(ip);
+            lru_remove(ip);
+        }
+        icache.ninode -= IPAGE_NINODE;
+        icache.nshrink++;
+        *pp = pg->next;
+        pg->next = freed;
+        freed = pg;
+    }
+    release(&icache.lock);
+
+    int n = 0;
+    for (; freed; ++n) {
+        pg = freed;
+        freed = pg->next;
+        kfree((char*)pg);
+    }
+    return n;
+}
+
 void
-iinit(int dev)
+icache_init()
 {
     initlock(&icache.lock, "icache");
-    for (int i = 0; i < NINODE; ++i)
-        initsleeplock(&icache.inode[i].lock, "inode");
+    icache.head.prev = &icache.head;
+    icache.head.next = &icache.head;
+    for (int i = 0; i < NINODE; ++i) ientry_init(&icache.inode[i]);
+    register_shrinker(icache_shrink);
+    dcache_init();
+    cprintf("icache_init: success.\n");
+}
 
+/*
+ * Print inode cache statistics.
+ */
+void
+icache_dump()
+{
+    acquire(&icache.lock);
+    cprintf(
+        "icache: %d entries, %d pages grown; iget %llu hit %llu; disk reads %llu read-ahead %llu; blocks flushed %llu; pages shrunk %llu\n",
+        icache.ninode, (icache.ninode - NINODE) / (int)IPAGE_NINODE,
+        icache.nget, icache.nhit, icache.nread, icache.nahead, icache.nflush,
+        icache.nshrink);
+    release(&icache.lock);
+}
+
+void
+iinit(int dev)
+{
     readsb(dev, &sb);
     cprintf(
-        "super block: size %d nblocks %d ninodes %d nlog %d logstart %d inodestart %d bmapstart %d\n",
+        "super block: size %d nblocks %d ninodes %d nlog %d logstart %d inodestart %d bmapstart %d features 0x%x\n",
         sb.size, sb.nblocks, sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-        sb.bmapstart);
+        sb.bmapstart, sb.features);
+    if ((sb.features & FEAT_LONGNAME) != FEAT_DIRSIZ)
+        panic("\tiinit: file system built for another DIRSIZ.\n");
 
     cprintf("iinit: success.\n");
 }
@@ -216,25 +386,85 @@ ialloc(uint32_t dev, uint16_t type)
 }
 
 /*
- * Copy a modified in-memory inode to disk.
+ * Note that a modified in-memory inode must reach the disk.
  *
  * Must be called after every change to an ip->xxx field
- * that lives on disk, since i-node cache is write-through.
- * Caller must hold ip->lock.
+ * that lives on disk. The copy is deferred: the inode is marked
+ * dirty, and iflush() writes it with any other dirty inodes in the
+ * same block when the transaction commits. A dirty entry is never
+ * recycled, so the update cannot be lost.
+ * Caller must hold ip->lock exclusive and be inside a transaction.
  */
 void
 iupdate(struct inode* ip)
 {
-    struct buf* bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    struct dinode* dip = (struct dinode*)bp->data + ip->inum % IPB;
+    if (!holdingsleep(&ip->lock)) panic("\tiupdate: inode not locked.\n");
+    acquire(&icache.lock);
+    int first = !ip->dirty;
+    if (first) {
+        ip->dirty = 1;
+        ip->dnext = icache.dirty;
+        icache.dirty = ip;
+    }
+    release(&icache.lock);
+    if (first) log_defer();
+}
+
+static void
+icopyout(struct inode* ip, struct dinode* dip)
+{
     dip->type = ip->type;
     dip->major = ip->major;
     dip->minor = ip->minor;
     dip->nlink = ip->nlink;
     dip->size = ip->size;
     memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-    log_write(bp);
-    brelse(bp);
+}
+
+static void
+icopyin(struct inode* ip, struct dinode* dip)
+{
+    ip->type = dip->type;
+    ip->major = dip->major;
+    ip->minor = dip->minor;
+    ip->nlink = dip->nlink;
+    ip->size = dip->size;
+    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+}
+
+/*
+ * Copy every dirty inode to its block and log the block.
+ *
+ * Called by commit() only, when no FS system call is outstanding,
+ * so no one can be changing the inodes or calling iupdate().
+ */
+void
+iflush()
+{
+    acquire(&icache.lock);
+    while (icache.dirty) {
+        uint32_t dev = icache.dirty->dev;
+        uint32_t bno = IBLOCK(icache.dirty->inum, sb);
+        release(&icache.lock);
+
+        struct buf* bp = bread(dev, bno);
+        acquire(&icache.lock);
+        for (struct inode *ip, **pp = &icache.dirty; (ip = *pp);) {
+            if (ip->dev != dev || IBLOCK(ip->inum, sb) != bno) {
+                pp = &ip->dnext;
+                continue;
+            }
+            icopyout(ip, (struct dinode*)bp->data + ip->inum % IPB);
+            ip->dirty = 0;
+            *pp = ip->dnext;
+        }
+        icache.nflush++;
+        release(&icache.lock);
+        log_write(bp);
+        brelse(bp);
+        acquire(&icache.lock);
+    }
+    release(&icache.lock);
 }
 
 /*
@@ -246,29 +476,46 @@ static struct inode*
 iget(uint32_t dev, uint32_t inum)
 {
     acquire(&icache.lock);
+    icache.nget++;
 
-    // Is the inode already cached?
-    struct inode* empty = NULL;
-    for (int i = 0; i < NINODE; ++i) {
-        struct inode* ip = &icache.inode[i];
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
+    for (;;) {
+        // Is the inode already cached?
+        struct inode* ip = ifind(dev, inum);
+        if (ip) {
+            if (!ip->ref++) lru_remove(ip);
+            icache.nhit++;
             release(&icache.lock);
             return ip;
         }
-        if (!empty && !ip->ref) empty = ip;  // remember empty slot
-    }
 
-    // Recycle an inode cache entry.
-    if (!empty) panic("\tiget: no inodes.\n");
+        // Take an entry that holds no inode, else grow the cache
+        // rather than evict, else recycle the least recently used
+        // clean entry.
+        ip = icache.head.prev;
+        if (ip == &icache.head || ip->inum) {
+            release(&icache.lock);
+            struct ipage* pg = (struct ipage*)kalloc();
+            acquire(&icache.lock);
+            if (pg) {
+                for (int i = 0; i < IPAGE_NINODE; ++i)
+                    ientry_init(&pg->inode[i]);
+                pg->next = icache.pages;
+                icache.pages = pg;
+                continue;  // The inode may have been cached meanwhile.
+            }
+            ip = icache.head.prev;
+            while (ip != &icache.head && ip->dirty) ip = ip->prev;
+            if (ip == &icache.head) panic("\tiget: no inodes.\n");
+            if (ip->inum) iunhash(ip);
+        }
 
-    struct inode* ip = empty;
-    ip->dev = dev;
-    ip->inum = inum;
-    ip->ref = 1;
-    ip->valid = 0;
-    release(&icache.lock);
-    return ip;
+        lru_remove(ip);
+        ihashin(ip, dev, inum);
+        ip->ref = 1;
+        ip->valid = 0;
+        release(&icache.lock);
+        return ip;
+    }
 }
 
 /*
@@ -279,14 +526,66 @@ struct inode*
 idup(struct inode* ip)
 {
     acquire(&icache.lock);
-    ip->ref++;
+    if (!ip->ref++) lru_remove(ip);
     release(&icache.lock);
     return ip;
 }
 
+/*
+ * Fill the other unreferenced, invalid inodes held in bp, which
+ * ilock() has just read for ip. Entries that hold no inode are put
+ * to use for allocated inodes not yet cached, so that stat-ing the
+ * rest of a directory finds them valid. The cache is neither grown
+ * nor evicted for read-ahead.
+ */
+static void
+ireadahead(struct inode* ip, struct buf* bp)
+{
+    struct inode* fill[IPB];
+    int n = 0;
+    uint32_t first = ip->inum - ip->inum % IPB;
+
+    acquire(&icache.lock);
+    for (uint32_t inum = first; inum < first + IPB && inum < sb.ninodes;
+         ++inum) {
+        struct dinode* dip = (struct dinode*)bp->data + inum % IPB;
+        if (!inum || inum == ip->inum || !dip->type) continue;
+
+        struct inode* np = ifind(ip->dev, inum);
+        if (!np) {
+            np = icache.head.prev;
+            if (np == &icache.head || np->inum) continue;
+            ihashin(np, ip->dev, inum);
+            np->valid = 0;
+        } else if (np->ref || np->valid || np->dirty) {
+            continue;
+        }
+        lru_remove(np);
+        np->ref = 1;
+        // np->ref was zero, so no one has np locked and
+        // this acquiresleep() won't block.
+        acquiresleep(&np->lock);
+        fill[n++] = np;
+    }
+    release(&icache.lock);
+
+    for (int i = 0; i < n; ++i) {
+        icopyin(fill[i], (struct dinode*)bp->data + fill[i]->inum % IPB);
+        fill[i]->valid = 1;
+        releasesleep(&fill[i]->lock);
+    }
+
+    acquire(&icache.lock);
+    for (int i = 0; i < n; ++i)
+        if (!--fill[i]->ref) lru_insert(fill[i]);
+    icache.nahead += n;
+    release(&icache.lock);
+}
+
 /*
  * Lock the given inode.
- * Reads the inode from disk if necessary.
+ * Reads the inode from disk if necessary, along with the
+ * others in its block.
  */
 void
 ilock(struct inode* ip)
@@ -295,19 +594,16 @@ ilock(struct inode* ip)
 
     acquiresleep(&ip->lock);
     if (!ip->valid) {
+        __atomic_fetch_add(&icache.nread, 1, __ATOMIC_RELAXED);
         struct buf* bp = bread(ip->dev, IBLOCK(ip->inum, sb));
         struct dinode* dip = (struct dinode*)bp->data + ip->inum % IPB;
-        ip->type = dip->type;
-        if (!ip->type) {
+        if (!dip->type) {
             brelse(bp);
             panic("\tilock: no type.\n");
         }
-        ip->major = dip->major;
-        ip->minor = dip->minor;
-        ip->nlink = dip->nlink;
-        ip->size = dip->size;
-        memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+        icopyin(ip, dip);
         ip->valid = 1;
+        ireadahead(ip, bp);
         brelse(bp);
     }
 }
@@ -323,11 +619,40 @@ iunlock(struct inode* ip)
     releasesleep(&ip->lock);
 }
 
+/*
+ * Lock the given inode shared with other readers, for calls that
+ * only read it: stati(), readi() and readpage() on a file or a
+ * directory. A device's read may unlock and relock the inode, so
+ * devices must be locked with ilock().
+ * If the inode must be read from disk, ilock() does that first.
+ */
+void
+ilock_shared(struct inode* ip)
+{
+    if (!ip || ip->ref < 1) panic("\tilock_shared: invalid inode.\n");
+
+    acquiresleep_shared(&ip->lock);
+    while (!ip->valid) {
+        // valid stays set from here on, as we hold a reference.
+        releasesleep_shared(&ip->lock);
+        ilock(ip);
+        iunlock(ip);
+        acquiresleep_shared(&ip->lock);
+    }
+}
+
+void
+iunlock_shared(struct inode* ip)
+{
+    if (!ip || ip->ref < 1) panic("\tiunlock_shared: invalid inode.\n");
+    releasesleep_shared(&ip->lock);
+}
+
 /*
  * Drop a reference to an in-memory inode.
  *
- * If that was the last reference, the inode cache entry can
- * be recycled.
+ * If that was the last reference, the inode cache entry goes
+ * on the LRU list, still valid, until it is recycled.
  * If that was the last reference and the inode has no links
  * to it, free the inode (and its content) on disk.
  * All calls to iput() must be inside a transaction in
@@ -353,7 +678,7 @@ iput(struct inode* ip)
         acquire(&icache.lock);
     }
 
-    ip->ref--;
+    if (!--ip->ref) lru_insert(ip);
     release(&icache.lock);
 }
 
@@ -418,6 +743,8 @@ bmap(struct inode* ip, uint32_t bn)
 static void
 itrunc(struct inode* ip)
 {
+    if (ip->type == T_FILE) pcache_drop(ip->dev, ip->inum);
+
     for (int i = 0; i < NDIRECT; ++i) {
         if (ip->addrs[i]) {
             bfree(ip->dev, ip->addrs[i]);
@@ -440,6 +767,38 @@ itrunc(struct inode* ip)
     iupdate(ip);
 }
 
+/*
+ * Return the page cache page holding the index'th page of ip,
+ * reading it from disk if it wasn't cached. Returns NULL if the
+ * page cache cannot supply a page.
+ * Caller must hold ip->lock, shared or not, and must release
+ * the page with pcache_put().
+ */
+struct page*
+readpage(struct inode* ip, uint32_t index)
+{
+    struct page* pg = pcache_get(ip->dev, ip->inum, index);
+    if (!pg || __atomic_load_n(&pg->valid, __ATOMIC_ACQUIRE)) return pg;
+
+    // Readers sharing ip->lock may miss the same page: fill it once.
+    acquiresleep(&ip->fill);
+    if (!pg->valid) {
+        size_t off = (size_t)index * PGSIZE;
+        for (int i = 0; i < PGSIZE; i += BSIZE, off += BSIZE) {
+            if (off >= ip->size) {
+                memset(pg->data + i, 0, BSIZE);
+                continue;
+            }
+            struct buf* bp = bread(ip->dev, bmap(ip, off / BSIZE));
+            memmove(pg->data + i, bp->data, BSIZE);
+            brelse(bp);
+        }
+        __atomic_store_n(&pg->valid, 1, __ATOMIC_RELEASE);
+    }
+    releasesleep(&ip->fill);
+    return pg;
+}
+
 /*
  * Copy stat information from inode.
  * Caller must hold ip->lock.
@@ -463,7 +822,7 @@ stati(struct inode* ip, struct stat* st)
 
 /*
  * Read data from inode.
- * Caller must hold ip->lock.
+ * Caller must hold ip->lock, shared or not, or exclusive for a device.
  */
 ssize_t
 readi(struct inode* ip, char* dst, size_t off, size_t n)
@@ -471,13 +830,23 @@ readi(struct inode* ip, char* dst, size_t off, size_t n)
     if (ip->type == T_DEV) {
         if (ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
             return -1;
-        return devsw[ip->major].read(ip, dst, n);
+        return devsw[ip->major].read(ip, dst, off, n);
     }
 
     if (off > ip->size || off + n < off) return -1;
     if (off + n > ip->size) n = ip->size - off;
 
     for (size_t tot = 0, m = 0; tot < n; tot += m, off += m, dst += m) {
+        // Regular files are read through the page cache,
+        // falling back to the buffer cache when it is exhausted.
+        struct page* pg =
+            ip->type == T_FILE ? readpage(ip, off / PGSIZE) : NULL;
+        if (pg) {
+            m = min(n - tot, PGSIZE - off % PGSIZE);
+            memmove(dst, pg->data + off % PGSIZE, m);
+            pcache_put(pg);
+            continue;
+        }
         struct buf* bp = bread(ip->dev, bmap(ip, off / BSIZE));
         m = min(n - tot, BSIZE - off % BSIZE);
         memmove(dst, bp->data + off % BSIZE, m);
@@ -488,11 +857,12 @@ readi(struct inode* ip, char* dst, size_t off, size_t n)
 
 /*
  * Write data to inode.
- * Caller must hold ip->lock.
+ * Caller must hold ip->lock exclusive.
  */
 ssize_t
 writei(struct inode* ip, char* src, size_t off, size_t n)
 {
+    if (!holdingsleep(&ip->lock)) panic("\twritei: inode not locked.\n");
     if (ip->type == T_DEV) {
         if (ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
             return -1;
@@ -507,6 +877,9 @@ writei(struct inode* ip, char* src, size_t off, size_t n)
         m = min(n - tot, BSIZE - off % BSIZE);
         memmove(bp->data + off % BSIZE, src, m);
         log_write(bp);
+        if (ip->type == T_FILE)
+            pcache_write(
+                ip->dev, ip->inum, off, (char*)bp->data + off % BSIZE, m);
         brelse(bp);
     }
 
@@ -525,6 +898,170 @@ namecmp(const char* s, const char* t)
     return strncmp(s, t, DIRSIZ);
 }
 
+/*
+ * Return the locked buffer of the bn-th block of directory dp.
+ * The block must lie within dp->size.
+ */
+static struct buf*
+dirblock(struct inode* dp, uint32_t bn)
+{
+    return bread(dp->dev, bmap(dp, bn));
+}
+
+/*
+ * Return the chain head of bucket h in the index block root.
+ */
+static uint16_t*
+dxbucket(struct buf* root, uint32_t h)
+{
+    struct dxslot* s = (struct dxslot*)root->data;
+    return &s[1 + h / DXSLOTN].ent[h % DXSLOTN];
+}
+
+/*
+ * Turn the empty directory dp into a hashed one, if the file system
+ * asks for hashed directories. Caller must hold dp->lock.
+ */
+void
+dirinit(struct inode* dp)
+{
+    if (!(sb.features & FEAT_DIRHASH)) return;
+    if (dp->type != T_DIR || dp->size) panic("\tdirinit: not an empty DIR.\n");
+
+    struct buf* bp = dirblock(dp, 0);
+    struct dxslot* s = (struct dxslot*)bp->data;
+    s->ent[0] = DXMAGIC;
+    s->ent[1] = DXNBUCKET;
+    log_write(bp);
+    brelse(bp);
+
+    dp->major |= DIR_HASHED;
+    dp->size = BSIZE;
+    iupdate(dp);
+}
+
+/*
+ * Look up name in the hashed directory dp, scanning only its bucket.
+ */
+static struct inode*
+dxlookup(struct inode* dp, char* name, size_t* poff)
+{
+    struct buf* bp = dirblock(dp, 0);
+    uint32_t bn = *dxbucket(bp, dxhash(name));
+    brelse(bp);
+
+    while (bn) {
+        bp = dirblock(dp, bn);
+        struct dirent* de = (struct dirent*)bp->data;
+        for (int i = 1; i < DPB; ++i) {
+            if (de[i].inum && !namecmp(name, de[i].name)) {
+                uint32_t inum = de[i].inum;
+                if (poff) *poff = bn * BSIZE + i * sizeof(*de);
+                brelse(bp);
+                return iget(dp->dev, inum);
+            }
+        }
+        bn = ((struct dxslot*)bp->data)->ent[0];
+        brelse(bp);
+    }
+    return 0;
+}
+
+/*
+ * Insert (name, inum) into the hashed directory dp.
+ * Checks for a duplicate and finds a free slot in the same pass over
+ * the bucket; appends a block to the chain if the bucket is full.
+ */
+static int
+dxlink(struct inode* dp, char* name, uint32_t inum)
+{
+    uint32_t h = dxhash(name), bn, last = 0, fbn = 0;
+    int fi = 0;
+
+    struct buf* bp = dirblock(dp, 0);
+    bn = *dxbucket(bp, h);
+    brelse(bp);
+
+    while (bn) {
+        bp = dirblock(dp, bn);
+        struct dirent* de = (struct dirent*)bp->data;
+        for (int i = 1; i < DPB; ++i) {
+            if (!de[i].inum) {
+                if (!fbn) fbn = bn, fi = i;
+            } else if (!namecmp(name, de[i].name)) {
+                brelse(bp);
+                return -1;
+            }
+        }
+        last = bn;
+        bn = ((struct dxslot*)bp->data)->ent[0];
+        brelse(bp);
+    }
+
+    if (!fbn) {
+        // Bucket is full: chain a new block at the end of the file.
+        fbn = dp->size / BSIZE;
+        fi = 1;
+        if (fbn >= MAXFILE) return -1;
+        bp = dirblock(dp, fbn);
+        ((struct dxslot*)bp->data)->ent[1] = h;
+        log_write(bp);
+        brelse(bp);
+
+        bp = dirblock(dp, last);
+        if (last)
+            ((struct dxslot*)bp->data)->ent[0] = fbn;
+        else
+            *dxbucket(bp, h) = fbn;
+        log_write(bp);
+        brelse(bp);
+
+        dp->size += BSIZE;
+        iupdate(dp);
+    }
+
+    bp = dirblock(dp, fbn);
+    struct dirent* de = (struct dirent*)bp->data + fi;
+    strncpy(de->name, name, DIRSIZ);
+    de->inum = inum;
+    log_write(bp);
+    brelse(bp);
+    return 0;
+}
+
+/*
+ * Iterator over the entries of a linear directory, a block at a time.
+ * dirnext() returns a pointer into the buffer-cache block, valid until
+ * the next call; dirdone() must be called if the scan stops early.
+ */
+struct diriter {
+    struct inode* dp;
+    struct buf* bp;
+    size_t off;  // Offset of the next entry
+};
+
+static struct dirent*
+dirnext(struct diriter* it)
+{
+    if (it->bp && it->off % BSIZE == 0) {
+        brelse(it->bp);
+        it->bp = NULL;
+    }
+    if (it->off + sizeof(struct dirent) > it->dp->size) return NULL;
+    if (!it->bp) it->bp = dirblock(it->dp, it->off / BSIZE);
+
+    struct dirent* de = (struct dirent*)(it->bp->data + it->off % BSIZE);
+    it->off += sizeof(*de);
+    return de;
+}
+
+static void
+dirdone(struct diriter* it)
+{
+    if (it->bp) brelse(it->bp);
+    it->bp = NULL;
+}
+
 /*
  * Look for a directory entry in a directory.
  * If found, set *poff to byte offset of entry.
@@ -533,18 +1070,20 @@ struct inode*
 dirlookup(struct inode* dp, char* name, size_t* poff)
 {
     if (dp->type != T_DIR) panic("\tdirlookup: not DIR.\n");
+    if (dp->major & DIR_HASHED) return dxlookup(dp, name, poff);
 
-    struct dirent de;
-    for (size_t off = 0; off < dp->size; off += sizeof(de)) {
-        if (readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-            panic("\tdirlookup: read error.\n");
-        if (!de.inum) continue;
-        if (!namecmp(name, de.name)) {
+    struct diriter it = {dp, NULL, 0};
+    for (struct dirent* de; (de = dirnext(&it));) {
+        if (!de->inum) continue;
+        if (!namecmp(name, de->name)) {
             // entry matches path element
-            if (poff) *poff = off;
-            return iget(dp->dev, de.inum);
+            uint32_t inum = de->inum;
+            if (poff) *poff = it.off - sizeof(*de);
+            dirdone(&it);
+            return iget(dp->dev, inum);
         }
     }
+    dirdone(&it);
     return 0;
 }
 
@@ -554,31 +1093,85 @@ dirlookup(struct inode* dp, char* name, size_t* poff)
 int
 dirlink(struct inode* dp, char* name, uint32_t inum)
 {
-    struct dirent de;
-    struct inode* ip = dirlookup(dp, name, 0);
-
-    /* Check that name is not present. */
-    if (ip) {
-        iput(ip);
-        return -1;
-    }
+    if (dp->major & DIR_HASHED) return dxlink(dp, name, inum);
 
-    /* Look for an empty dirent. */
-    ssize_t off = 0;
-    for (; off < dp->size; off += sizeof(de)) {
-        if (readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-            panic("\tdirlink: read error.\n");
-        if (de.inum == 0) break;
+    /* Check that name is not present and look for an empty dirent. */
+    struct diriter it = {dp, NULL, 0};
+    ssize_t empty = -1;
+    for (struct dirent* de; (de = dirnext(&it));) {
+        if (!de->inum) {
+            if (empty < 0) empty = it.off - sizeof(*de);
+        } else if (!namecmp(name, de->name)) {
+            dirdone(&it);
+            return -1;
+        }
     }
+    dirdone(&it);
 
+    struct dirent de;
+    memset(&de, 0, sizeof(de));
     strncpy(de.name, name, DIRSIZ);
     de.inum = inum;
+    size_t off = empty >= 0 ? empty : it.off;
     if (writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
         panic("\tdirlink: write error.\n");
 
     return 0;
 }
 
+/* Record returned by getdents64, see getdents(2). */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    uint16_t d_reclen;
+    uint8_t d_type;
+    char d_name[];
+};
+
+#define DT_UNKNOWN 0
+
+/*
+ * Fill dst with linux_dirent64 records for the entries of dp from
+ * byte offset *poff on, at most n bytes in total, advancing *poff.
+ * Free slots (including hashed directory bookkeeping) are skipped.
+ * Returns the number of bytes filled, or -1 if dst can't hold even one.
+ * Caller must hold dp->lock.
+ */
+ssize_t
+getdents(struct inode* dp, char* dst, size_t* poff, size_t n)
+{
+    if (dp->type != T_DIR) return -1;
+
+    struct diriter it = {dp, NULL, ROUNDUP(*poff, sizeof(struct dirent))};
+    size_t tot = 0;
+    for (struct dirent* de; (de = dirnext(&it));) {
+        if (!de->inum) continue;
+
+        size_t len = strnlen(de->name, DIRSIZ);
+        size_t reclen = ROUNDUP(
+            offset_of(struct linux_dirent64, d_name) + len + 1,
+            sizeof(uint64_t));
+        if (tot + reclen > n) {
+            it.off -= sizeof(*de);  // Return it next time.
+            break;
+        }
+
+        struct linux_dirent64* ld = (struct linux_dirent64*)(dst + tot);
+        ld->d_ino = de->inum;
+        ld->d_off = it.off;
+        ld->d_reclen = reclen;
+        ld->d_type = DT_UNKNOWN;
+        memmove(ld->d_name, de->name, len);
+        ld->d_name[len] = '\0';
+        tot += reclen;
+    }
+    dirdone(&it);
+
+    *poff = it.off;
+    if (!tot && it.off < dp->size) return -1;
+    return tot;
+}
+
 /* Paths. */
 
 /*
@@ -613,6 +1206,173 @@ skipelem(char* path, char* name)
     return path;
 }
 
+/*
+ * Directory entry cache.
+ *
+ * namex() records each name it looks up, with the inode number the
+ * name stands for in its directory and, once known, that inode's
+ * type. namex_rcu() then resolves paths whose every element is
+ * cached with no lock and no reference count, and only gets the last
+ * inode with iget(). Entries are published with release stores and
+ * not changed while visible, except for the type, which goes once
+ * from 0, unknown, to the inode's. When the cache is full, the next
+ * NDEVICT entries round it are unlinked and reused only after
+ * synchronize_rcu(), so a lookup never sees an entry change under it.
+ *
+ * Names are only ever added to directories, as there is no unlink;
+ * whatever removes or renames one must drop its entry here first.
+ */
+
+#define NDENTRY 512  // Cached names
+#define NDHASH  257  // Hash chains
+#define NDEVICT 32   // Entries reused at a time
+
+struct dentry {
+    struct dentry* next;  // Hash chain, read without locks
+    struct dentry* free;  // Free list
+    int hashed;           // On a hash chain
+    uint32_t dev;
+    uint32_t dir;   // Inode number of the directory
+    uint32_t inum;  // Inode number the name stands for
+    uint16_t type;  // Its type, or 0 if not known yet
+    char name[DIRSIZ];
+};
+
+static struct {
+    struct spinlock lock;  // Protects all but lookups
+    struct dentry* hash[NDHASH];
+    struct dentry entry[NDENTRY];
+    struct dentry* free;
+    int hand;  // Next entry to consider reusing
+} dcache;
+
+static void
+dcache_init()
+{
+    initlock(&dcache.lock, "dcache");
+    for (int i = 0; i < NDENTRY; ++i) {
+        dcache.entry[i].free = dcache.free;
+        dcache.free = &dcache.entry[i];
+    }
+}
+
+static struct dentry**
+dhash(uint32_t dev, uint32_t dir, char* name)
+{
+    uint32_t h = dev * 31 + dir;
+    for (int i = 0; i < DIRSIZ && name[i]; ++i) h = h * 33 + name[i];
+    return &dcache.hash[h % NDHASH];
+}
+
+/*
+ * Return the entry for name in directory dir, or NULL.
+ * Takes no lock, and must not sleep until done with the entry.
+ */
+static struct dentry*
+dcache_lookup(uint32_t dev, uint32_t dir, char* name)
+{
+    struct dentry* d = __atomic_load_n(dhash(dev, dir, name), __ATOMIC_ACQUIRE);
+    for (; d; d = __atomic_load_n(&d->next, __ATOMIC_ACQUIRE))
+        if (d->dir == dir && d->dev == dev && !namecmp(d->name, name))
+            return d;
+    return NULL;
+}
+
+/*
+ * Unlink the next NDEVICT entries round the cache and free them
+ * once no lookup can be looking at them. Yields.
+ */
+static void
+dcache_evict()
+{
+    struct dentry *d, *gone = NULL;
+    acquire(&dcache.lock);
+    for (int i = 0, n = 0; i < NDENTRY && n < NDEVICT; ++i) {
+        d = &dcache.entry[dcache.hand];
+        dcache.hand = (dcache.hand + 1) % NDENTRY;
+        if (!d->hashed) continue;
+        struct dentry** pd = dhash(d->dev, d->dir, d->name);
+        while (*pd != d) pd = &(*pd)->next;
+        __atomic_store_n(pd, d->next, __ATOMIC_RELEASE);
+        d->hashed = 0;
+        d->free = gone;
+        gone = d;
+        ++n;
+    }
+    release(&dcache.lock);
+
+    synchronize_rcu();
+    acquire(&dcache.lock);
+    while ((d = gone)) {
+        gone = d->free;
+        d->free = dcache.free;
+        dcache.free = d;
+    }
+    release(&dcache.lock);
+}
+
+/*
+ * Record that name in directory dir stands for inode inum, of type
+ * type if that isn't 0. May yield, so hold no spinlocks.
+ */
+static void
+dcache_add(uint32_t dev, uint32_t dir, char* name, uint32_t inum, int type)
+{
+    struct dentry* d;
+    acquire(&dcache.lock);
+    while (!(d = dcache_lookup(dev, dir, name)) && !dcache.free) {
+        release(&dcache.lock);
+        dcache_evict();
+        acquire(&dcache.lock);
+    }
+    if (d) {
+        if (!d->type && type)
+            __atomic_store_n(&d->type, type, __ATOMIC_RELEASE);
+        release(&dcache.lock);
+        return;
+    }
+
+    d = dcache.free;
+    dcache.free = d->free;
+    d->dev = dev;
+    d->dir = dir;
+    d->inum = inum;
+    d->type = type;
+    strncpy(d->name, name, DIRSIZ);
+    d->hashed = 1;
+    struct dentry** h = dhash(dev, dir, name);
+    d->next = *h;
+    __atomic_store_n(h, d, __ATOMIC_RELEASE);
+    release(&dcache.lock);
+}
+
+/*
+ * Look up a path as namex() does, in the directory entry cache only,
+ * without locks. Returns NULL if some element isn't cached, or isn't
+ * known to be a directory where one is needed; namex() then walks
+ * the path itself.
+ */
+static struct inode*
+namex_rcu(char* path, int nameiparent, char* name)
+{
+    uint32_t dev = ROOTDEV, inum = ROOTINO;
+    int type = T_DIR;
+    if (*path != '/') {
+        dev = thisproc()->cwd->dev;
+        inum = thisproc()->cwd->inum;
+    }
+
+    while ((path = skipelem(path, name))) {
+        if (type != T_DIR) return NULL;
+        if (nameiparent && *path == '\0') return iget(dev, inum);
+        struct dentry* d = dcache_lookup(dev, inum, name);
+        if (!d) return NULL;
+        type = __atomic_load_n(&d->type, __ATOMIC_ACQUIRE);
+        inum = d->inum;
+    }
+    return nameiparent ? NULL : iget(dev, inum);
+}
+
 /*
  * Look up and return the inode for a path name.
  *
@@ -623,11 +1383,16 @@ skipelem(char* path, char* name)
 static struct inode*
 namex(char* path, int nameiparent, char* name)
 {
-    struct inode* ip = NULL;
+    struct inode* ip = namex_rcu(path, nameiparent, name);
+    if (ip) return ip;
+
+    uint32_t dir = 0;    // Directory ip was found in, if any
+    char found[DIRSIZ];  // Name ip was found under
     ip = (*path == '/') ? iget(ROOTDEV, ROOTINO) : idup(thisproc()->cwd);
 
     while ((path = skipelem(path, name))) {
         ilock(ip);
+        if (dir) dcache_add(ip->dev, dir, found, ip->inum, ip->type);
         if (ip->type != T_DIR) {
             iunlockput(ip);
             return 0;
@@ -642,6 +1407,8 @@ namex(char* path, int nameiparent, char* name)
             iunlockput(ip);
             return 0;
         }
+        dir = ip->inum;
+        memmove(found, name, DIRSIZ);
         iunlockput(ip);
         ip = next;
     }
@@ -649,6 +1416,7 @@ namex(char* path, int nameiparent, char* name)
         iput(ip);
         return 0;
     }
+    if (dir) dcache_add(ip->dev, dir, found, ip->inum, 0);
     return ip;
 }
 
@@ -0,0 +1,273 @@
+/*
+ * Futexes: FUTEX_WAIT, FUTEX_WAKE, FUTEX_REQUEUE and FUTEX_CMP_REQUEUE,
+ * with or without FUTEX_PRIVATE_FLAG.
+ *
+ * A futex is a user word, known by the kernel address of the word,
+ * which is its physical address plus KERNBASE, so that every thread
+ * and process mapping the word finds the same futex. Private futexes
+ * are keyed the same way, which is as good and costs one page table
+ * walk. Waiters queue in FIFO order on one of NBUCKET buckets, hashed
+ * by key, and sleep on their own queue entry, which lives on their
+ * kernel stack. A wait checks the word and queues under the bucket
+ * lock that a wake takes to dequeue, so no wake is lost in between.
+ *
+ * The page table is walked without the address space lock, as the
+ * word is read with copy_from_user(); a word unmapped under a waiter
+ * just never matches a wake again, as in Linux.
+ */
+
+#include "futex.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "arm.h"
+#include "console.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "syscall1.h"
+#include "types.h"
+#include "uaccess.h"
+#include "vm.h"
+
+#define NBUCKET 64  // Wait queues, a power of two
+
+/* Operations, as in Linux. */
+#define FUTEX_WAIT         0
+#define FUTEX_WAKE         1
+#define FUTEX_REQUEUE      3
+#define FUTEX_CMP_REQUEUE  4
+#define FUTEX_PRIVATE_FLAG 128
+
+struct waiter {
+    uint64_t key;
+    struct proc* proc;
+    struct bucket* b;     // Bucket queued on, changed by requeue
+    struct waiter* next;  // Next in the bucket
+    int woken;            // Taken off the queue by a wake
+};
+
+struct bucket {
+    struct spinlock lock;
+    struct waiter* head;
+    struct waiter** tail;  // Where the next waiter goes
+};
+
+static struct bucket buckets[NBUCKET];
+
+void
+futex_init()
+{
+    for (struct bucket* b = buckets; b < buckets + NBUCKET; ++b) {
+        initlock(&b->lock, "futex");
+        b->tail = &b->head;
+    }
+}
+
+static struct bucket*
+bucket(uint64_t key)
+{
+    return &buckets[(key >> 2 ^ key >> 12) % NBUCKET];
+}
+
+/*
+ * Return the key of the futex at user address uaddr, or 0 if that
+ * is misaligned or not mapped for user code.
+ */
+static uint64_t
+futex_key(uint64_t uaddr)
+{
+    if (uaddr % sizeof(int)) return 0;
+    return (uint64_t)uvm_addr(thisproc()->mm->pgdir, uaddr);
+}
+
+static void
+enqueue(struct bucket* b, struct waiter* w)
+{
+    w->b = b;
+    w->next = NULL;
+    *b->tail = w;
+    b->tail = &w->next;
+}
+
+/*
+ * Take the waiter that pw points at off bucket b.
+ */
+static struct waiter*
+dequeue(struct bucket* b, struct waiter** pw)
+{
+    struct waiter* w = *pw;
+    *pw = w->next;
+    if (b->tail == &w->next) b->tail = pw;
+    return w;
+}
+
+/*
+ * Lock the buckets a and b, which may be the same, lower first.
+ */
+static void
+lock2(struct bucket* a, struct bucket* b)
+{
+    if (a > b) {
+        struct bucket* t = a;
+        a = b;
+        b = t;
+    }
+    acquire(&a->lock);
+    if (b != a) acquire(&b->lock);
+}
+
+static void
+unlock2(struct bucket* a, struct bucket* b)
+{
+    release(&a->lock);
+    if (b != a) release(&b->lock);
+}
+
+/*
+ * Sleep on the futex at uaddr while it holds val, for at most the
+ * time at utimeout unless that is NULL. Returns 0 once woken,
+ * -EAGAIN if the word doesn't hold val, -ETIMEDOUT, -EINTR if
+ * killed, or -EFAULT or -EINVAL for a bad address or time.
+ */
+static int
+futex_wait(uint64_t uaddr, int val, uint64_t utimeout)
+{
+    uint64_t deadline = 0;
+    if (utimeout) {
+        struct timespec ts;
+        uint64_t f;
+        if (copy_from_user(&ts, (void*)utimeout, sizeof(ts)) < 0)
+            return -EFAULT;
+        if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+            return -EINVAL;
+        asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+        deadline = timestamp() + ts.tv_sec * f + ts.tv_nsec * f / 1000000000;
+    }
+
+    struct waiter w = {futex_key(uaddr), thisproc()};
+    if (!w.key) return -EFAULT;
+    struct bucket* b = bucket(w.key);
+    acquire(&b->lock);
+    int cur;
+    if (copy_from_user(&cur, (void*)uaddr, sizeof(cur)) < 0) {
+        release(&b->lock);
+        return -EFAULT;
+    }
+    if (cur != val) {
+        release(&b->lock);
+        return -EAGAIN;
+    }
+
+    enqueue(b, &w);
+    int r = 0;
+    while (!w.woken) {
+        if (w.proc->killed) {
+            r = -EINTR;
+            break;
+        }
+        if (deadline && timestamp() >= deadline) {
+            r = -ETIMEDOUT;
+            break;
+        }
+        sleep_until(&w, &b->lock, deadline);
+
+        // Follow the waiter to the bucket it was requeued on.
+        while (w.b != b) {
+            release(&b->lock);
+            b = w.b;
+            acquire(&b->lock);
+        }
+    }
+    if (!w.woken) {
+        struct waiter** pw = &b->head;
+        while (*pw != &w) pw = &(*pw)->next;
+        dequeue(b, pw);
+    }
+    release(&b->lock);
+    return r;
+}
+
+/*
+ * Wake up to nwake waiters on the futex keyed key, and move up to
+ * nmove more to the futex keyed key2, if that isn't 0. If cmp isn't
+ * NULL, check first that the word at uaddr holds *cmp, or return
+ * -EAGAIN. Returns the number of waiters woken, plus those moved.
+ */
+static int
+futex_wake(
+    uint64_t key, int nwake, uint64_t key2, int nmove, uint64_t uaddr,
+    int* cmp)
+{
+    struct bucket* b = bucket(key);
+    struct bucket* b2 = key2 ? bucket(key2) : b;
+    lock2(b, b2);
+    int cur, n = 0;
+    if (cmp
+        && (copy_from_user(&cur, (void*)uaddr, sizeof(cur)) < 0
+            || cur != *cmp)) {
+        unlock2(b, b2);
+        return -EAGAIN;
+    }
+
+    for (struct waiter** pw = &b->head; *pw && n < nwake + nmove;) {
+        if ((*pw)->key != key) {
+            pw = &(*pw)->next;
+            continue;
+        }
+        struct waiter* w = dequeue(b, pw);
+        if (n++ < nwake) {
+            w->woken = 1;
+            wakeup(w);
+        } else {
+            w->key = key2;
+            enqueue(b2, w);
+        }
+    }
+    unlock2(b, b2);
+    return n;
+}
+
+/*
+ * Wake up to n waiters on the futex at user address uaddr, as exit()
+ * does at the address set by CLONE_CHILD_CLEARTID. Returns the number
+ * woken, or -EFAULT.
+ */
+int
+futex_wakeup(uint64_t uaddr, int n)
+{
+    uint64_t key = futex_key(uaddr);
+    return key ? futex_wake(key, n, 0, 0, 0, NULL) : -EFAULT;
+}
+
+/*
+ * futex(uaddr, op, val, timeout or val2, uaddr2, val3)
+ */
+int
+sys_futex()
+{
+    uint64_t uaddr, op, val, utimeout, uaddr2, val3;
+    if (argint(0, &uaddr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0
+        || argint(3, &utimeout) < 0 || argint(4, &uaddr2) < 0
+        || argint(5, &val3) < 0)
+        return -EINVAL;
+
+    uint64_t key, key2;
+    int cmp = val3;
+    op &= ~FUTEX_PRIVATE_FLAG;
+    switch (op) {
+    case FUTEX_WAIT: return futex_wait(uaddr, val, utimeout);
+    case FUTEX_WAKE: return futex_wakeup(uaddr, val);
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+        if (!(key = futex_key(uaddr)) || !(key2 = futex_key(uaddr2)))
+            return -EFAULT;
+        return futex_wake(
+            key, val, key2, (int)utimeout, uaddr,
+            op == FUTEX_CMP_REQUEUE ? &cmp : NULL);
+    default:
+        cprintf("sys_futex: op %d unimplemented.\n", op);
+        return -ENOSYS;
+    }
+}
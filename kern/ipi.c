@@ -0,0 +1,159 @@
+/*
+ * Inter-processor interrupts, over mailbox 0 of each core's local
+ * peripherals (QA7, section 4.7). A sender sets bits in the target's
+ * mailbox, which holds the target's IRQ line up until it clears them.
+ *
+ * The kernel runs with interrupts masked, so a CPU takes the IRQ in
+ * user mode, or when it is idle in wfi, which a pending interrupt
+ * ends even when masked; a CPU busy in the kernel sees it when it
+ * gets to either. IPI_WAKE only has to get an idle CPU back into its
+ * scheduler loop. IPI_CALL has the target run the functions queued
+ * for it by smp_call_function().
+ */
+
+#include "ipi.h"
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "peripherals/irq.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NASYNC 8  // Calls a CPU may have in flight without waiting
+
+struct call {
+    void (*fn)(void*);
+    void* arg;
+    struct call* next;
+    int done;  // fn has returned
+};
+
+static struct {
+    struct spinlock lock;
+    struct call* head;   // Calls for this CPU to run
+    struct call** tail;  // Where the next call goes
+    struct call async[NASYNC];  // Calls from this CPU not waited for
+    int nasync;
+} __attribute__((aligned(64))) queues[NCPU];
+
+void
+ipi_init()
+{
+    for (int i = 0; i < NCPU; i++) {
+        initlock(&queues[i].lock, "ipi");
+        queues[i].tail = &queues[i].head;
+        for (int j = 0; j < NASYNC; j++) queues[i].async[j].done = 1;
+        put32(CORE_MBOX_CLR(i, 0), 0xFFFFFFFF);
+        put32(CORE_MBOX_CTRL(i), MBOX_IRQ(0));
+    }
+    cprintf("ipi_init: success.\n");
+}
+
+/*
+ * Interrupt cpu for the reasons in why.
+ */
+void
+ipi_send(int cpu, int why)
+{
+    asm volatile("dsb st");  // What it is sent for first
+    put32(CORE_MBOX_SET(cpu, 0), why);
+}
+
+/*
+ * Clear the IPIs pending on this CPU and run the calls queued for
+ * it. Called on the mailbox interrupt, and while waiting for a call,
+ * so that two CPUs calling each other don't wait forever.
+ */
+void
+ipi_handle()
+{
+    int self = cpuid();
+    uint32_t why = get32(CORE_MBOX_CLR(self, 0));
+    if (!why) return;
+    // Clear first, so that a call queued after we look is sent again.
+    put32(CORE_MBOX_CLR(self, 0), why);
+    asm volatile("dsb sy");
+    if (!(why & IPI_CALL)) return;
+
+    acquire(&queues[self].lock);
+    struct call* c = queues[self].head;
+    queues[self].head = NULL;
+    queues[self].tail = &queues[self].head;
+    release(&queues[self].lock);
+    while (c) {
+        struct call* next = c->next;  // c is the caller's once done
+        c->fn(c->arg);
+        __atomic_store_n(&c->done, 1, __ATOMIC_RELEASE);
+        c = next;
+    }
+}
+
+static void
+call_queue(int cpu, struct call* c, void (*fn)(void*), void* arg)
+{
+    c->fn = fn;
+    c->arg = arg;
+    c->next = NULL;
+    c->done = 0;
+    acquire(&queues[cpu].lock);
+    *queues[cpu].tail = c;
+    queues[cpu].tail = &c->next;
+    release(&queues[cpu].lock);
+    ipi_send(cpu, IPI_CALL);
+}
+
+static void
+call_wait(struct call* c)
+{
+    while (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE)) ipi_handle();
+}
+
+/*
+ * Take a slot for a call that isn't waited for, waiting for the
+ * oldest one if they are all in flight.
+ */
+static struct call*
+call_async()
+{
+    int self = cpuid();
+    struct call* c = &queues[self].async[queues[self].nasync++ % NASYNC];
+    call_wait(c);
+    return c;
+}
+
+/*
+ * Run fn(arg) on cpu, and wait for it to return if wait is set. fn
+ * runs with interrupts masked and must not sleep. The caller must
+ * not hold spinlocks the target may be waiting for in the kernel,
+ * and should expect the call to wait until the target next enters
+ * user mode or goes idle.
+ */
+void
+smp_call_function_single(int cpu, void (*fn)(void*), void* arg, int wait)
+{
+    if (cpu == cpuid()) {
+        fn(arg);
+        return;
+    }
+    struct call c, *cp = wait ? &c : call_async();
+    call_queue(cpu, cp, fn, arg);
+    if (wait) call_wait(cp);
+}
+
+/*
+ * Run fn(arg) on every other CPU, and wait for all of them to return
+ * if wait is set.
+ */
+void
+smp_call_function(void (*fn)(void*), void* arg, int wait)
+{
+    struct call c[NCPU];
+    int self = cpuid();
+    for (int i = 0; i < NCPU; i++)
+        if (i != self) call_queue(i, wait ? &c[i] : call_async(), fn, arg);
+    if (wait)
+        for (int i = 0; i < NCPU; i++)
+            if (i != self) call_wait(&c[i]);
+}
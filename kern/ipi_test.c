@@ -0,0 +1,85 @@
+/*
+ * Benchmark of IPIs: CPU 0 calls a function on each other CPU and
+ * waits for it to return, ROUNDS times, while the others sit in wfi,
+ * as idle CPUs do, and then while they spin checking their mailbox.
+ * The difference is the cost of waking a core from wfi. Build with
+ * `make IPI_TEST=1` to run it at boot.
+ */
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "ipi.h"
+#include "proc.h"
+
+#define ROUNDS 1000  // Calls to each CPU
+
+static volatile int phase;  // 1 wfi, 2 spin, 3 done
+static volatile uint64_t calls;
+
+static void
+barrier()
+{
+    static volatile int arrived, sense;
+    int s = !sense;
+    if (__atomic_add_fetch(&arrived, 1, __ATOMIC_ACQ_REL) == NCPU) {
+        arrived = 0;
+        __atomic_store_n(&sense, s, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&sense, __ATOMIC_ACQUIRE) != s) {
+        }
+    }
+}
+
+static void
+count(void* arg)
+{
+    __atomic_add_fetch(&calls, 1, __ATOMIC_RELAXED);
+}
+
+static void
+serve(int p)
+{
+    while (phase == p) {
+        if (p == 1) asm volatile("wfi");
+        ipi_handle();
+    }
+}
+
+static void
+run(int p)
+{
+    if (cpuid()) {
+        barrier();
+        serve(p);
+        return;
+    }
+
+    uint64_t f;
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+    phase = p;
+    calls = 0;
+    barrier();
+    for (int c = 1; c < NCPU; c++) {
+        uint64_t t = timestamp();
+        for (int i = 0; i < ROUNDS; i++)
+            smp_call_function_single(c, count, NULL, 1);
+        t = timestamp() - t;
+        cprintf(
+            "ipi_test: %s, CPU %d: %lld ns a call\n", p == 1 ? "wfi" : "spin",
+            c, t * 1000000000 / f / ROUNDS);
+    }
+    if (calls != (NCPU - 1) * ROUNDS) panic("\tipi_test: lost calls.\n");
+    phase = p + 1;
+    for (int c = 1; c < NCPU; c++) ipi_send(c, IPI_WAKE);
+}
+
+void
+ipi_test()
+{
+    run(1);
+    barrier();
+    run(2);
+    barrier();
+}
@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "string.h"
 #include "types.h"
+#include "workqueue.h"
 
 extern char end[];
 
@@ -24,11 +25,66 @@ struct {
     struct run* free_list; /* Free list of physical pages */
 } kmem;
 
+/*
+ * 2 MiB blocks for huge user pages. The free list above knows nothing
+ * of contiguity, so NHUGEPAGE blocks are set aside at the top of memory
+ * at boot. Blocks still free when pages run out are handed over to
+ * the page free list for good.
+ */
+static struct {
+    struct spinlock lock;
+    struct run* free_list;
+    int nfree;
+} khuge;
+
+/*
+ * Caches that hold pages they can give back register a shrinker.
+ * kalloc() runs them when the free list is empty; each returns the
+ * number of pages it freed.
+ */
+#define NSHRINKER 16  // Four registered at boot, room for more
+
+static struct {
+    struct spinlock lock;
+    int n;
+    int (*fn[NSHRINKER])();
+} shrinkers;
+
+/*
+ * Pages cleared ahead of need by a worker thread, so that page faults
+ * and brk() usually find one instead of clearing it themselves. The
+ * pool is topped up to NZERO when it falls below half, and given back
+ * when memory runs out.
+ */
+#define NZERO 64
+
+static struct {
+    struct spinlock lock;
+    struct run* free_list;
+    int nfree;
+} kzero;
+
+static void kzero_fill(void*);
+static struct work kzero_work = WORK_INIT(kzero_fill, NULL);
+
+static int khuge_shrink();
+static int kzero_shrink();
+
 void
 alloc_init()
 {
     initlock(&kmem.lock, "kmem_lock"); /* Init kmem lock */
-    free_range(end, P2V(PHYSTOP));
+    initlock(&khuge.lock, "khuge");
+    initlock(&shrinkers.lock, "shrinkers");
+    initlock(&kzero.lock, "kzero");
+
+    char* huge = ROUNDDOWN((char*)P2V(PHYSTOP), BKSIZE) - NHUGEPAGE * BKSIZE;
+    if (huge < end) panic("\talloc_init: NHUGEPAGE too large.\n");
+    free_range(end, huge);
+    for (; huge + BKSIZE <= (char*)P2V(PHYSTOP); huge += BKSIZE)
+        kfree_huge(huge);
+    register_shrinker(khuge_shrink);
+    register_shrinker(kzero_shrink);
     cprintf("alloc_init: success.\n");
 }
 
@@ -59,6 +115,44 @@ free_range(void* vstart, void* vend)
     for (; p + PGSIZE <= (char*)vend; p += PGSIZE) kfree(p);
 }
 
+/*
+ * Register fn to be called when memory runs out.
+ * fn must not call kalloc(), and must not take a lock that is held
+ * around a call to kalloc().
+ */
+void
+register_shrinker(int (*fn)())
+{
+    acquire(&shrinkers.lock);
+    if (shrinkers.n == NSHRINKER)
+        panic("\tregister_shrinker: too many shrinkers.\n");
+    shrinkers.fn[shrinkers.n++] = fn;
+    release(&shrinkers.lock);
+}
+
+/* Ask every registered cache to give pages back. */
+static int
+shrink()
+{
+    int n, freed = 0;
+    acquire(&shrinkers.lock);
+    n = shrinkers.n;
+    release(&shrinkers.lock);
+    for (int i = 0; i < n; ++i) freed += shrinkers.fn[i]();
+    return freed;
+}
+
+/* Take a page off the free list, or return NULL if it is empty. */
+static struct run*
+kmem_take()
+{
+    acquire(&kmem.lock);
+    struct run* p = kmem.free_list;
+    if (p) kmem.free_list = p->next;
+    release(&kmem.lock);
+    return p;
+}
+
 /*
  * Allocate one 4096-byte page of physical memory.
  * Returns a pointer that the kernel can use.
@@ -68,13 +162,124 @@ char*
 kalloc()
 {
     struct run* p;
-    acquire(&kmem.lock);
-    p = kmem.free_list;
-    if (p) kmem.free_list = p->next;
-    release(&kmem.lock);
+    while (!(p = kmem_take()) && shrink()) {}
     return (char*)p;
 }
 
+/*
+ * Allocate a page of zeros. Returns 0 if memory runs out.
+ */
+char*
+kalloc_zeroed()
+{
+    acquire(&kzero.lock);
+    struct run* p = kzero.free_list;
+    if (p) {
+        kzero.free_list = p->next;
+        kzero.nfree--;
+    }
+    int low = kzero.nfree < NZERO / 2;
+    release(&kzero.lock);
+    if (low && system_wq) queue_work(system_wq, &kzero_work);
+
+    if (p) {
+        p->next = NULL;  // The one word the free list used
+        return (char*)p;
+    }
+    char* v = kalloc();
+    if (v) clear_page(v);
+    return v;
+}
+
+static void
+kzero_fill(void* arg)
+{
+    while (1) {
+        acquire(&kzero.lock);
+        int n = kzero.nfree;
+        release(&kzero.lock);
+        if (n >= NZERO) return;
+
+        // Only pages free anyway, not those of caches kalloc() shrinks.
+        struct run* r = kmem_take();
+        if (!r) return;
+        clear_page(r);
+        acquire(&kzero.lock);
+        r->next = kzero.free_list;
+        kzero.free_list = r;
+        kzero.nfree++;
+        release(&kzero.lock);
+    }
+}
+
+/* Give the cleared pages back to kalloc(). */
+static int
+kzero_shrink()
+{
+    acquire(&kzero.lock);
+    struct run* p = kzero.free_list;
+    int n = kzero.nfree;
+    kzero.free_list = NULL;
+    kzero.nfree = 0;
+    release(&kzero.lock);
+
+    for (struct run* next; p; p = next) {
+        next = p->next;
+        kfree((char*)p);
+    }
+    return n;
+}
+
+/*
+ * Allocate one BKSIZE-aligned block of BKSIZE bytes.
+ * Returns 0 if none is left; callers fall back to pages.
+ */
+char*
+kalloc_huge()
+{
+    acquire(&khuge.lock);
+    struct run* p = khuge.free_list;
+    if (p) {
+        khuge.free_list = p->next;
+        khuge.nfree--;
+    }
+    release(&khuge.lock);
+    return (char*)p;
+}
+
+/* Free a block from kalloc_huge(). */
+void
+kfree_huge(char* v)
+{
+    if ((uint64_t)v % BKSIZE || v < end || V2P(v) + BKSIZE > PHYSTOP)
+        panic("\tkfree_huge: invalid address: 0x%p\n", V2P(v));
+
+    struct run* r = (struct run*)v;
+    acquire(&khuge.lock);
+    r->next = khuge.free_list;
+    khuge.free_list = r;
+    khuge.nfree++;
+    release(&khuge.lock);
+}
+
+/* Break the free blocks up into pages for kalloc(). */
+static int
+khuge_shrink()
+{
+    acquire(&khuge.lock);
+    struct run* p = khuge.free_list;
+    int n = khuge.nfree;
+    khuge.free_list = NULL;
+    khuge.nfree = 0;
+    release(&khuge.lock);
+
+    for (struct run* next; p; p = next) {
+        next = p->next;
+        free_range(p, (char*)p + BKSIZE);
+    }
+    return n * (BKSIZE / PGSIZE);
+}
+
 void
 check_free_list()
 {
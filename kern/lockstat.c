@@ -0,0 +1,164 @@
+/*
+ * Lock contention statistics.
+ *
+ * initlock() and initsleeplock() look up the class of their name in
+ * a fixed table, claiming a free slot with a compare-and-swap, so
+ * that no lock is needed and the first locks can be counted too.
+ * Each class keeps its counters per CPU, so that counting doesn't
+ * add to the contention it measures. A read of the device adds them
+ * up and prints one line a class, most contended first; a write to
+ * it clears them.
+ */
+
+#include "lockstat.h"
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "file.h"
+#include "kalloc.h"
+#include "mmu.h"
+#include "proc.h"
+#include "string.h"
+#include "types.h"
+
+#define NCLASS 48  // Lock classes, all of whose lines fit in a page
+#define NAMESZ 12  // Width of the name column
+
+struct lockstat {
+    char* name;
+    int sleep;  // Sleeplocks rather than spinlocks
+    int ready;  // Name and sleep are set
+    struct {
+        uint64_t acquired;
+        uint64_t contended;  // Acquisitions that had to wait
+        uint64_t wait;       // Ticks spent waiting
+        uint64_t maxhold;    // Longest hold, in ticks
+    } __attribute__((aligned(64))) cpu[NCPU];
+};
+
+static struct lockstat classes[NCLASS];
+
+/*
+ * Return the class of spinlocks, or sleeplocks if sleep is set, that
+ * are called name, or NULL if the table is full.
+ */
+struct lockstat*
+lockstat_class(char* name, int sleep)
+{
+    for (struct lockstat* ls = classes; ls < classes + NCLASS; ++ls) {
+        char* n = __atomic_load_n(&ls->name, __ATOMIC_ACQUIRE);
+        if (!n
+            && __atomic_compare_exchange_n(
+                &ls->name, &n, name, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ls->sleep = sleep;
+            __atomic_store_n(&ls->ready, 1, __ATOMIC_RELEASE);
+            return ls;
+        }
+        // Someone else has the slot; wait until it says which class.
+        while (!__atomic_load_n(&ls->ready, __ATOMIC_ACQUIRE)) {
+        }
+        if (!strcmp(n, name) && ls->sleep == sleep) return ls;
+    }
+    return NULL;
+}
+
+void
+lockstat_acquired(struct lockstat* ls, int contended, uint64_t wait)
+{
+    int c = cpuid();
+    ls->cpu[c].acquired++;
+    if (contended) {
+        ls->cpu[c].contended++;
+        ls->cpu[c].wait += wait;
+    }
+}
+
+void
+lockstat_released(struct lockstat* ls, uint64_t hold)
+{
+    int c = cpuid();
+    if (hold > ls->cpu[c].maxhold) ls->cpu[c].maxhold = hold;
+}
+
+static uint64_t
+contended(struct lockstat* ls)
+{
+    uint64_t n = 0;
+    for (int c = 0; c < NCPU; c++) n += ls->cpu[c].contended;
+    return n;
+}
+
+/*
+ * Print a line for each class that has been taken, most contended
+ * first, into page, and return the length.
+ */
+static size_t
+lockstat_print(char* page)
+{
+    struct lockstat* order[NCLASS];
+    int n = 0;
+    for (struct lockstat* ls = classes; ls < classes + NCLASS; ++ls) {
+        if (!__atomic_load_n(&ls->ready, __ATOMIC_ACQUIRE)) continue;
+        int i = n++;
+        for (; i > 0 && contended(order[i - 1]) < contended(ls); i--)
+            order[i] = order[i - 1];
+        order[i] = ls;
+    }
+
+    static char header[] =
+        "name        type     acquired  contended       wait   max hold\n";
+    char* p = page + sizeof(header) - 1;
+    memmove(page, header, sizeof(header) - 1);
+    for (int i = 0; i < n; i++) {
+        struct lockstat* ls = order[i];
+        uint64_t acquired = 0, wait = 0, maxhold = 0;
+        for (int c = 0; c < NCPU; c++) {
+            acquired += ls->cpu[c].acquired;
+            wait += ls->cpu[c].wait;
+            maxhold = MAX(maxhold, ls->cpu[c].maxhold);
+        }
+        if (!acquired) continue;
+        if (p - page > PGSIZE - 128) break;  // Longest line possible
+        put_str(&p, ls->name, NAMESZ);
+        put_str(&p, ls->sleep ? "sleep" : "spin", 6);
+        put_num(&p, acquired, 11);
+        put_num(&p, contended(ls), 11);
+        put_num(&p, wait, 11);
+        put_num(&p, maxhold, 11);
+        *p++ = '\n';
+    }
+    return p - page;
+}
+
+static ssize_t
+lockstat_read(struct inode* ip, char* dst, size_t off, ssize_t n)
+{
+    char* page = kalloc();
+    if (!page) return -1;
+    size_t len = lockstat_print(page);
+    n = off < len ? MIN(n, len - off) : 0;
+    memmove(dst, page + off, n);
+    kfree(page);
+    return n;
+}
+
+/*
+ * Writing anything clears the counters.
+ */
+static ssize_t
+lockstat_write(struct inode* ip, char* src, ssize_t n)
+{
+    for (struct lockstat* ls = classes; ls < classes + NCLASS; ++ls)
+        memset(ls->cpu, 0, sizeof(ls->cpu));
+    return n;
+}
+
+void
+lockstat_init()
+{
+    devsw[LOCKSTAT_MAJOR].read = lockstat_read;
+    devsw[LOCKSTAT_MAJOR].write = lockstat_write;
+    cprintf("lockstat_init: success.\n");
+}
@@ -21,11 +21,17 @@
  *   block C
  *   ...
  * Log appends are synchronous.
+ *
+ * Inode updates are not logged as they happen. iupdate() marks the
+ * cached inode dirty and calls log_defer(), and commit() has iflush()
+ * copy every dirty inode into its block, one log_write() per block,
+ * before writing the log.
  */
 
 #include "buf.h"
 #include "console.h"
 #include "file.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "spinlock.h"
 #include "string.h"
@@ -46,6 +52,7 @@ struct log {
     int size;
     int outstanding;  // How many FS sys calls are executing.
     int committing;   // In commit(), please wait.
+    int ndeferred;    // Dirty inodes whose blocks are not yet logged.
     int dev;
     struct logheader lh;
 } log;
@@ -133,7 +140,9 @@ begin_op()
     while (1) {
         if (log.committing) {
             sleep(&log, &log.lock);
-        } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
+        } else if (log.lh.n + log.ndeferred +
+                       (log.outstanding + 1) * MAXOPBLOCKS >
+                   LOGSIZE) {
             // This op might exhaust log space; wait for commit.
             sleep(&log, &log.lock);
         } else {
@@ -194,6 +203,11 @@ write_log()
 static void
 commit()
 {
+    iflush();
+    acquire(&log.lock);
+    log.ndeferred = 0;
+    release(&log.lock);
+
     if (log.lh.n > 0) {
         write_log();
         write_head();
@@ -203,6 +217,21 @@ commit()
     }
 }
 
+/*
+ * Reserve log space for an inode that iupdate() has just made dirty.
+ * Its block is logged by iflush() at commit; until then begin_op()
+ * counts it against the log.
+ */
+void
+log_defer()
+{
+    if (log.outstanding < 1) panic("\tlog_defer: outside of transaction.\n");
+
+    acquire(&log.lock);
+    ++log.ndeferred;
+    release(&log.lock);
+}
+
 /*
  * Caller has modified b->data and is done with the buffer.
  * Record the block number and pin in the cache with B_DIRTY.
@@ -219,7 +248,8 @@ log_write(struct buf* b)
 {
     if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
         panic("\tlog_write: transaction is too big.\n");
-    if (log.outstanding < 1) panic("\tlog_write: outside of transaction.\n");
+    if (log.outstanding < 1 && !log.committing)
+        panic("\tlog_write: outside of transaction.\n");
 
     acquire(&log.lock);
     int i = 0;
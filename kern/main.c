@@ -4,14 +4,22 @@
 #include "buf.h"
 #include "console.h"
 #include "file.h"
+#include "futex.h"
+#include "ipi.h"
 #include "kalloc.h"
+#include "lockstat.h"
+#include "pcache.h"
 #include "proc.h"
 #include "sd.h"
+#include "softirq.h"
 #include "spinlock.h"
 #include "string.h"
 #include "timer.h"
 #include "trap.h"
+#include "uaccess.h"
+#include "vdso.h"
 #include "vm.h"
+#include "workqueue.h"
 
 static struct spinlock start_lock = {0};
 volatile static int started = 0;
@@ -25,16 +33,36 @@ main()
     if (!started) {
         memset(edata, 0, end - edata);
         console_init();
+#ifdef LOCKSTAT
+        lockstat_init();
+#endif
         cprintf("main: [CPU %d] init started.\n", cpuid());
         alloc_init();
+#ifdef STRING_TEST
+        string_test();
+#endif
+#ifdef VM_TEST
+        check_huge_pages();
+        check_uvm_range();
+#endif
         proc_init();
+        futex_init();
         lvbar(vectors);
+#ifdef UACCESS_TEST
+        uaccess_test();
+#endif
         irq_init();
+        ipi_init();
+        softirq_init();
         timer_init();
         file_init();
         binit();
+        icache_init();
+        pcache_init();
+        vdso_init();
         sd_init();
         user_init();
+        workqueue_init();  // After init, which must be pid 1
         started = 1;
         release(&start_lock);  // allow APs to run
     } else {
@@ -44,6 +72,12 @@ main()
         timer_init();
     }
     cprintf("main: [CPU %d] init success.\n", cpuid());
+#ifdef LOCK_TEST
+    lock_test();
+#endif
+#ifdef IPI_TEST
+    ipi_test();
+#endif
 
     scheduler();
 }
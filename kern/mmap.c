@@ -0,0 +1,425 @@
+/*
+ * Memory-mapped regions: mmap(), munmap() and mprotect().
+ *
+ * Regions live between MMAPBASE and MMAPTOP, above anything brk()
+ * will hand out, and are described by the vma[] table of the address
+ * space, whose lock is held to change them. Every page of a region
+ * is mapped when the region is created.
+ *
+ * A read-only file mapping maps the page cache pages themselves:
+ * every process mapping a file shares one copy, and nothing is copied
+ * on the way in. Such entries carry PTE_SHARED, and each holds a
+ * reference on its page, so the page cannot be recycled while mapped.
+ * Anonymous mappings and writable private file mappings get private
+ * pages. Writable shared file mappings are refused, since nothing
+ * writes user mappings back to the file.
+ */
+
+#include "mmap.h"
+
+#include <sys/mman.h>
+
+#include "console.h"
+#include "file.h"
+#include "kalloc.h"
+#include "log.h"
+#include "mmu.h"
+#include "pcache.h"
+#include "proc.h"
+#include "string.h"
+#include "syscall1.h"
+#include "types.h"
+#include "vm.h"
+
+/*
+ * Return the first region of mm overlapping [start, end), or NULL.
+ */
+static struct vma*
+vma_find(struct mm* mm, uint64_t start, uint64_t end)
+{
+    for (struct vma* v = mm->vma; v < mm->vma + NVMA; ++v)
+        if (v->start < end && start < v->end) return v;
+    return NULL;
+}
+
+/*
+ * Return the lowest address in the mmap() area where len bytes
+ * are free, or 0 if there is none.
+ */
+static uint64_t
+vma_gap(struct mm* mm, uint64_t len)
+{
+    uint64_t addr = MMAPBASE;
+    for (struct vma* v; addr + len <= MMAPTOP; addr = v->end)
+        if (!(v = vma_find(mm, addr, addr + len))) return addr;
+    return 0;
+}
+
+/*
+ * Return an unused slot of mm's vma[] table, or NULL.
+ */
+static struct vma*
+vma_spare(struct mm* mm)
+{
+    for (struct vma* v = mm->vma; v < mm->vma + NVMA; ++v)
+        if (!v->end) return v;
+    return NULL;
+}
+
+/*
+ * Unmap the pages from start to end, dropping the references
+ * of page cache pages and freeing private ones.
+ */
+static void
+vma_unmap(uint64_t* pgdir, uint64_t start, uint64_t end)
+{
+    for (uint64_t va = start; va < end; va += PGSIZE) {
+        uint64_t pte;
+        char* page = uvm_unmap_page(pgdir, va, &pte);
+        if (!page) continue;
+        if (pte & PTE_SHARED)
+            pcache_unpin(page);
+        else
+            kfree(page);
+    }
+}
+
+/*
+ * Return the page table permissions for memory with protection prot.
+ */
+static int64_t
+vma_perm(int prot)
+{
+    int64_t perm = PTE_PAGE | (prot & PROT_WRITE ? PTE_RW : PTE_RO);
+    if (prot != PROT_NONE) perm |= PTE_USER;
+    return perm;
+}
+
+/*
+ * Map the pages of v from start to end into pgdir.
+ * Caller must hold v->ip->lock for a file mapping, and must
+ * vma_unmap() the range on failure.
+ */
+static int
+vma_fill(uint64_t* pgdir, struct vma* v, uint64_t start, uint64_t end)
+{
+    int64_t perm = vma_perm(v->prot);
+
+    for (uint64_t va = start; va < end; va += PGSIZE) {
+        struct page* pg = NULL;
+        uint64_t index = (v->off + va - v->start) / PGSIZE;
+        if (v->ip && !(pg = readpage(v->ip, index))) return -1;
+
+        // Share the page itself; the mapping keeps the reference.
+        if (pg && !(v->prot & PROT_WRITE)) {
+            if (map_region(
+                    pgdir, (void*)va, PGSIZE, (uint64_t)pg->data,
+                    perm | PTE_SHARED)) {
+                pcache_put(pg);
+                return -1;
+            }
+            continue;
+        }
+
+        char* mem = pg ? kalloc() : kalloc_zeroed();
+        if (mem && pg) copy_page(mem, pg->data);
+        if (pg) pcache_put(pg);
+        if (!mem) return -1;
+        if (map_region(pgdir, (void*)va, PGSIZE, (uint64_t)mem, perm)) {
+            kfree(mem);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Give the regions of mm to the copy nmm made by fork(), sharing
+ * page cache pages and copying private ones. On failure nothing is
+ * left mapped in nmm. Caller must hold mm->lock.
+ */
+int
+vma_copy(struct mm* nmm, struct mm* mm)
+{
+    for (struct vma* v = mm->vma; v < mm->vma + NVMA; ++v) {
+        if (!v->end) continue;
+        for (uint64_t va = v->start; va < v->end; va += PGSIZE) {
+            uint64_t pte;
+            char* page = uvm_page(mm->pgdir, va, &pte);
+            if (!page) continue;
+
+            char* mem = page;
+            if (pte & PTE_SHARED) {
+                pcache_pin(page);
+            } else if ((mem = kalloc())) {
+                copy_page(mem, page);
+            } else {
+                goto bad;
+            }
+            if (map_region(
+                    nmm->pgdir, (void*)va, PGSIZE, (uint64_t)mem,
+                    PTE_FLAGS(pte) | (pte & PTE_SHARED))) {
+                if (pte & PTE_SHARED)
+                    pcache_unpin(mem);
+                else
+                    kfree(mem);
+                goto bad;
+            }
+        }
+        nmm->vma[v - mm->vma] = *v;
+    }
+
+    // Only now take the inode references, which can't be
+    // dropped here without a transaction.
+    for (struct vma* v = nmm->vma; v < nmm->vma + NVMA; ++v)
+        if (v->ip) idup(v->ip);
+    return 0;
+
+bad:
+    for (struct vma* v = mm->vma; v < mm->vma + NVMA; ++v)
+        if (v->end) vma_unmap(nmm->pgdir, v->start, v->end);
+    memset(nmm->vma, 0, sizeof(nmm->vma));
+    return -1;
+}
+
+/*
+ * Unmap every region of mm, as its last user exits or execs.
+ */
+void
+vma_free(struct mm* mm)
+{
+    int files = 0;
+    for (struct vma* v = mm->vma; v < mm->vma + NVMA; ++v) {
+        if (!v->end) continue;
+        vma_unmap(mm->pgdir, v->start, v->end);
+        files |= !!v->ip;
+    }
+
+    if (files) {
+        begin_op();
+        for (struct vma* v = mm->vma; v < mm->vma + NVMA; ++v)
+            if (v->ip) iput(v->ip);
+        end_op();
+    }
+    memset(mm->vma, 0, sizeof(mm->vma));
+}
+
+/*
+ * Split v at addr, inside it, into two regions, the upper one in the
+ * unused slot spare.
+ */
+static void
+vma_split(struct vma* v, struct vma* spare, uint64_t addr)
+{
+    *spare = *v;
+    spare->off += addr - v->start;
+    spare->start = addr;
+    if (spare->ip) idup(spare->ip);
+    v->end = addr;
+}
+
+/*
+ * Remap the pages of v from start to end with the protection of v.
+ * A page cache page shared by a region made writable is replaced by
+ * a private copy. Returns -1 if memory runs out.
+ */
+static int
+vma_reprotect(uint64_t* pgdir, struct vma* v, uint64_t start, uint64_t end)
+{
+    int r = 0;
+    for (uint64_t va = start; va < end; va += PGSIZE) {
+        uint64_t pte;
+        char* page = uvm_unmap_page(pgdir, va, &pte);
+        if (!page) continue;
+
+        int64_t perm = vma_perm(v->prot) | (pte & PTE_SHARED);
+        if ((pte & PTE_SHARED) && (v->prot & PROT_WRITE)) {
+            char* mem = kalloc();
+            if (mem) {
+                copy_page(mem, page);
+                pcache_unpin(page);
+                page = mem;
+                perm &= ~PTE_SHARED;
+            } else {
+                perm = PTE_FLAGS(pte) | PTE_SHARED;  // Leave it as it was
+                r = -1;
+            }
+        }
+        // The table is there already, so this cannot fail.
+        map_region(pgdir, (void*)va, PGSIZE, (uint64_t)page, perm);
+    }
+    return r;
+}
+
+uint64_t
+sys_mmap()
+{
+    uint64_t addr, len, prot, flags, fd, off;
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0
+        || argint(3, &flags) < 0 || argint(4, &fd) < 0 || argint(5, &off) < 0)
+        return -1;
+
+    struct proc* p = thisproc();
+    struct mm* mm = p->mm;
+    struct file* f = NULL;
+    int type = flags & (MAP_SHARED | MAP_PRIVATE);
+
+    len = ROUNDUP(len, PGSIZE);
+    if (!len || len > MMAPTOP - MMAPBASE || off % PGSIZE) return -1;
+    if (type != MAP_SHARED && type != MAP_PRIVATE) return -1;
+    if (flags & MAP_ANONYMOUS) {
+        if (type == MAP_SHARED) {
+            cprintf("sys_mmap: shared anonymous memory unimplemented.\n");
+            return -1;
+        }
+    } else {
+        if (fd >= NOFILE || !(f = p->files->ofile[fd]) || f->type != FD_INODE
+            || !f->readable)
+            return -1;
+        if (type == MAP_SHARED && (prot & PROT_WRITE)) {
+            cprintf("sys_mmap: writable shared mappings unimplemented.\n");
+            return -1;
+        }
+    }
+
+    acquiresleep(&mm->lock);
+    struct vma* v = vma_spare(mm);
+    if (flags & MAP_FIXED) {
+        if (addr % PGSIZE || addr < MMAPBASE || addr + len > MMAPTOP
+            || vma_find(mm, addr, addr + len))
+            v = NULL;
+    } else if (!(addr = vma_gap(mm, len))) {
+        v = NULL;
+    }
+    if (!v) {
+        releasesleep(&mm->lock);
+        return -1;
+    }
+
+    int r;
+    struct vma nv = {addr, addr + len, prot, flags, NULL, off};
+    if (f) {
+        ilock_shared(f->ip);
+        if (f->ip->type == T_FILE) {
+            nv.ip = f->ip;
+            r = vma_fill(mm->pgdir, &nv, nv.start, nv.end);
+        } else {
+            r = -1;
+        }
+        iunlock_shared(f->ip);
+        if (!r) idup(f->ip);
+    } else {
+        r = vma_fill(mm->pgdir, &nv, nv.start, nv.end);
+    }
+    if (r < 0) {
+        vma_unmap(mm->pgdir, nv.start, nv.end);
+        tlb_shootdown(nv.start, nv.end);
+    } else {
+        *v = nv;
+    }
+    releasesleep(&mm->lock);
+    return r < 0 ? -1 : addr;
+}
+
+int
+sys_munmap()
+{
+    uint64_t addr, len;
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0) return -1;
+
+    struct mm* mm = thisproc()->mm;
+    uint64_t end = addr + ROUNDUP(len, PGSIZE);
+    if (addr % PGSIZE || end <= addr) return -1;
+
+    // Unmapping the middle of a region splits it in two.
+    acquiresleep(&mm->lock);
+    struct vma* spare = NULL;
+    struct vma* v = vma_find(mm, addr, end);
+    if (v && v->start < addr && end < v->end && !(spare = vma_spare(mm))) {
+        releasesleep(&mm->lock);
+        return -1;
+    }
+
+    int put = 0;
+    while ((v = vma_find(mm, addr, end))) {
+        uint64_t s = MAX(addr, v->start), e = MIN(end, v->end);
+        vma_unmap(mm->pgdir, s, e);
+        if (s == v->start && e == v->end) {
+            put |= !!v->ip;  // Leave ip for the iput() below
+            v->start = v->end = 0;
+        } else if (s == v->start) {
+            v->off += e - v->start;
+            v->start = e;
+        } else if (e == v->end) {
+            v->end = s;
+        } else {
+            vma_split(v, spare, e);
+            v->end = s;
+        }
+    }
+    tlb_shootdown(addr, end);
+
+    if (put) {
+        begin_op();
+        for (v = mm->vma; v < mm->vma + NVMA; ++v) {
+            if (!v->end && v->ip) {
+                iput(v->ip);
+                v->ip = NULL;
+            }
+        }
+        end_op();
+    }
+    releasesleep(&mm->lock);
+    return 0;
+}
+
+/*
+ * Change the protection of the pages in [addr, addr + len), which
+ * must all lie in regions. A region partly in the range is split at
+ * its ends. Writable shared file mappings are refused, as in mmap().
+ */
+int
+sys_mprotect()
+{
+    uint64_t addr, len, prot;
+    if (argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0)
+        return -1;
+
+    struct mm* mm = thisproc()->mm;
+    uint64_t end = addr + ROUNDUP(len, PGSIZE);
+    if (addr % PGSIZE || end < addr) return -1;
+
+    // Check the whole range first, and count the slots splits take.
+    acquiresleep(&mm->lock);
+    int nsplit = 0, nspare = 0;
+    struct vma* v;
+    for (uint64_t a = addr; a < end; a = v->end) {
+        if (!(v = vma_find(mm, a, a + 1))
+            || (v->ip && (v->flags & MAP_SHARED) && (prot & PROT_WRITE))) {
+            releasesleep(&mm->lock);
+            return -1;
+        }
+        nsplit += (v->start < addr) + (end < v->end);
+    }
+    for (v = mm->vma; v < mm->vma + NVMA; ++v) nspare += !v->end;
+    if (nsplit > nspare) {
+        releasesleep(&mm->lock);
+        return -1;
+    }
+
+    int r = 0;
+    for (uint64_t a = addr; a < end;) {
+        v = vma_find(mm, a, a + 1);
+        if (v->start < a) {
+            vma_split(v, vma_spare(mm), a);
+            continue;
+        }
+        if (end < v->end) vma_split(v, vma_spare(mm), end);
+        v->prot = prot;
+        if (vma_reprotect(mm->pgdir, v, v->start, v->end) < 0) r = -1;
+        a = v->end;
+    }
+    tlb_shootdown(addr, end);
+    releasesleep(&mm->lock);
+    return r;
+}
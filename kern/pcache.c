@@ -0,0 +1,374 @@
+/*
+ * Page cache.
+ *
+ * The page cache holds PGSIZE pages of regular file data, so that
+ * readi() copies from one page instead of eight buffer cache blocks,
+ * and so that mmap() can hand the very same pages to user space.
+ *
+ * Interface:
+ *   pcache_get() finds or recycles the page for (dev, inum, index)
+ *     and returns it referenced; readpage() in fs.c fills it when
+ *     page->valid is clear. Release it with pcache_put(), and take
+ *     another reference with pcache_dup().
+ *   writei() keeps cached pages current with pcache_write() after
+ *     each block, since file writes still go through the buffer
+ *     cache and the log.
+ *   itrunc() calls pcache_drop() to forget a file's pages.
+ *   A user mapping holds a reference on its page; pcache_pin() and
+ *     pcache_unpin() take and drop one given the page's address.
+ *   splice() and sendfile() lend pages to pipes, which hold a
+ *     reference until the data has been read. Later writes to the
+ *     file show through, as they do through a mapping.
+ *
+ * Pages are got under the file's inode lock, which readers share, so
+ * two readers can miss the same page at once. pcache_get() looks again
+ * once it has memory for the page, and the later one takes the page
+ * the earlier one put in. readpage() fills pages under the inode's
+ * fill lock, so only one of them reads it from disk.
+ *
+ * Unreferenced pages wait on an LRU list for reuse, descriptors
+ * without memory at the least recent end. When kalloc() runs out of
+ * memory, pcache_shrink() gives back the memory of every unreferenced
+ * page.
+ */
+
+#include "pcache.h"
+
+#include "console.h"
+#include "kalloc.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "string.h"
+
+#define NPHASH 67  // Buckets in the page hash table
+
+struct {
+    struct spinlock lock;
+    struct page page[NPAGE];
+    struct page* hash[NPHASH];
+    struct page* dhash[NPHASH];  // Pages with memory, by its address
+
+    // Linked list of unreferenced pages.
+    // head.next is most recent, head.prev is least.
+    struct page head;
+
+    uint64_t nget;     // Calls to pcache_get()
+    uint64_t nhit;     // pcache_get() found the page cached
+    uint64_t nshrink;  // Pages given back to kalloc()
+} pcache;
+
+static struct page**
+phash(uint32_t dev, uint32_t inum, uint32_t index)
+{
+    return &pcache.hash[(dev * 31 + inum * 131 + index) % NPHASH];
+}
+
+static struct page**
+pdata(char* data)
+{
+    return &pcache.dhash[(uint64_t)data / PGSIZE % NPHASH];
+}
+
+/*
+ * Give pg the memory at data, or none if data is NULL, keeping the
+ * table by address that pcache_pin() looks pages up in current.
+ */
+static void
+pset_data(struct page* pg, char* data)
+{
+    if (pg->data) {
+        struct page** pp = pdata(pg->data);
+        while (*pp != pg) pp = &(*pp)->dnext;
+        *pp = pg->dnext;
+    }
+    pg->data = data;
+    if (data) {
+        pg->dnext = *pdata(data);
+        *pdata(data) = pg;
+    }
+}
+
+static void
+punhash(struct page* pg)
+{
+    struct page** pp = phash(pg->dev, pg->inum, pg->index);
+    while (*pp != pg) pp = &(*pp)->hnext;
+    *pp = pg->hnext;
+    pg->hnext = NULL;
+    pg->inum = 0;
+}
+
+static void
+lru_remove(struct page* pg)
+{
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+}
+
+/* Insert pg at the most recent end if it has memory, else at the least. */
+static void
+lru_insert(struct page* pg)
+{
+    struct page* at = pg->data ? &pcache.head : pcache.head.prev;
+    pg->next = at->next;
+    pg->prev = at;
+    at->next->prev = pg;
+    at->next = pg;
+}
+
+/*
+ * Give back the memory of every unreferenced page.
+ * Called by kalloc() when memory runs out.
+ * Returns the number of pages freed.
+ */
+static int
+pcache_shrink()
+{
+    char* freed = NULL;
+    int n = 0;
+
+    acquire(&pcache.lock);
+    for (struct page *pg = pcache.head.next, *next; pg != &pcache.head;
+         pg = next) {
+        next = pg->next;
+        if (!pg->data) continue;
+        if (pg->inum) punhash(pg);
+        *(char**)pg->data = freed;
+        freed = pg->data;
+        pset_data(pg, NULL);
+        pg->valid = 0;
+        lru_remove(pg);
+        lru_insert(pg);
+        ++n;
+    }
+    pcache.nshrink += n;
+    release(&pcache.lock);
+
+    while (freed) {
+        char* p = freed;
+        freed = *(char**)p;
+        kfree(p);
+    }
+    return n;
+}
+
+void
+pcache_init()
+{
+    initlock(&pcache.lock, "pcache");
+    pcache.head.prev = &pcache.head;
+    pcache.head.next = &pcache.head;
+    for (struct page* pg = pcache.page; pg < pcache.page + NPAGE; ++pg)
+        lru_insert(pg);
+    register_shrinker(pcache_shrink);
+    cprintf("pcache_init: success.\n");
+}
+
+/*
+ * Print page cache statistics.
+ */
+void
+pcache_dump()
+{
+    acquire(&pcache.lock);
+    cprintf(
+        "pcache: %d pages; get %llu hit %llu; pages shrunk %llu\n", NPAGE,
+        pcache.nget, pcache.nhit, pcache.nshrink);
+    release(&pcache.lock);
+}
+
+/*
+ * Return the page for the index'th PGSIZE bytes of inode inum on
+ * device dev, with a reference held. The page is not read from disk
+ * if it wasn't cached; its valid flag is clear instead.
+ * Returns NULL if every page is in use or no memory is left.
+ * Caller must hold the inode's lock.
+ */
+struct page*
+pcache_get(uint32_t dev, uint32_t inum, uint32_t index)
+{
+    acquire(&pcache.lock);
+    pcache.nget++;
+
+    // Is the page already cached?
+    for (struct page* pg = *phash(dev, inum, index); pg; pg = pg->hnext) {
+        if (pg->dev == dev && pg->inum == inum && pg->index == index) {
+            if (!pg->ref++) lru_remove(pg);
+            pcache.nhit++;
+            release(&pcache.lock);
+            return pg;
+        }
+    }
+
+    // Not cached; recycle the least recently used page,
+    // keeping its memory if it has any.
+    struct page* pg = pcache.head.prev;
+    if (pg == &pcache.head) {
+        release(&pcache.lock);
+        return NULL;
+    }
+    lru_remove(pg);
+    if (pg->inum) punhash(pg);
+    pg->ref = 1;
+    pg->valid = 0;
+    release(&pcache.lock);
+
+    char* data = pg->data;
+    if (!data && !(data = kalloc())) {
+        pcache_put(pg);
+        return NULL;
+    }
+
+    // Someone else may have cached it meanwhile; if so,
+    // give ours back and take theirs.
+    acquire(&pcache.lock);
+    if (!pg->data) pset_data(pg, data);
+    struct page** pp = phash(dev, inum, index);
+    for (struct page* other = *pp; other; other = other->hnext) {
+        if (other->dev == dev && other->inum == inum
+            && other->index == index) {
+            if (!other->ref++) lru_remove(other);
+            pg->ref = 0;
+            lru_insert(pg);
+            release(&pcache.lock);
+            return other;
+        }
+    }
+    pg->dev = dev;
+    pg->inum = inum;
+    pg->index = index;
+    pg->hnext = *pp;
+    *pp = pg;
+    release(&pcache.lock);
+    return pg;
+}
+
+/*
+ * Take another reference to a referenced page.
+ */
+void
+pcache_dup(struct page* pg)
+{
+    acquire(&pcache.lock);
+    if (pg->ref < 1) panic("\tpcache_dup: page not referenced.\n");
+    pg->ref++;
+    release(&pcache.lock);
+}
+
+/*
+ * Drop a reference to a page.
+ * The memory of a page dropped from the cache is freed with its
+ * last reference.
+ */
+void
+pcache_put(struct page* pg)
+{
+    char* freed = NULL;
+
+    acquire(&pcache.lock);
+    if (pg->ref < 1) panic("\tpcache_put: page not referenced.\n");
+    if (!--pg->ref) {
+        if (!pg->inum) {
+            freed = pg->data;
+            pset_data(pg, NULL);
+            pg->valid = 0;
+        }
+        lru_insert(pg);
+    }
+    release(&pcache.lock);
+
+    if (freed) kfree(freed);
+}
+
+/*
+ * Copy n bytes at src into the cached page of the inode holding
+ * offset off, if it is cached, after writei() has written them to
+ * the file. The bytes must not cross a page boundary. The copy is
+ * made holding a reference to the page, not pcache.lock.
+ * Caller must hold the inode's lock.
+ */
+void
+pcache_write(uint32_t dev, uint32_t inum, size_t off, char* src, size_t n)
+{
+    uint32_t index = off / PGSIZE;
+    struct page* pg;
+
+    acquire(&pcache.lock);
+    for (pg = *phash(dev, inum, index); pg; pg = pg->hnext)
+        if (pg->dev == dev && pg->inum == inum && pg->index == index) break;
+    if (pg && pg->valid) {
+        if (!pg->ref++) lru_remove(pg);
+    } else {
+        pg = NULL;
+    }
+    release(&pcache.lock);
+
+    if (!pg) return;
+    memmove(pg->data + off % PGSIZE, src, n);
+    pcache_put(pg);
+}
+
+/*
+ * Forget every cached page of the inode, as its content is going away.
+ * Pages still mapped by a process live on until they are unmapped.
+ */
+void
+pcache_drop(uint32_t dev, uint32_t inum)
+{
+    char* freed = NULL;
+
+    acquire(&pcache.lock);
+    for (struct page* pg = pcache.page; pg < pcache.page + NPAGE; ++pg) {
+        if (pg->dev != dev || pg->inum != inum) continue;
+        punhash(pg);
+        if (pg->ref || !pg->data) continue;
+        *(char**)pg->data = freed;
+        freed = pg->data;
+        pset_data(pg, NULL);
+        pg->valid = 0;
+        lru_remove(pg);
+        lru_insert(pg);
+    }
+    release(&pcache.lock);
+
+    while (freed) {
+        char* p = freed;
+        freed = *(char**)p;
+        kfree(p);
+    }
+}
+
+static struct page*
+pcache_lookup(char* data)
+{
+    for (struct page* pg = *pdata(data); pg; pg = pg->dnext)
+        if (pg->data == data) return pg;
+    panic("\tpcache_lookup: not a page cache page.\n");
+    return NULL;
+}
+
+/*
+ * Take a reference on the page whose memory is at data,
+ * for a new user mapping of it.
+ */
+void
+pcache_pin(char* data)
+{
+    acquire(&pcache.lock);
+    struct page* pg = pcache_lookup(data);
+    if (pg->ref < 1) panic("\tpcache_pin: page not referenced.\n");
+    pg->ref++;
+    release(&pcache.lock);
+}
+
+/*
+ * Drop the reference of a user mapping of the page at data.
+ */
+void
+pcache_unpin(char* data)
+{
+    acquire(&pcache.lock);
+    struct page* pg = pcache_lookup(data);
+    release(&pcache.lock);
+    pcache_put(pg);
+}
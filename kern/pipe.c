@@ -0,0 +1,393 @@
+/*
+ * Pipes.
+ *
+ * A pipe is a ring of buffers, one slot to begin with and up to
+ * PIPE_MAXPAGES after F_SETPIPE_SZ, indexed by the free-running slot
+ * counts head and tail. Each buffer holds part of one page: either a
+ * page of the pipe's own, which write() fills and later writes append
+ * to, or a page cache page that splice() or sendfile() lent to the
+ * pipe, which is read in place and never written. Data moves with
+ * memmove() in runs that stay within one page, and splice() moves
+ * whole buffers between pipes and files without copying them.
+ *
+ * Wakeups are batched, since wakeup() visits every process. A writer
+ * wakes sleeping readers once per write, or when the ring fills up,
+ * rather than per run. A reader wakes sleeping writers only once the
+ * room in the ring reaches wneed, the least any of them waits for:
+ * half the ring, or the whole of a write of up to PIPE_ATOMIC bytes,
+ * which must not be split.
+ */
+
+#include <stdint.h>
+
+#include "console.h"
+#include "file.h"
+#include "kalloc.h"
+#include "mmu.h"
+#include "pcache.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "string.h"
+#include "types.h"
+
+#define PIPE_ATOMIC PGSIZE  // Writes this small aren't interleaved, PIPE_BUF
+
+struct pipe {
+    struct spinlock lock;
+    struct pipe_buf buf[PIPE_MAXPAGES];  // The ring, nbuf long
+    int nbuf;
+    uint32_t head;  // Buffers filled, readers sleep on it
+    uint32_t tail;  // Buffers emptied, writers sleep on it
+    char* spare;    // Own page emptied by a reader, for the next write
+    int readopen;   // Read fd is still open
+    int writeopen;  // Write fd is still open
+    int rwait;      // Readers asleep on head
+    int wwait;      // Writers asleep on tail
+    size_t wneed;   // Room the writers asleep wait for
+};
+
+static inline struct pipe_buf*
+pipe_buf(struct pipe* pi, uint32_t i)
+{
+    return &pi->buf[i % pi->nbuf];
+}
+
+/*
+ * Return the number of bytes that fit in the pipe: the free slots,
+ * and what is left of the last buffer if it is our own.
+ */
+static size_t
+pipe_room(struct pipe* pi)
+{
+    size_t room = (pi->nbuf - (pi->head - pi->tail)) * PGSIZE;
+    if (pi->head != pi->tail) {
+        struct pipe_buf* b = pipe_buf(pi, pi->head - 1);
+        if (!b->pg) room += PGSIZE - b->off - b->len;
+    }
+    return room;
+}
+
+/*
+ * Release a buffer taken out of the ring, keeping an own page
+ * as the spare if there is none.
+ */
+static void
+pipe_drop(struct pipe* pi, struct pipe_buf* b)
+{
+    if (!b->pg && !pi->spare)
+        pi->spare = b->data;
+    else
+        pipe_buf_release(b);
+}
+
+/*
+ * Wake the writers asleep if the room they wait for is there.
+ */
+static void
+pipe_wakewriters(struct pipe* pi)
+{
+    if (pi->wwait && pipe_room(pi) >= pi->wneed) {
+        pi->wneed = SIZE_MAX;
+        wakeup(&pi->tail);
+    }
+}
+
+/*
+ * Copy n bytes at addr into the pipe, which has room for them,
+ * appending to the last buffer and then filling new ones.
+ * Returns the number of bytes copied, short if memory runs out.
+ */
+static size_t
+pipe_fill(struct pipe* pi, char* addr, size_t n)
+{
+    size_t tot = 0, m;
+    if (pi->head != pi->tail) {
+        struct pipe_buf* b = pipe_buf(pi, pi->head - 1);
+        if (!b->pg && (m = MIN(n, PGSIZE - b->off - b->len))) {
+            memmove(b->data + b->off + b->len, addr, m);
+            b->len += m;
+            tot += m;
+        }
+    }
+    for (; tot < n; tot += m) {
+        char* page = pi->spare ? pi->spare : kalloc();
+        if (!page) break;
+        pi->spare = NULL;
+        m = MIN(n - tot, PGSIZE);
+        memmove(page, addr + tot, m);
+        *pipe_buf(pi, pi->head++) = (struct pipe_buf){page, NULL, 0, m};
+    }
+    return tot;
+}
+
+/*
+ * Create a pipe, and a file for each end of it.
+ */
+int
+pipe_alloc(struct file** f0, struct file** f1)
+{
+    struct pipe* pi = NULL;
+    *f0 = *f1 = NULL;
+    if (!(*f0 = file_alloc()) || !(*f1 = file_alloc())) goto bad;
+    if (!(pi = (struct pipe*)kalloc())) goto bad;
+    memset(pi, 0, sizeof(*pi));
+
+    initlock(&pi->lock, "pipe");
+    pi->nbuf = 1;
+    pi->readopen = 1;
+    pi->writeopen = 1;
+    pi->wneed = SIZE_MAX;
+    (*f0)->type = FD_PIPE;
+    (*f0)->readable = 1;
+    (*f0)->writable = 0;
+    (*f0)->pipe = pi;
+    (*f1)->type = FD_PIPE;
+    (*f1)->readable = 0;
+    (*f1)->writable = 1;
+    (*f1)->pipe = pi;
+    return 0;
+
+bad:
+    if (pi) kfree((char*)pi);
+    if (*f0) file_close(*f0);
+    if (*f1) file_close(*f1);
+    return -1;
+}
+
+/*
+ * Close one end of a pipe, and free it once both are closed.
+ */
+void
+pipe_close(struct pipe* pi, int writable)
+{
+    acquire(&pi->lock);
+    if (writable) {
+        pi->writeopen = 0;
+        wakeup(&pi->head);
+    } else {
+        pi->readopen = 0;
+        wakeup(&pi->tail);
+    }
+    if (pi->readopen || pi->writeopen) {
+        release(&pi->lock);
+        return;
+    }
+    release(&pi->lock);
+
+    for (uint32_t i = pi->tail; i != pi->head; ++i)
+        pipe_buf_release(pipe_buf(pi, i));
+    if (pi->spare) kfree(pi->spare);
+    kfree((char*)pi);
+}
+
+/*
+ * Write n bytes at addr to the pipe, sleeping while it is full.
+ * Returns n, or -1 if the read end is closed or we are killed.
+ * Returns the number of bytes written if memory runs out.
+ */
+ssize_t
+pipe_write(struct pipe* pi, char* addr, size_t n)
+{
+    acquire(&pi->lock);
+    size_t i = 0;
+    while (i < n) {
+        if (!pi->readopen || thisproc()->killed) {
+            release(&pi->lock);
+            return -1;
+        }
+
+        size_t room = pipe_room(pi);
+        size_t need =
+            n <= PIPE_ATOMIC ? n : MIN(n - i, pi->nbuf * PGSIZE / 2);
+        if (room < need && (n <= PIPE_ATOMIC || !room)) {
+            if (pi->rwait) wakeup(&pi->head);
+            pi->wneed = MIN(pi->wneed, need);
+            pi->wwait++;
+            sleep(&pi->tail, &pi->lock);
+            pi->wwait--;
+            continue;
+        }
+
+        size_t m = MIN(n - i, room);
+        size_t r = pipe_fill(pi, addr + i, m);
+        i += r;
+        if (r != m) break;
+    }
+    if (pi->rwait) wakeup(&pi->head);
+    release(&pi->lock);
+    return i || !n ? i : -1;
+}
+
+/*
+ * Read up to n bytes from the pipe into addr, sleeping while it is
+ * empty and may still be written. Returns the number of bytes read,
+ * 0 at end of file, or -1 if we are killed.
+ */
+ssize_t
+pipe_read(struct pipe* pi, char* addr, size_t n)
+{
+    acquire(&pi->lock);
+    while (pi->head == pi->tail && pi->writeopen) {
+        if (thisproc()->killed) {
+            release(&pi->lock);
+            return -1;
+        }
+        pi->rwait++;
+        sleep(&pi->head, &pi->lock);
+        pi->rwait--;
+    }
+
+    size_t tot = 0;
+    while (tot < n && pi->head != pi->tail) {
+        struct pipe_buf* b = pipe_buf(pi, pi->tail);
+        size_t m = MIN(n - tot, b->len);
+        memmove(addr + tot, b->data + b->off, m);
+        b->off += m;
+        b->len -= m;
+        tot += m;
+        if (!b->len) {
+            pipe_drop(pi, b);
+            pi->tail++;
+        }
+    }
+    pipe_wakewriters(pi);
+    release(&pi->lock);
+    return tot;
+}
+
+/*
+ * Append buffer b, whose page reference the pipe takes over, to the
+ * pipe, sleeping while every slot is in use. Returns 0, or -1 if the
+ * read end is closed or we are killed, and b is still the caller's.
+ */
+int
+pipe_give(struct pipe* pi, struct pipe_buf* b)
+{
+    acquire(&pi->lock);
+    for (;;) {
+        if (!pi->readopen || thisproc()->killed) {
+            release(&pi->lock);
+            return -1;
+        }
+        if (pi->head - pi->tail < pi->nbuf) break;
+        if (pi->rwait) wakeup(&pi->head);
+        pi->wneed = MIN(pi->wneed, PGSIZE);
+        pi->wwait++;
+        sleep(&pi->tail, &pi->lock);
+        pi->wwait--;
+    }
+    *pipe_buf(pi, pi->head++) = *b;
+    if (pi->rwait) wakeup(&pi->head);
+    release(&pi->lock);
+    return 0;
+}
+
+/*
+ * Take up to n bytes at the front of the pipe out of it, as buffer b,
+ * which the caller releases with pipe_buf_release(). Sleeps while the
+ * pipe is empty and may still be written if wait is set.
+ * Returns the length of b, 0 at end of file or if the pipe is empty
+ * and wait is clear, or -1 if we are killed or memory runs out.
+ *
+ * A buffer is handed over whole if it fits; otherwise a page cache
+ * page gets another reference, and bytes of our own are copied out.
+ */
+ssize_t
+pipe_take(struct pipe* pi, struct pipe_buf* b, size_t n, int wait)
+{
+    acquire(&pi->lock);
+    while (pi->head == pi->tail) {
+        if (!pi->writeopen || !wait) {
+            release(&pi->lock);
+            return 0;
+        }
+        if (thisproc()->killed) {
+            release(&pi->lock);
+            return -1;
+        }
+        pi->rwait++;
+        sleep(&pi->head, &pi->lock);
+        pi->rwait--;
+    }
+
+    struct pipe_buf* f = pipe_buf(pi, pi->tail);
+    *b = *f;
+    if (n >= f->len) {
+        pi->tail++;
+    } else if (f->pg) {
+        pcache_dup(f->pg);
+        b->len = n;
+    } else {
+        char* page = pi->spare ? pi->spare : kalloc();
+        if (!page) {
+            release(&pi->lock);
+            return -1;
+        }
+        pi->spare = NULL;
+        memmove(page, f->data + f->off, n);
+        *b = (struct pipe_buf){page, NULL, 0, n};
+    }
+    if (n < f->len) {
+        f->off += n;
+        f->len -= n;
+    }
+    pipe_wakewriters(pi);
+    release(&pi->lock);
+    return b->len;
+}
+
+/*
+ * Release the page of a buffer taken out of a pipe.
+ */
+void
+pipe_buf_release(struct pipe_buf* b)
+{
+    if (b->pg)
+        pcache_put(b->pg);
+    else
+        kfree(b->data);
+}
+
+/*
+ * Return the size of the ring in bytes.
+ */
+size_t
+pipe_size(struct pipe* pi)
+{
+    acquire(&pi->lock);
+    size_t size = pi->nbuf * PGSIZE;
+    release(&pi->lock);
+    return size;
+}
+
+/*
+ * Resize the ring to hold at least n bytes, rounded up to a power of
+ * two pages, as F_SETPIPE_SZ does. Returns the new size in bytes,
+ * or -1 if that is over PIPE_MAXPAGES pages, or if the buffers in the
+ * pipe wouldn't fit.
+ */
+ssize_t
+pipe_resize(struct pipe* pi, size_t n)
+{
+    int nbuf = 1;
+    while (nbuf < PIPE_MAXPAGES && nbuf * PGSIZE < n) nbuf *= 2;
+    if (nbuf * PGSIZE < n) return -1;
+
+    acquire(&pi->lock);
+    uint32_t used = pi->head - pi->tail;
+    if (used > nbuf) {
+        release(&pi->lock);
+        return -1;
+    }
+
+    // Move the buffers to the start of the new ring.
+    struct pipe_buf buf[PIPE_MAXPAGES];
+    for (uint32_t i = 0; i < used; ++i) buf[i] = *pipe_buf(pi, pi->tail + i);
+    memmove(pi->buf, buf, used * sizeof(*buf));
+    pi->nbuf = nbuf;
+    pi->tail = 0;
+    pi->head = used;
+    pipe_wakewriters(pi);
+    release(&pi->lock);
+    return nbuf * PGSIZE;
+}
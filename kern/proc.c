@@ -3,13 +3,20 @@
 #include "arm.h"
 #include "console.h"
 #include "file.h"
+#include "futex.h"
+#include "ipi.h"
 #include "kalloc.h"
 #include "log.h"
 #include "mmu.h"
+#include "rcu.h"
+#include "softirq.h"
 #include "spinlock.h"
 #include "string.h"
+#include "timer.h"
 #include "trap.h"
 #include "types.h"
+#include "uaccess.h"
+#include "vdso.h"
 #include "vm.h"
 
 struct cpu cpus[NCPU];
@@ -54,8 +61,8 @@ proc_init()
 }
 
 /*
- * Free a proc structure and the data hanging from it,
- * including user pages.
+ * Free a proc structure and its kernel stack. Its memory and files
+ * are gone already, dropped by exit(), or never taken by clone().
  * p->lock must be held.
  */
 static void
@@ -65,13 +72,15 @@ proc_free(struct proc* p)
     p->killed = 0;
     p->xstate = 0;
     p->pid = 0;
+    p->tgid = 0;
+    p->vfork = NULL;
+    p->cpu = -1;
     p->parent = NULL;
     if (p->kstack) kfree(p->kstack);
     p->kstack = NULL;
-    p->sz = 0;
-    if (p->pgdir) vm_free(p->pgdir, 4);
-    p->pgdir = NULL;
     p->tf = NULL;
+    p->clear_tid = 0;
+    p->splitseq = 0;
     p->name[0] = '\0';
     p->state = UNUSED;
 }
@@ -87,12 +96,17 @@ proc_alloc()
 {
     for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; ++p) {
         acquire(&p->lock);
+        // Threads other than the first have nobody to wait() for
+        // them, and are freed here once they have exited.
+        if (p->state == ZOMBIE && p->pid != p->tgid) proc_free(p);
         if (p->state != UNUSED) {
             release(&p->lock);
             continue;
         }
 
         p->pid = pid_next();
+        p->tgid = p->pid;
+        p->cpu = -1;
 
         // Allocate kernel stack.
         if (!(p->kstack = kalloc())) {
@@ -119,6 +133,100 @@ proc_alloc()
     return NULL;
 }
 
+/*
+ * Allocate an address space with an empty page table, holding one
+ * reference. Returns NULL if memory runs out.
+ */
+struct mm*
+mm_alloc()
+{
+    struct mm* mm = (struct mm*)kalloc();
+    if (!mm) return NULL;
+    memset(mm, 0, sizeof(*mm));
+    if (!(mm->pgdir = pgdir_init())) {
+        kfree((char*)mm);
+        return NULL;
+    }
+    mm->ref = 1;
+    initsleeplock(&mm->lock, "mm");
+    if (vdso_map(mm) < 0) {
+        mm_put(mm);
+        return NULL;
+    }
+    return mm;
+}
+
+/*
+ * Drop a reference to mm, and free it with all its memory after the
+ * last. No CPU may be running on its page table by then.
+ */
+void
+mm_put(struct mm* mm)
+{
+    if (__atomic_sub_fetch(&mm->ref, 1, __ATOMIC_ACQ_REL)) return;
+    vma_free(mm);
+    vdso_unmap(mm);
+    vm_free(mm->pgdir);
+    kfree((char*)mm);
+}
+
+/*
+ * Return a copy of the address space old, for fork().
+ */
+static struct mm*
+mm_copy(struct mm* old)
+{
+    struct mm* mm = mm_alloc();
+    if (!mm) return NULL;
+
+    acquiresleep(&old->lock);
+    int r = uvm_copy(old->pgdir, mm->pgdir, old->sz);
+    if (!r) r = vma_copy(mm, old);
+    mm->sz = old->sz;
+    releasesleep(&old->lock);
+
+    if (r < 0) {
+        mm_put(mm);
+        return NULL;
+    }
+    return mm;
+}
+
+/*
+ * Return a file table holding one reference, with new references to
+ * the files of old, or empty if old is NULL. Returns NULL if memory
+ * runs out.
+ */
+struct fdtable*
+fdtable_copy(struct fdtable* old)
+{
+    struct fdtable* ft = (struct fdtable*)kalloc();
+    if (!ft) return NULL;
+    memset(ft, 0, sizeof(*ft));
+    ft->ref = 1;
+    initlock(&ft->lock, "fdtable");
+    if (old) {
+        acquire(&old->lock);
+        for (int fd = 0; fd < NOFILE; ++fd)
+            if (old->ofile[fd]) ft->ofile[fd] = file_dup(old->ofile[fd]);
+        ft->cloexec = old->cloexec;
+        release(&old->lock);
+    }
+    return ft;
+}
+
+/*
+ * Drop a reference to a file table, closing its files after the last.
+ */
+void
+fdtable_put(struct fdtable* ft)
+{
+    if (__atomic_sub_fetch(&ft->ref, 1, __ATOMIC_ACQ_REL)) return;
+    for (int fd = 0; fd < NOFILE; ++fd)
+        if (ft->ofile[fd]) file_close(ft->ofile[fd]);
+    kfree((char*)ft);
+}
+
 /*
  * Set up first user process (only used once).
  * Set trapframe for the new process to run
@@ -135,14 +243,14 @@ user_init()
     if (!p) panic("\tuser_init: process failed to allocate.\n");
     initproc = p;
 
-    // Allocate a user page table.
-    if (!(p->pgdir = pgdir_init()))
-        panic("\tuser_init: page table failed to allocate.\n");
-    p->sz = PGSIZE;
+    // Allocate an address space, and an empty file table.
+    if (!(p->mm = mm_alloc()) || !(p->files = fdtable_copy(NULL)))
+        panic("\tuser_init: out of memory.\n");
+    p->mm->sz = PGSIZE;
 
     // Copy initcode into the page table.
     uvm_init(
-        p->pgdir, _binary_obj_user_initcode_start,
+        p->mm->pgdir, _binary_obj_user_initcode_start,
         (uint64_t)_binary_obj_user_initcode_size);
 
     // Set up trapframe to prepare for the first "return" from kernel to user.
@@ -160,6 +268,72 @@ user_init()
     cprintf("user_init: proc %d (%s) success.\n", p->pid, p->name, cpuid());
 }
 
+/*
+ * Take an idle CPU to give something to, and return its number, or -1
+ * if none is idle. Whoever sees a CPU idle clears the flag as it takes
+ * it, so that n processes woken together kick n CPUs.
+ */
+int
+idle_claim()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  // Pairs with idle()
+    for (int i = 1; i < NCPU; i++) {
+        int c = (cpuid() + i) % NCPU, one = 1;
+        if (__atomic_load_n(&cpus[c].idle, __ATOMIC_RELAXED)
+            && __atomic_compare_exchange_n(
+                &cpus[c].idle, &one, 0, 0, __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+            return c;
+    }
+    return -1;
+}
+
+/*
+ * Get an idle CPU to look for something to run, after a process has
+ * been made runnable that may run on cpu, or on any CPU if it is -1.
+ */
+static void
+kick_idle(int cpu)
+{
+    int one = 1;
+    if (cpu < 0) {
+        cpu = idle_claim();
+    } else {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);  // Pairs with idle()
+        if (!__atomic_compare_exchange_n(
+                &cpus[cpu].idle, &one, 0, 0, __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED))
+            cpu = -1;
+    }
+    if (cpu >= 0) ipi_send(cpu, IPI_WAKE);
+}
+
+/*
+ * Wait in wfi for an interrupt, with nothing to run: an hrtimer, a
+ * device, or an IPI from whoever claims this CPU. There is no tick
+ * while idle, as the scheduler stops it on the way out of a process. A
+ * process made runnable before idle is set is seen by the check here,
+ * and one made runnable after by the kick, so no wakeup is left
+ * waiting for a tick.
+ */
+static void
+idle(struct cpu* c)
+{
+    __atomic_store_n(&c->idle, 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  // Pairs with kick_idle()
+    int ready = 0, self = cpuid();
+    for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; ++p)
+        ready |= __atomic_load_n(&p->state, __ATOMIC_RELAXED) == RUNNABLE
+                 && (p->cpu < 0 || p->cpu == self);
+    if (!ready) {
+        irq_idle(1);
+        asm volatile("wfi");
+        irq_idle(0);
+    }
+    __atomic_store_n(&c->idle, 0, __ATOMIC_RELAXED);
+    irq_handle();
+}
+
 /*
  * Per-CPU process scheduler
  * Each CPU calls scheduler() after setting itself up.
@@ -173,13 +347,18 @@ void
 scheduler()
 {
     struct cpu* c = thiscpu;
+    int self = cpuid();
     c->proc = NULL;
 
     while (1) {
+        rcu_quiescent();
+        softirq_run();
+        int ran = 0;
+
         // Loop over process table looking for process to run.
         for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; ++p) {
             acquire(&p->lock);
-            if (p->state != RUNNABLE) {
+            if (p->state != RUNNABLE || (p->cpu >= 0 && p->cpu != self)) {
                 release(&p->lock);
                 continue;
             }
@@ -189,16 +368,24 @@ scheduler()
             // before jumping back to us.
             c->proc = p;
             uvm_switch(p);
+            // The vDSO's getpid() reads the thread group ID from here.
+            uint64_t tgid = p->tgid;
+            asm volatile("msr tpidrro_el0, %[x]" : : [x] "r"(tgid));
             p->state = RUNNING;
             // cprintf("scheduler: run proc %d at CPU %d.\n", p->pid, cpuid());
 
+            tick_start();
             swtch(&c->scheduler, p->context);
+            tick_stop();
 
             // Process is done running for now.
             // It should have changed its p->state before coming back.
             c->proc = NULL;
             release(&p->lock);
+            rcu_quiescent();
+            ran = 1;
         }
+        if (!ran) idle(c);
     }
 }
 
@@ -245,6 +432,44 @@ forkret()
     usertrapret(tf);
 }
 
+/*
+ * A kernel thread's first scheduling swtch()es here, to call the
+ * function kthread_create() left in its otherwise unused trapframe.
+ */
+static void
+kthread_start()
+{
+    struct proc* p = thisproc();
+
+    // Still holding p->lock from scheduler.
+    release(&p->lock);
+
+    ((void (*)(void*))p->tf->x0)((void*)p->tf->x1);
+    panic("\tkthread_start: %s returned.\n", p->name);
+}
+
+/*
+ * Start a kernel thread called name running fn(arg), on CPU cpu only,
+ * or on any if cpu is -1. It has no address space, files or current
+ * directory, runs on the kernel's page table, and never exits, so fn
+ * must not return. Returns NULL if no process slot or memory is left.
+ */
+struct proc*
+kthread_create(void (*fn)(void*), void* arg, int cpu, char* name)
+{
+    struct proc* p = proc_alloc();
+    if (!p) return NULL;
+    p->context->x30 = (uint64_t)kthread_start;
+    p->tf->x0 = (uint64_t)fn;
+    p->tf->x1 = (uint64_t)arg;
+    p->cpu = cpu;
+    strncpy(p->name, name, sizeof(p->name));
+    p->state = RUNNABLE;
+    release(&p->lock);
+    kick_idle(cpu);
+    return p;
+}
+
 /*
  * Pass p's abandoned children to initproc.
  * Caller must hold wait_lock.
@@ -269,12 +494,21 @@ exit(int status)
 
     if (p == initproc) panic("\texit: initproc exiting.\n");
 
-    for (int fd = 0; fd < NOFILE; ++fd) {
-        if (p->ofile[fd]) {
-            file_close(p->ofile[fd]);
-            p->ofile[fd] = 0;
-        }
-    }
+    // Tell pthread_join() we are gone, while our memory is still ours.
+    int zero = 0;
+    if (p->clear_tid
+        && !copy_to_user((void*)p->clear_tid, &zero, sizeof(zero)))
+        futex_wakeup(p->clear_tid, 1);
+
+    fdtable_put(p->files);
+    p->files = NULL;
+
+    // Leave the page table before the last thread frees it.
+    struct mm* mm = p->mm;
+    p->mm = NULL;
+    uvm_switch(p);
+    mm_put(mm);
+    if (p->vfork) vfork_done(p);
 
     begin_op();
     iput(p->cwd);
@@ -286,6 +520,12 @@ exit(int status)
     // Give any children to init.
     reparent(p);
 
+    // Wake the parent of the thread group, which may wait for it now.
+    struct proc* parent = p->parent;
+    for (struct proc* q = ptable.proc; q < &ptable.proc[NPROC]; ++q)
+        if (p->pid != p->tgid && q->pid == p->tgid) parent = q->parent;
+    if (parent) wakeup(parent);
+
     acquire(&p->lock);
     p->xstate = status;
     p->state = ZOMBIE;
@@ -297,14 +537,64 @@ exit(int status)
     panic("\texit: zombie returned!\n");
 }
 
+/*
+ * Exit every thread of the current process with the given status.
+ * The others exit on their way back to user space, and those asleep
+ * are woken to get there.
+ */
+void
+exit_group(int status)
+{
+    struct proc* p = thisproc();
+    for (struct proc* q = ptable.proc; q < &ptable.proc[NPROC]; ++q) {
+        if (q == p) continue;
+        acquire(&q->lock);
+        if (q->tgid == p->tgid && q->state != ZOMBIE) {
+            q->killed = 1;
+            q->xstate = status;
+            if (q->state == SLEEPING) {
+                q->state = RUNNABLE;
+                kick_idle(q->cpu);
+            }
+        }
+        release(&q->lock);
+    }
+    exit(status);
+}
+
 /*
  * Atomically release lock and sleep on chan.
  * Reacquires lock when awakened.
  */
 void
 sleep(void* chan, struct spinlock* lk)
+{
+    sleep_until(chan, lk, 0);
+}
+
+/*
+ * Wake the process arg from sleep_until(), at its deadline.
+ */
+static void
+sleep_timeout(void* arg)
+{
+    struct proc* p = arg;
+    acquire(&p->lock);
+    int woken = p->state == SLEEPING;
+    if (woken) p->state = RUNNABLE;
+    release(&p->lock);
+    if (woken) kick_idle(p->cpu);
+}
+
+/*
+ * Like sleep(), but also wake once the system counter reaches
+ * deadline, unless that is 0. The caller checks which happened.
+ */
+void
+sleep_until(void* chan, struct spinlock* lk, uint64_t deadline)
 {
     struct proc* p = thisproc();
+    struct hrtimer t = HRTIMER_INIT(sleep_timeout, p);
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
@@ -319,13 +609,15 @@ sleep(void* chan, struct spinlock* lk)
     // Go to sleep.
     p->chan = chan;
     p->state = SLEEPING;
+    if (deadline) hrtimer_start(&t, deadline);
     sched();
 
     // Tidy up.
     p->chan = 0;
 
-    // Reacquire original lock.
+    // Reacquire original lock, once the timer can't touch us.
     release(&p->lock);
+    if (deadline) hrtimer_cancel(&t);
     acquire(lk);
 }
 
@@ -339,10 +631,10 @@ wakeup(void* chan)
     for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; ++p) {
         if (p != thisproc()) {
             acquire(&p->lock);
-            if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
-            }
+            int woken = p->state == SLEEPING && p->chan == chan;
+            if (woken) p->state = RUNNABLE;
             release(&p->lock);
+            if (woken) kick_idle(p->cpu);
         }
     }
 }
@@ -368,50 +660,71 @@ yield()
 int
 growproc(int n)
 {
-    struct proc* p = thisproc();
-    uint64_t sz = p->sz;
-    if (n > 0) {
-        if (!(sz = uvm_alloc(p->pgdir, sz, sz + n))) return -1;
-    } else if (n < 0) {
-        if (!(sz = uvm_dealloc(p->pgdir, sz, sz + n))) return -1;
-    }
-    p->sz = sz;
-    uvm_switch(p);
-    return 0;
+    struct mm* mm = thisproc()->mm;
+    acquiresleep(&mm->lock);
+    uint64_t old = mm->sz, sz = old;
+    if (n > 0)
+        sz = sz + n <= MMAPBASE ? uvm_alloc(mm->pgdir, sz, sz + n) : 0;
+    else if (n < 0)
+        sz = uvm_dealloc(mm->pgdir, sz, sz + n);
+    if (sz) mm->sz = sz;
+    releasesleep(&mm->lock);
+    // Growing only fills entries that were invalid, which no TLB holds.
+    if (n < 0 && old + n < old) tlb_shootdown(old + n, old);
+    return sz ? 0 : -1;
 }
 
 /*
- * Create a new process copying p as the parent.
+ * Create a new process or thread copying p as the parent, as clone()
+ * does with flags. The child gets a copy of our memory and our file
+ * table, or shares them with CLONE_VM and CLONE_FILES. CLONE_VFORK
+ * has us sleep until the child calls exec() or exit(). CLONE_THREAD
+ * puts the child in our thread group, and nobody waits for it.
+ * The child runs on stack if that isn't 0, with the thread pointer
+ * tls given CLONE_SETTLS. Its tid is stored at ptid given
+ * CLONE_PARENT_SETTID, and zeroed at ctid as it exits given
+ * CLONE_CHILD_CLEARTID.
  * Sets up stack to return as if from system call.
- * Caller must set state of returned proc to RUNNABLE.
+ * Returns the child's pid, or -1.
  */
 int
-fork()
+clone(
+    uint64_t flags, uint64_t stack, uint64_t ptid, uint64_t tls, uint64_t ctid)
 {
-    // Allocate process
-    struct proc* np = proc_alloc();
-    if (!np) return -1;
-
+    struct proc* np = NULL;
     struct proc* p = thisproc();
+    struct mm* mm = p->mm;
+    struct fdtable* files = p->files;
+
+    if (flags & CLONE_VM)
+        __atomic_add_fetch(&mm->ref, 1, __ATOMIC_RELAXED);
+    else
+        mm = mm_copy(mm);
+    if (flags & CLONE_FILES)
+        __atomic_add_fetch(&files->ref, 1, __ATOMIC_RELAXED);
+    else
+        files = fdtable_copy(files);
 
-    // Copy user memory from parent to child
-    if (uvm_copy(p->pgdir, np->pgdir, p->sz) < 0) {
-        proc_free(np);
-        release(&np->lock);
+    // Allocate process
+    if (!mm || !files || !(np = proc_alloc())) {
+        if (mm) mm_put(mm);
+        if (files) fdtable_put(files);
         return -1;
     }
-    np->sz = p->sz;
+    np->mm = mm;
+    np->files = files;
+    if (flags & CLONE_THREAD) np->tgid = p->tgid;
+    if (flags & CLONE_VFORK) np->vfork = p;
+    if (flags & CLONE_CHILD_CLEARTID) np->clear_tid = ctid;
 
     // Copy saved user registers
     memcpy(np->tf, p->tf, sizeof(*p->tf));
 
     // Cause fork to return 0 in the child
     np->tf->x0 = 0;
+    if (stack) np->tf->sp_el0 = stack;
+    if (flags & CLONE_SETTLS) np->tf->tpidr_el0 = tls;
 
-    // Increment reference counts on open file descriptors
-    for (int i = 0; i < NOFILE; ++i) {
-        if (p->ofile[i]) np->ofile[i] = file_dup(p->ofile[i]);
-    }
     np->cwd = idup(p->cwd);
 
     strncpy(np->name, p->name, sizeof(p->name));
@@ -420,23 +733,60 @@ fork()
 
     release(&np->lock);
 
-    acquire(&wait_lock);
-    np->parent = p;
-    release(&wait_lock);
+    if (flags & CLONE_PARENT_SETTID)
+        copy_to_user((void*)ptid, &pid, sizeof(pid));
+
+    if (!(flags & CLONE_THREAD)) {
+        acquire(&wait_lock);
+        np->parent = p;
+        release(&wait_lock);
+    }
 
     acquire(&np->lock);
     np->state = RUNNABLE;
+    kick_idle(-1);
+
+    // Sleep while the child uses our memory.
+    while (np->vfork) sleep(&np->vfork, &np->lock);
     release(&np->lock);
 
     return pid;
 }
 
 /*
- * Wait for a child process to exit and return its pid.
- * Return -1 if this process has no children.
+ * Called by a vfork() child in exec() or exit(), once it no longer
+ * uses its parent's memory, to wake the parent.
+ */
+void
+vfork_done(struct proc* p)
+{
+    acquire(&p->lock);
+    p->vfork = NULL;
+    release(&p->lock);
+    wakeup(&p->vfork);
+}
+
+/*
+ * Is a thread other than the first of the thread group led by p
+ * still running? Caller must hold wait_lock.
+ */
+static int
+group_alive(struct proc* p)
+{
+    for (struct proc* q = ptable.proc; q < &ptable.proc[NPROC]; ++q)
+        if (q != p && q->tgid == p->pid && q->state != ZOMBIE) return 1;
+    return 0;
+}
+
+/*
+ * Wait for a child process to exit, the one with the given pid if
+ * pid is positive, and return its pid. A process has exited once all
+ * of its threads have. Stores its exit status in *status unless
+ * status is NULL.
+ * Return -1 if this process has no such children.
  */
 int
-wait()
+wait(int pid, int* status)
 {
     struct proc* p = thisproc();
     acquire(&wait_lock);
@@ -445,14 +795,15 @@ wait()
         // Scan through table looking for exited children.
         int havekids = 0;
         for (struct proc* np = ptable.proc; np < &ptable.proc[NPROC]; ++np) {
-            if (np->parent != p) continue;
+            if (np->parent != p || (pid > 0 && np->pid != pid)) continue;
             havekids = 1;
-            if (np->state == ZOMBIE) {
+            if (np->state == ZOMBIE && !group_alive(np)) {
                 // Found one.
-                int pid = np->pid;
+                int cpid = np->pid;
+                if (status) *status = np->xstate;
                 proc_free(np);
                 release(&wait_lock);
-                return pid;
+                return cpid;
             }
         }
 
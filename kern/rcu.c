@@ -0,0 +1,53 @@
+/*
+ * Read-copy update, by quiescent states.
+ *
+ * The kernel doesn't preempt and runs with interrupts masked, so code
+ * that reads a shared structure without locks and without sleeping
+ * is done with it by the time its CPU next passes through the
+ * scheduler. Readers therefore pay nothing: no lock, no counter.
+ * Every pass through the scheduler ends an epoch of the CPU's own,
+ * and a writer that has unlinked something waits in synchronize_rcu()
+ * until every other CPU has ended an epoch, after which no reader can
+ * still be looking at it, and it can be reused. An idle CPU, waiting
+ * in wfi from the scheduler, has no readers either, and may not end
+ * its epoch until its next interrupt, so it counts as having ended it.
+ */
+
+#include "rcu.h"
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "proc.h"
+
+/*
+ * Note that this CPU holds no references from lockless reads.
+ * Called by the scheduler between processes.
+ */
+void
+rcu_quiescent()
+{
+    struct cpu* c = thiscpu;
+    __atomic_store_n(&c->epoch, c->epoch + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait until every lockless reader that may have seen what we
+ * unlinked is done. Must be called from a process holding no
+ * spinlocks, since it yields. A CPU that hasn't reached the
+ * scheduler yet has no readers to wait for.
+ */
+void
+synchronize_rcu()
+{
+    uint64_t epoch[NCPU];
+    int self = cpuid();
+    for (int i = 0; i < NCPU; i++)
+        epoch[i] = __atomic_load_n(&cpus[i].epoch, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < NCPU; i++) {
+        if (i == self || !epoch[i]) continue;
+        while (__atomic_load_n(&cpus[i].epoch, __ATOMIC_ACQUIRE) == epoch[i]
+               && !__atomic_load_n(&cpus[i].idle, __ATOMIC_ACQUIRE))
+            yield();
+    }
+}
@@ -111,6 +111,8 @@ int _fls_long(unsigned long x);
 
 #define FREQ_SETUP  400000    // 400 Khz
 #define FREQ_NORMAL 25000000  // 25 Mhz
+#define FREQ_HIGH   50000000  // 50 Mhz, once the card is in high speed
+#define FREQ_BASE   41666666  // Host base clock, always this on the Pi
 
 // CONTROL2 values
 #define C2_VDD_18     0x00080000
@@ -236,7 +238,8 @@ static EmmcCommand sd_command_table[] = {
     {"ALL_SEND_CID", 0x02000000 | CMD_RSPNS_136, RESP_R2I, RCA_NO, 0},
     {"SEND_REL_ADDR", 0x03000000 | CMD_RSPNS_48, RESP_R6, RCA_NO, 0},
     {"SET_DSR", 0x04000000 | CMD_RSPNS_NO, RESP_NO, RCA_NO, 0},
-    {"SWITCH_FUNC", 0x06000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
+    {"SWITCH_FUNC", 0x06000000 | CMD_RSPNS_48 | CMD_IS_DATA | TM_DAT_DIR_CH,
+     RESP_R1, RCA_NO, 0},
     {"CARD_SELECT", 0x07000000 | CMD_RSPNS_48B, RESP_R1b, RCA_YES, 0},
     {"SEND_IF_COND", 0x08000000 | CMD_RSPNS_48, RESP_R7, RCA_NO, 100},
     {"SEND_CSD", 0x09000000 | CMD_RSPNS_136, RESP_R2S, RCA_YES, 0},
@@ -407,6 +410,8 @@ static EmmcCommand sd_command_table[] = {
 #define SCR_SD_SEC_2        0x00003000  // SDHC
 #define SCR_SD_SEC_3        0x00004000  // SDXC
 
+#define SCR_SD_SPEC 0x0000000f  // 0 is version 1.0, without CMD6
+
 #define SCR_SD_BUS_WIDTHS  0x00000f00
 #define SCR_SD_BUS_WIDTH_1 0x00000100
 #define SCR_SD_BUS_WIDTH_4 0x00000400
@@ -443,6 +448,11 @@ static EmmcCommand sd_command_table[] = {
  * #define EMMC_HC_TOCLOCK_SHIFT      0
  */
 
+// SWITCH_FUNC (CMD6) arguments. Function groups 2 to 6 are left as is.
+#define CMD6_CHECK      0x00fffff0
+#define CMD6_SWITCH     0x80fffff0
+#define CMD6_HIGH_SPEED 1  // Access mode (group 1) function
+
 // SD card types
 #define SD_TYPE_MMC  1
 #define SD_TYPE_1    2
@@ -473,11 +483,14 @@ typedef struct SdDescriptor {
     unsigned char uhsi;
     unsigned char init;
     unsigned char absent;
+    unsigned char bus_width;   // Data lines in use, 1 or 4
+    unsigned char high_speed;  // Card switched by CMD6, clock raised
 
     // Dynamic information.
     unsigned int rca;
     unsigned int card_state;
     unsigned int status;
+    unsigned int clock;  // Clock set by sd_set_clock(), in Hz
 
     EmmcCommand* last_cmd;
     unsigned int last_arg;
@@ -681,6 +694,9 @@ sd_test()
     int64_t f, t;
     asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
     cprintf("sd_test: begin nblocks %d\n", n);
+    cprintf(
+        "sd_test: %d bit bus, %s speed (%d Hz)\n", sd_card.bus_width,
+        sd_card.high_speed ? "high" : "normal", sd_card.clock);
 
     cprintf("sd_test: sd check rw...\n");
     // Read / write test
@@ -1029,18 +1045,21 @@ _sd_send_command_a(int index, int arg)
     return resp;
 }
 
-/* Read card's SCR. */
+/*
+ * Send a command that reads n words of data from the card,
+ * such as SEND_SCR, into data.
+ */
 static int
-sd_read_scr()
+sd_read_data(int index, int arg, unsigned int* data, int n)
 {
-    // SEND_SCR command is like a READ_SINGLE but for a block of 8 bytes.
     // Ensure that any data operation has completed before reading the block.
     if (_sd_wait_for_data()) return SD_TIMEOUT;
 
-    // Set BLKSIZECNT to 1 block of 8 bytes, send SEND_SCR command
-    *EMMC_BLKSIZECNT = (1 << 16) | 8;
+    // Set BLKSIZECNT to 1 block of n words and send the command.
+    *EMMC_BLKSIZECNT = (1 << 16) | (n * 4);
     int resp;
-    if ((resp = _sd_send_command(IX_SEND_SCR))) return sd_debug_response(resp);
+    if ((resp = _sd_send_command_a(index, arg)))
+        return sd_debug_response(resp);
 
     // Wait for READ_RDY interrupt.
     if ((resp = _sd_wait_for_interrupt(INT_READ_RDY))) {
@@ -1050,23 +1069,33 @@ sd_read_scr()
 
     // Allow maximum of 100ms for the read operation.
     int num_read = 0, count = 100000;
-    while (num_read < 2) {
+    while (num_read < n) {
         if (*EMMC_STATUS & SR_READ_AVAILABLE)
-            sd_card.scr[num_read++] = *EMMC_DATA;
+            data[num_read++] = *EMMC_DATA;
         else {
             _sd_delayus(1);
             if (--count == 0) break;
         }
     }
 
-    // If SCR not fully read, the operation timed out.
-    if (num_read != 2) {
+    // If the data was not fully read, the operation timed out.
+    if (num_read != n) {
         cprintf(
-            "* ERROR EMMC: SEND_SCR ERR: %x %x %x\n", *EMMC_STATUS,
-            *EMMC_INTERRUPT, *EMMC_RESP0);
-        cprintf("* EMMC: Reading SCR, only read %d words.\n", num_read);
+            "* ERROR EMMC: %s ERR: %x %x %x\n", sd_command_table[index].name,
+            *EMMC_STATUS, *EMMC_INTERRUPT, *EMMC_RESP0);
+        cprintf("* EMMC: Only read %d words.\n", num_read);
         return SD_TIMEOUT;
     }
+    return SD_OK;
+}
+
+/* Read card's SCR. */
+static int
+sd_read_scr()
+{
+    // SEND_SCR command is like a READ_SINGLE but for a block of 8 bytes.
+    int resp;
+    if ((resp = sd_read_data(IX_SEND_SCR, 0, sd_card.scr, 2))) return resp;
 
     // Parse out the SCR.  Only interested in values in scr[0], scr[1] is mfr
     // specific.
@@ -1118,33 +1147,40 @@ roundup_pow_of_two(unsigned long x)
 
 /*
  * Get the clock divider for the given requested frequency.
- * This is calculated relative to the SD base clock.
+ * This is calculated relative to the SD base clock, which divisor 0
+ * passes through and divisor n divides by 2n.
  */
 static uint32_t
 sd_get_clock_divider(uint32_t freq)
 {
-    uint32_t divisor;
-    // Pi SD frequency is always 41.66667Mhz on baremetal
-    uint32_t closest = 41666666 / freq;
-
-    // Get the raw shiftcount
-    uint32_t shiftcount = _fls_long(closest - 1);
-
-    // Note the offset of shift by 1 (look at the spec)
-    if (shiftcount > 0) shiftcount--;
-
-    // It's only 8 bits maximum on HOST_SPEC_V2
-    if (shiftcount > 7) shiftcount = 7;
-    // Version 3 take closest
-    if (sd_host_ver > HOST_SPEC_V2) divisor = closest;
-    // Version 2 take power 2
-    else
-        divisor = (1 << shiftcount);
-
-    if (divisor <= 2) {  // Too dangerous to go for divisor 1 unless you test
-        divisor = 2;     // You can't take divisor below 2 on slow cards
-        shiftcount = 0;  // Match shift to above just for debug notification
+    uint32_t divisor, shiftcount = 0;
+    uint32_t closest = FREQ_BASE / freq;
+
+    if (!closest) {
+        // freq is at or above the base clock, which is the fastest
+        // there is. Only a card in high speed mode asks for that.
+        divisor = 0;
+    } else {
+        // Get the raw shiftcount
+        shiftcount = _fls_long(closest - 1);
+
+        // Note the offset of shift by 1 (look at the spec)
+        if (shiftcount > 0) shiftcount--;
+
+        // It's only 8 bits maximum on HOST_SPEC_V2
+        if (shiftcount > 7) shiftcount = 7;
+        // Version 3 take closest
+        if (sd_host_ver > HOST_SPEC_V2) divisor = closest;
+        // Version 2 take power 2
+        else
+            divisor = (1 << shiftcount);
+
+        if (freq <= FREQ_NORMAL && divisor <= 2) {
+            divisor = 2;     // You can't take divisor below 2 on slow cards
+            shiftcount = 0;  // Match shift to above just for debug notification
+        }
     }
+    sd_card.clock = divisor ? FREQ_BASE / (2 * divisor) : FREQ_BASE;
 
     cprintf("- Divisor selected = %u, shift count = %u\n", divisor, shiftcount);
     uint32_t hi = 0;
@@ -1197,6 +1233,39 @@ sd_set_clock(int freq)
     return SD_OK;
 }
 
+/*
+ * Switch the card to high speed with SWITCH_FUNC (CMD6), then the
+ * host to FREQ_HIGH. On failure the host is left at FREQ_NORMAL.
+ */
+static int
+sd_set_high_speed()
+{
+    // SWITCH_FUNC is new in version 1.10 of the spec.
+    if (!(sd_card.scr[0] & SCR_SD_SPEC)) return SD_ERROR;
+
+    // The 512-bit status comes most significant byte first. Bits 415:400
+    // are the supported group 1 functions, 379:376 the one selected.
+    unsigned int status[16];
+    uint8_t* st = (uint8_t*)status;
+    int resp;
+    if ((resp = sd_read_data(IX_SWITCH_FUNC, CMD6_CHECK, status, 16)))
+        return resp;
+    if (!(st[13] & (1 << CMD6_HIGH_SPEED))) return SD_ERROR;
+    if ((resp = sd_read_data(
+             IX_SWITCH_FUNC, CMD6_SWITCH | CMD6_HIGH_SPEED, status, 16)))
+        return resp;
+    if ((st[16] & 0xf) != CMD6_HIGH_SPEED) return SD_ERROR;
+
+    // The card has switched by the end of the status block.
+    *EMMC_CONTROL0 |= C0_HCTL_HS_EN;
+    if ((resp = sd_set_clock(FREQ_HIGH))) {
+        *EMMC_CONTROL0 &= ~C0_HCTL_HS_EN;
+        sd_set_clock(FREQ_NORMAL);
+        return resp;
+    }
+    return SD_OK;
+}
+
 /* Reset card. */
 static int
 sd_reset_card(int reset_type)
@@ -1502,10 +1571,28 @@ _sd_init()
 
     // Send APP_SET_BUS_WIDTH (ACMD6)
     // If supported, set 4 bit bus width and update the CONTROL0 register.
+    // A card refusing it still works on 1 bit.
+    sd_card.bus_width = 1;
     if (sd_card.support & SD_SUPP_BUS_WIDTH_4) {
-        if ((resp = _sd_send_command_a(IX_SET_BUS_WIDTH, sd_card.rca | 2)))
-            return sd_debug_response(resp);
-        *EMMC_CONTROL0 |= C0_HCTL_DWITDH;
+        if ((resp = _sd_send_command_a(IX_SET_BUS_WIDTH, sd_card.rca | 2))) {
+            cprintf("- EMMC: 4 bit bus refused, staying at 1 bit.\n");
+        } else {
+            *EMMC_CONTROL0 |= C0_HCTL_DWITDH;
+            sd_card.bus_width = 4;
+        }
+    }
+
+    // Switch to high speed where the card supports it. A failed SWITCH_FUNC
+    // may leave the data line busy, so reset it before going on.
+    sd_card.high_speed = 0;
+    if ((resp = sd_set_high_speed())) {
+        cprintf("- EMMC: no high speed (%d), staying at normal speed.\n", resp);
+        *EMMC_CONTROL1 |= C1_SRST_DATA;
+        int count = 10000;
+        while ((*EMMC_CONTROL1 & C1_SRST_DATA) && count--) _sd_delayus(10);
+        *EMMC_INTERRUPT = *EMMC_INTERRUPT;
+    } else {
+        sd_card.high_speed = 1;
     }
 
     // Send SET_BLOCKLEN (CMD16)
@@ -1,30 +1,145 @@
 #include "sleeplock.h"
 
+#include "arm.h"
+#include "console.h"
+#include "lockstat.h"
+#include "proc.h"
+
+#define SPIN_US 50  // Longest an acquire spins on running owners, in us
+
+/* A process in line for a sleeplock, on its kernel stack. */
+struct sleepwaiter {
+    struct proc* proc;
+    struct sleepwaiter* next;
+    int queued;  // In line, until a release takes it off
+    int shared;  // Waits to read
+};
+
 void
 initsleeplock(struct sleeplock* lk, char* name)
 {
     initlock(&lk->lk, name);
     lk->locked = 0;
-    lk->pid = 0;
+    lk->readers = 0;
+    lk->owner = NULL;
+    lk->waiters = NULL;
+#ifdef LOCKSTAT
+    lk->stat = lockstat_class(name, 1);
+#endif
 }
 
-void
-acquiresleep(struct sleeplock* lk)
+/*
+ * Spin until lk is released, or changes hands, or its owner stops
+ * running, or the counter passes end. Cache hits hold buffer and inode
+ * locks for less than a context switch takes, and an owner that is
+ * RUNNING is on another CPU, since the kernel doesn't preempt, so it
+ * pays to wait for it. Called and returns with lk->lk held.
+ */
+static void
+spin_on_owner(struct sleeplock* lk, struct proc* owner, uint64_t end)
+{
+    release(&lk->lk);
+    while (__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == owner
+           && __atomic_load_n(&owner->state, __ATOMIC_RELAXED) == RUNNING
+           && timestamp() < end)
+        asm volatile("yield");
+    acquire(&lk->lk);
+}
+
+/*
+ * Take lk, shared if shared is set. A writer waits for the readers
+ * to leave; a reader waits for the writer, and for those in line
+ * unless a release took it off the line.
+ */
+static void
+acquire_mode(struct sleeplock* lk, int shared)
 {
+    struct sleepwaiter w = {thisproc(), NULL, 0, shared};
+    uint64_t end = 0;
+    int woken = 0;
+
     acquire(&lk->lk);
-    while (lk->locked) { sleep(lk, &lk->lk); }
-    lk->locked = 1;
-    lk->pid = thisproc()->pid;
+#ifdef LOCKSTAT
+    int contended = lk->locked || (shared ? lk->waiters != NULL : lk->readers);
+    uint64_t t0 = timestamp();
+#endif
+    while (lk->locked || (shared ? !woken && lk->waiters : lk->readers)) {
+        if (lk->locked && lk->owner->state == RUNNING) {
+            if (!end) {
+                uint64_t f;
+                asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+                end = timestamp() + f * SPIN_US / 1000000;
+            }
+            if (timestamp() < end) {
+                spin_on_owner(lk, lk->owner, end);
+                continue;
+            }
+        }
+
+        // Get in line, at the front if we lost the lock after a wakeup.
+        if (!w.queued) {
+            struct sleepwaiter** pw = &lk->waiters;
+            while (!woken && *pw) pw = &(*pw)->next;
+            w.next = *pw;
+            w.queued = 1;
+            *pw = &w;
+        }
+        sleep(&w, &lk->lk);
+        woken = !w.queued;
+    }
+
+    // Woken by someone other than a release, e.g. exit_group().
+    if (w.queued) {
+        struct sleepwaiter** pw = &lk->waiters;
+        while (*pw != &w) pw = &(*pw)->next;
+        *pw = w.next;
+    }
+    if (shared) {
+        lk->readers++;
+    } else {
+        lk->locked = 1;
+        lk->owner = w.proc;
+    }
+#ifdef LOCKSTAT
+    uint64_t now = timestamp();
+    if (!shared) lk->since = now;
+    if (lk->stat) lockstat_acquired(lk->stat, contended, now - t0);
+#endif
     release(&lk->lk);
 }
 
+/*
+ * Wake the first process in line, and if it is a reader, the readers
+ * right behind it too. Caller must hold lk->lk.
+ */
+static void
+wake_next(struct sleeplock* lk)
+{
+    struct sleepwaiter* w;
+    while ((w = lk->waiters)) {
+        lk->waiters = w->next;
+        w->queued = 0;
+        wakeup(w);
+        if (!w->shared || !lk->waiters || !lk->waiters->shared) break;
+    }
+}
+
+void
+acquiresleep(struct sleeplock* lk)
+{
+    acquire_mode(lk, 0);
+}
+
 void
 releasesleep(struct sleeplock* lk)
 {
     acquire(&lk->lk);
+#ifdef LOCKSTAT
+    if (lk->stat) lockstat_released(lk->stat, timestamp() - lk->since);
+#endif
     lk->locked = 0;
-    lk->pid = 0;
-    wakeup(lk);
+    lk->owner = NULL;
+    wake_next(lk);
     release(&lk->lk);
 }
 
@@ -34,7 +149,25 @@ holdingsleep(struct sleeplock* lk)
     int r;
 
     acquire(&lk->lk);
-    r = lk->locked && (lk->pid == thisproc()->pid);
+    r = lk->locked && lk->owner == thisproc();
     release(&lk->lk);
     return r;
 }
+
+void
+acquiresleep_shared(struct sleeplock* lk)
+{
+    acquire_mode(lk, 1);
+}
+
+/*
+ * Leave lk, which we share. Hold times are kept for writers only.
+ */
+void
+releasesleep_shared(struct sleeplock* lk)
+{
+    acquire(&lk->lk);
+    if (lk->readers < 1) panic("\treleasesleep_shared: not shared.\n");
+    if (!--lk->readers) wake_next(lk);
+    release(&lk->lk);
+}
@@ -0,0 +1,95 @@
+/*
+ * Tasklets, the bottom halves of interrupt handlers.
+ *
+ * tasklet_schedule() queues a tasklet on an idle CPU, which it kicks
+ * out of wfi, or else on its own CPU, so that a core taking all the
+ * device interrupts hands on what they leave to do. Each CPU runs its
+ * queue in softirq_run() on its way back to user mode from an
+ * interrupt, and at the top of every pass of its scheduler loop.
+ */
+
+#include "softirq.h"
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "ipi.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trap.h"
+#include "types.h"
+
+static struct {
+    struct spinlock lock;
+    struct tasklet* head;
+    struct tasklet** tail;
+} __attribute__((aligned(64))) queues[NCPU];
+
+void
+softirq_init()
+{
+    for (int i = 0; i < NCPU; i++) {
+        initlock(&queues[i].lock, "softirq");
+        queues[i].tail = &queues[i].head;
+    }
+    cprintf("softirq_init: success.\n");
+}
+
+static void
+enqueue(int cpu, struct tasklet* t)
+{
+    t->next = NULL;
+    acquire(&queues[cpu].lock);
+    *queues[cpu].tail = t;
+    queues[cpu].tail = &t->next;
+    release(&queues[cpu].lock);
+}
+
+void
+tasklet_schedule(struct tasklet* t)
+{
+    if (__atomic_fetch_or(&t->state, TASKLET_SCHED, __ATOMIC_ACQ_REL)
+        & TASKLET_SCHED)
+        return;
+    t->queued = timestamp();
+    int cpu = idle_claim();
+    enqueue(cpu < 0 ? cpuid() : cpu, t);
+    if (cpu >= 0) ipi_send(cpu, IPI_WAKE);
+}
+
+/*
+ * Run the tasklets queued on this CPU. One still running on another
+ * CPU goes back on the queue, for the next call.
+ */
+void
+softirq_run()
+{
+    int self = cpuid();
+    if (!__atomic_load_n(&queues[self].head, __ATOMIC_RELAXED)) return;
+
+    acquire(&queues[self].lock);
+    struct tasklet* t = queues[self].head;
+    queues[self].head = NULL;
+    queues[self].tail = &queues[self].head;
+    release(&queues[self].lock);
+
+    struct irqstat* s = &irqstat[self];
+    while (t) {
+        struct tasklet* next = t->next;
+        if (__atomic_fetch_or(&t->state, TASKLET_RUN, __ATOMIC_ACQUIRE)
+            & TASKLET_RUN) {
+            enqueue(self, t);
+        } else {
+            uint64_t delay = timestamp() - t->queued;
+            s->tasklets++;
+            s->delay += delay;
+            s->maxdelay = MAX(s->maxdelay, delay);
+            // Cleared first, so that one scheduled while it runs runs again.
+            __atomic_and_fetch(&t->state, ~TASKLET_SCHED, __ATOMIC_ACQ_REL);
+            t->fn(t->arg);
+            __atomic_and_fetch(&t->state, ~TASKLET_RUN, __ATOMIC_RELEASE);
+        }
+        t = next;
+    }
+}
@@ -1,6 +1,7 @@
 #include "spinlock.h"
 #include "arm.h"
 #include "console.h"
+#include "lockstat.h"
 #include "proc.h"
 #include "string.h"
 
@@ -10,36 +11,80 @@
 int
 holding(struct spinlock* lk)
 {
-    int hold;
-    hold = lk->locked && lk->cpu == thiscpu;
-    return hold;
+    uint32_t t = lk->ticket;
+    return (t >> 16) != (t & 0xffff) && lk->cpu == thiscpu;
 }
 
 void
 initlock(struct spinlock* lk, char* name)
 {
     lk->name = name;
-    lk->locked = 0;
+    lk->ticket = 0;
     lk->cpu = 0;
+#ifdef LOCKSTAT
+    lk->stat = lockstat_class(name, 0);
+#endif
 }
 
+/*
+ * Take a ticket by adding one to next with ldaxr/stxr, then wait in
+ * wfe until owner reaches it. The ldaxrh in the loop arms the local
+ * exclusive monitor, and the store that release() makes to owner
+ * clears it, which is the event that ends the wfe; sevl makes the
+ * first wfe fall through.
+ */
 void
 acquire(struct spinlock* lk)
 {
+    uint32_t t, tmp, fail;
     if (holding(lk)) {
         panic("\tacquire: lock %s at CPU %d already held.\n", lk->name, cpuid());
     }
-    while (lk->locked || __atomic_test_and_set(&lk->locked, __ATOMIC_ACQUIRE)) {
-    }
+#ifdef LOCKSTAT
+    uint64_t t0 = timestamp();
+#endif
+    asm volatile("   prfm pstl1strm, %[lock]\n"
+                 "1: ldaxr %w[t], %[lock]\n"
+                 "   add %w[tmp], %w[t], #0x10000\n"
+                 "   stxr %w[fail], %w[tmp], %[lock]\n"
+                 "   cbnz %w[fail], 1b\n"
+                 "   eor %w[tmp], %w[t], %w[t], ror #16\n"
+                 "   cbz %w[tmp], 3f\n"
+                 "   sevl\n"
+                 "2: wfe\n"
+                 "   ldaxrh %w[tmp], %[owner]\n"
+                 "   eor %w[tmp], %w[tmp], %w[t], lsr #16\n"
+                 "   cbnz %w[tmp], 2b\n"
+                 "3:"
+                 : [t] "=&r"(t), [tmp] "=&r"(tmp), [fail] "=&r"(fail),
+                   [lock] "+Q"(lk->ticket)
+                 : [owner] "Q"(lk->owner)
+                 : "memory");
     lk->cpu = thiscpu;
+#ifdef LOCKSTAT
+    // t still holds both counts as they were when we took the ticket.
+    lk->since = timestamp();
+    if (lk->stat)
+        lockstat_acquired(lk->stat, t >> 16 != (t & 0xffff), lk->since - t0);
+#endif
 }
 
 void
 release(struct spinlock* lk)
 {
+    uint32_t tmp;
     if (!holding(lk)) {
         panic("\trelease: lock %s at CPU %d not held.\n", lk->name, cpuid());
     }
+#ifdef LOCKSTAT
+    if (lk->stat) lockstat_released(lk->stat, timestamp() - lk->since);
+#endif
     lk->cpu = NULL;
-    __atomic_clear(&lk->locked, __ATOMIC_RELEASE);
-}
\ No newline at end of file
+    // Only the holder writes owner, so a plain load will do.
+    asm volatile("ldrh %w[tmp], %[owner]\n"
+                 "add %w[tmp], %w[tmp], #1\n"
+                 "stlrh %w[tmp], %[owner]"
+                 : [tmp] "=&r"(tmp), [owner] "+Q"(lk->owner)
+                 :
+                 : "memory");
+}
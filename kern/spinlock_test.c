@@ -0,0 +1,113 @@
+/*
+ * Benchmark of the ticket spinlock against the test-and-set lock it
+ * replaced: 1 to NCPU CPUs take turns on one lock for PERIOD of a
+ * second each, and the acquisitions per second and the spread of the
+ * CPUs' shares are reported. Every CPU runs it on its way into the
+ * scheduler. Build with `make LOCK_TEST=1` to run it at boot.
+ */
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define PERIOD 20  // Runs last 1/PERIOD of a second
+#define WORK   8   // Shared counter increments in the critical section
+
+static struct spinlock lock;
+static volatile int taslock;
+static volatile uint64_t shared;
+static volatile uint64_t deadline;
+static struct {
+    uint64_t n;
+} __attribute__((aligned(64))) count[NCPU];
+
+static void
+tas_acquire()
+{
+    while (taslock || __atomic_test_and_set(&taslock, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void
+tas_release()
+{
+    __atomic_clear(&taslock, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait for every CPU to get here.
+ */
+static void
+barrier()
+{
+    static volatile int arrived, sense;
+    int s = !sense;
+    if (__atomic_add_fetch(&arrived, 1, __ATOMIC_ACQ_REL) == NCPU) {
+        arrived = 0;
+        __atomic_store_n(&sense, s, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&sense, __ATOMIC_ACQUIRE) != s) {
+        }
+    }
+}
+
+/*
+ * Take the lock until the deadline on the first n CPUs, with the
+ * ticket lock, or the test-and-set lock if tas is set.
+ */
+static void
+run(int n, int tas)
+{
+    uint64_t f, i = 0;
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+    if (cpuid() == 0) {
+        shared = 0;
+        for (int c = 0; c < NCPU; c++) count[c].n = 0;
+        deadline = timestamp() + f / PERIOD;
+    }
+    barrier();
+
+    if (cpuid() < n) {
+        while (timestamp() < deadline) {
+            if (tas)
+                tas_acquire();
+            else
+                acquire(&lock);
+            for (int j = 0; j < WORK; j++) shared++;
+            if (tas)
+                tas_release();
+            else
+                release(&lock);
+            i++;
+        }
+        count[cpuid()].n = i;
+    }
+    barrier();
+
+    if (cpuid() == 0) {
+        uint64_t tot = 0, min = UINT64_MAX, max = 0;
+        for (int c = 0; c < n; c++) {
+            tot += count[c].n;
+            min = count[c].n < min ? count[c].n : min;
+            max = count[c].n > max ? count[c].n : max;
+        }
+        if (shared != tot * WORK) panic("\tlock_test: lost updates.\n");
+        cprintf(
+            "lock_test: %s, %d CPUs: %lld acquisitions/s, spread %lld%%\n",
+            tas ? "test-and-set" : "ticket", n, tot * PERIOD,
+            max ? (max - min) * 100 / max : 0);
+    }
+    barrier();
+}
+
+void
+lock_test()
+{
+    if (cpuid() == 0) initlock(&lock, "lock_test");
+    barrier();
+    for (int tas = 1; tas >= 0; tas--)
+        for (int n = 1; n <= NCPU; n++) run(n, tas);
+}
@@ -0,0 +1,117 @@
+/*
+ * Benchmark of the memory routines in string.S.
+ * Build with `make STRING_TEST=1` to run it at boot.
+ */
+
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "kalloc.h"
+#include "mmu.h"
+#include "string.h"
+
+#define ROUNDS 64  // Calls timed per size
+
+static char *src, *dst, *ref;
+
+/* The byte-at-a-time loops string.h used to inline. */
+__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void*
+byte_memcpy(void* dst, const void* src, size_t n)
+{
+    const char* s = src;
+    char* d = dst;
+    while (n-- > 0) *d++ = *s++;
+    return dst;
+}
+
+__attribute__((optimize("no-tree-loop-distribute-patterns"))) static void*
+byte_memset(void* dst, int c, size_t n)
+{
+    char* d = dst;
+    while (n-- > 0) *d++ = c;
+    return dst;
+}
+
+static inline uint64_t
+cycles()
+{
+    uint64_t t;
+    asm volatile("isb; mrs %[cnt], pmccntr_el0" : [cnt] "=r"(t));
+    return t;
+}
+
+/* Print bytes/cycle for ROUNDS calls on n bytes taking t cycles. */
+static void
+report(char* name, size_t n, uint64_t t)
+{
+    uint64_t r = n * ROUNDS * 100 / (t ? t : 1);
+    cprintf(
+        "  %s %d B: %lld.%lld%lld B/cycle\n", name, n, r / 100, r / 10 % 10,
+        r % 10);
+}
+
+static void
+bench_cpy(char* name, void* (*fn)(void*, const void*, size_t), size_t n)
+{
+    fn(dst, src, n);  // Warm the caches
+    uint64_t t = cycles();
+    for (int i = 0; i < ROUNDS; i++) fn(dst, src, n);
+    t = cycles() - t;
+    if (memcmp(dst, ref, n)) panic("\tstring_test: %s is wrong.\n", name);
+    report(name, n, t);
+}
+
+static void
+bench_set(char* name, void* (*fn)(void*, int, size_t), size_t n)
+{
+    fn(dst, 0x5a, n);
+    uint64_t t = cycles();
+    for (int i = 0; i < ROUNDS; i++) fn(dst, 0x5a, n);
+    t = cycles() - t;
+    if (memcmp(dst, ref, n)) panic("\tstring_test: %s is wrong.\n", name);
+    report(name, n, t);
+}
+
+/*
+ * Compare the byte loops with the ldp/stp and NEON routines
+ * for sizes from 16 B to 4 KiB, on the cycle counter.
+ */
+void
+string_test()
+{
+    src = kalloc();
+    dst = kalloc();
+    ref = kalloc();
+    if (!src || !dst || !ref) panic("\tstring_test: out of memory.\n");
+
+    // Enable the cycle counter, counting at EL1.
+    asm volatile("msr pmccfiltr_el0, xzr");
+    asm volatile("msr pmcntenset_el0, %[x]" : : [x] "r"(1UL << 31));
+    asm volatile("msr pmcr_el0, %[x]" : : [x] "r"(1UL));
+
+    for (int i = 0; i < PGSIZE; i++) src[i] = i * 7 + 3;
+    for (size_t n = 16; n <= PGSIZE; n *= 2) {
+        cprintf("string_test: %d B\n", n);
+        byte_memcpy(ref, src, n);
+        bench_cpy("byte memcpy", byte_memcpy, n);
+        bench_cpy("memcpy", memcpy, n);
+        bench_cpy("memcpy_neon", memcpy_neon, n);
+
+        byte_memset(ref, 0x5a, n);
+        bench_set("byte memset", byte_memset, n);
+        bench_set("memset", memset, n);
+        bench_set("memset_neon", memset_neon, n);
+    }
+
+    uint64_t t = cycles();
+    for (int i = 0; i < ROUNDS; i++) copy_page(dst, src);
+    report("copy_page", PGSIZE, cycles() - t);
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) clear_page(dst);
+    report("clear_page", PGSIZE, cycles() - t);
+
+    kfree(src);
+    kfree(dst);
+    kfree(ref);
+}
@@ -5,6 +5,7 @@
 #include "string.h"
 #include "syscall1.h"
 #include "types.h"
+#include "uaccess.h"
 
 /*
  * User code makes a system call with SVC.
@@ -17,41 +18,31 @@
 int
 fetchint(uint64_t addr, int64_t* ip)
 {
-    struct proc* p = thisproc();
-    if (addr >= p->sz || addr + 8 > p->sz) return -1;
-
-    *ip = *(int64_t*)(addr);
-    return 0;
+    return copy_from_user(ip, (void*)addr, sizeof(*ip));
 }
 
 /*
- * Fetch the nul-terminated string at addr from the current process.
- * Doesn't actually copy the string - just sets *pp to point at it.
- * Returns length of string, not including nul.
+ * Copy the nul-terminated string at addr from the current process
+ * into buf, which holds n bytes.
+ * Returns length of string, not including nul, -1 if it doesn't fit
+ * or -EFAULT.
  */
 int
-fetchstr(uint64_t addr, char** pp)
+fetchstr(uint64_t addr, char* buf, size_t n)
 {
-    struct proc* p = thisproc();
-    if (addr >= p->sz) return -1;
-
-    *pp = (char*)addr;
-    char* ep = (char*)p->sz;
-    for (char* s = *pp; s < ep; ++s) {
-        if (*s == '\0') return s - *pp;
-    }
-    return -1;
+    long r = strncpy_from_user(buf, (char*)addr, n);
+    return r == n ? -1 : r;
 }
 
 /*
  * Fetch the nth (starting from 0) 32-bit system call argument.
- * In our ABI, r0 contains system call index, r1-r4 contain parameters.
- * now we support system calls with at most 4 parameters.
+ * In our ABI, r0 contains system call index, r1-r6 contain parameters.
+ * now we support system calls with at most 6 parameters.
  */
 int
 argint(int n, uint64_t* ip)
 {
-    if (n > 3) panic("\targint: too many system call parameters.\n");
+    if (n > 5) panic("\targint: too many system call parameters.\n");
     struct proc* p = thisproc();
 
     *ip = *(&p->tf->x1 + n);
@@ -59,50 +50,32 @@ argint(int n, uint64_t* ip)
 }
 
 /*
- * Fetch the nth word-sized system call argument as a pointer
- * to a block of memory of size n bytes.  Check that the pointer
- * lies within the process address space.
- */
-int
-argptr(int n, char** pp, int size)
-{
-    uint64_t i;
-    if (argint(n, &i) < 0) return -1;
-
-    struct proc* p = thisproc();
-    if ((uint64_t)i >= p->sz || (uint64_t)i + size > p->sz) return -1;
-
-    *pp = (char*)i;
-    return 0;
-}
-
-/*
- * Fetch the nth word-sized system call argument as a string pointer.
- * Check that the pointer is valid and the string is nul-terminated.
- * (There is no shared writable memory, so the string can't change
- * between this check and being used by the kernel.)
+ * Fetch the nth word-sized system call argument as a string pointer,
+ * and copy the string into buf, which holds n bytes.
+ * Copying means the string can't change after it is checked.
  */
 int
-argstr(int n, char** pp)
+argstr(int n, char* buf, size_t size)
 {
     uint64_t addr;
     if (argint(n, &addr) < 0) return -1;
-    cprintf("argstr: n %d addr %lld\n", n, addr);
-    return fetchstr(addr, pp);
+    return fetchstr(addr, buf, size);
 }
 
 static func syscalls[] = {
-    [SYS_set_tid_address] = sys_gettid,
+    [SYS_set_tid_address] = sys_set_tid_address,
     [SYS_gettid] = sys_gettid,
+    [SYS_getpid] = sys_getpid,
+    [SYS_futex] = sys_futex,
     [SYS_ioctl] = sys_ioctl,
     [SYS_rt_sigprocmask] = sys_rt_sigprocmask,
+    [SYS_rt_sigaction] = sys_rt_sigaction,
     [SYS_brk] = (func)sys_brk,
     [SYS_execve] = sys_exec,
     [SYS_sched_yield] = sys_yield,
     [SYS_clone] = sys_clone,
     [SYS_wait4] = sys_wait4,
-    // FIXME: exit_group should kill every thread in the current thread group.
-    [SYS_exit_group] = sys_exit,
+    [SYS_exit_group] = sys_exit_group,
     [SYS_exit] = sys_exit,
     [SYS_dup] = sys_dup,
     [SYS_chdir] = sys_chdir,
@@ -111,9 +84,25 @@ static func syscalls[] = {
     [SYS_mkdirat] = sys_mkdirat,
     [SYS_mknodat] = sys_mknodat,
     [SYS_openat] = sys_openat,
+    [SYS_write] = (func)sys_write,
     [SYS_writev] = (func)sys_writev,
     [SYS_read] = (func)sys_read,
+    [SYS_pread64] = (func)sys_pread64,
+    [SYS_pwrite64] = (func)sys_pwrite64,
+    [SYS_getdents64] = (func)sys_getdents64,
     [SYS_close] = sys_close,
+    [SYS_mmap] = (func)sys_mmap,
+    [SYS_munmap] = sys_munmap,
+    [SYS_mprotect] = sys_mprotect,
+    [SYS_madvise] = sys_madvise,
+    [SYS_pipe2] = sys_pipe2,
+    [SYS_splice] = (func)sys_splice,
+    [SYS_vmsplice] = (func)sys_vmsplice,
+    [SYS_sendfile] = (func)sys_sendfile,
+    [SYS_fcntl] = sys_fcntl,
+    [SYS_clock_gettime] = sys_clock_gettime,
+    [SYS_nanosleep] = sys_nanosleep,
+    [SYS_clock_nanosleep] = sys_clock_nanosleep,
 };
 
 int
@@ -2,9 +2,11 @@
 
 #include "console.h"
 #include "proc.h"
+#include "uaccess.h"
 
 /*
- * Use pid instead of tid since we don't have threads.
+ * Each thread is a process of its own, whose pid is the tid. The
+ * pid of the process is the thread group ID.
  */
 int
 sys_gettid()
@@ -12,6 +14,32 @@ sys_gettid()
     return thisproc()->pid;
 }
 
+int
+sys_getpid()
+{
+    return thisproc()->tgid;
+}
+
+/*
+ * Set the address exit() zeroes, as CLONE_CHILD_CLEARTID does.
+ */
+int
+sys_set_tid_address()
+{
+    struct proc* p = thisproc();
+    if (argint(0, &p->clear_tid) < 0) return -1;
+    return p->pid;
+}
+
+/*
+ * Advice about memory use, which is free to ignore.
+ */
+int
+sys_madvise()
+{
+    return 0;
+}
+
 /*
  * Hack TIOCGWINSZ (get window size).
  */
@@ -31,3 +59,16 @@ sys_rt_sigprocmask()
 {
     return 0;
 }
+
+/*
+ * Every signal has its default action, since we don't have signals.
+ */
+int
+sys_rt_sigaction()
+{
+    struct proc* p = thisproc();
+    uint64_t oldact = p->tf->x2;
+    uint64_t k_sigaction[4] = {0};  // handler, flags, restorer, mask
+    if (oldact && copy_to_user((void*)oldact, k_sigaction, 32)) return -1;
+    return 0;
+}
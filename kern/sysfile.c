@@ -4,10 +4,12 @@
  * user code, and calls into file.c and fs.c.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 
 #include "console.h"
 #include "file.h"
+#include "kalloc.h"
 #include "log.h"
 #include "mmu.h"
 #include "proc.h"
@@ -16,6 +18,12 @@
 #include "string.h"
 #include "syscall1.h"
 #include "types.h"
+#include "uaccess.h"
+
+#ifndef F_SETPIPE_SZ
+#    define F_SETPIPE_SZ 1031
+#    define F_GETPIPE_SZ 1032
+#endif
 
 struct iovec {
     void* iov_base; /* Starting address. */
@@ -33,94 +41,340 @@ argfd(int n, uint64_t* pfd, struct file** pf)
     struct file* f;
 
     if (argint(n, &fd) < 0) return -1;
-    if (fd < 0 || fd >= NOFILE || (f = thisproc()->ofile[fd]) == 0) return -1;
+    if (fd < 0 || fd >= NOFILE || (f = thisproc()->files->ofile[fd]) == 0)
+        return -1;
     if (pfd) *pfd = fd;
     if (pf) *pf = f;
     return 0;
 }
 
 /*
- * Allocate a file descriptor for the given file.
+ * Allocate a file descriptor for the given file, closed on exec()
+ * if flags has O_CLOEXEC.
  * Takes over file reference from caller on success.
  */
 static int
-fdalloc(struct file* f)
+fdalloc(struct file* f, int flags)
 {
-    struct proc* p = thisproc();
+    struct fdtable* ft = thisproc()->files;
 
+    acquire(&ft->lock);
     for (int fd = 0; fd < NOFILE; ++fd) {
-        if (!p->ofile[fd]) {
-            p->ofile[fd] = f;
+        if (!ft->ofile[fd]) {
+            ft->ofile[fd] = f;
+            ft->cloexec &= ~(1U << fd);
+            if (flags & O_CLOEXEC) ft->cloexec |= 1U << fd;
+            release(&ft->lock);
             return fd;
         }
     }
+    release(&ft->lock);
     return -1;
 }
 
+/*
+ * Clear descriptor fd, returning the file it held.
+ */
+static struct file*
+fdfree(int fd)
+{
+    struct fdtable* ft = thisproc()->files;
+
+    acquire(&ft->lock);
+    struct file* f = ft->ofile[fd];
+    ft->ofile[fd] = NULL;
+    ft->cloexec &= ~(1U << fd);
+    release(&ft->lock);
+    return f;
+}
+
 int
 sys_dup()
 {
     struct file* f;
     if (argfd(0, 0, &f) < 0) return -1;
 
-    int fd = fdalloc(f);
+    int fd = fdalloc(f, 0);
     if (fd < 0) return -1;
 
     file_dup(f);
     return fd;
 }
 
+/*
+ * Read up to n bytes of f into user memory at ubuf, at *off and
+ * advancing it if off isn't NULL, else at the file offset.
+ *
+ * The data goes through a kernel page and out with copy_to_user(),
+ * never into user memory in place: a thread sharing the memory may
+ * unmap the buffer at any time, even while the read sleeps, and the
+ * kernel would fault on it. Only regular files are read a page after
+ * another; a pipe or a device returns what its first read gets, as
+ * a second might block.
+ */
+static ssize_t
+uread(struct file* f, char* ubuf, size_t n, size_t* off)
+{
+    char* buf = kalloc();
+    if (!buf) return -ENOMEM;
+
+    int more = f->type == FD_INODE && f->ip->type != T_DEV;
+    size_t tot = 0;
+    ssize_t r = 0;
+    while (tot < n) {
+        size_t m = MIN(n - tot, PGSIZE);
+        r = off ? file_pread(f, buf, m, *off) : file_read(f, buf, m);
+        if (r < 0) break;
+        if (copy_to_user(ubuf + tot, buf, r) < 0) {
+            r = -EFAULT;
+            break;
+        }
+        if (off) *off += r;
+        tot += r;
+        if (r < m || !more) break;
+    }
+    kfree(buf);
+    return tot ? tot : r;
+}
+
+/*
+ * Write n bytes at user address ubuf to f, at *off and advancing it
+ * if off isn't NULL, else at the file offset. The data is copied in
+ * a page at a time with copy_from_user(), for the reason uread()
+ * gives.
+ */
+static ssize_t
+uwrite(struct file* f, char* ubuf, size_t n, size_t* off)
+{
+    char* buf = kalloc();
+    if (!buf) return -ENOMEM;
+
+    size_t tot = 0;
+    ssize_t r = 0;
+    while (tot < n) {
+        size_t m = MIN(n - tot, PGSIZE);
+        if (copy_from_user(buf, ubuf + tot, m) < 0) {
+            r = -EFAULT;
+            break;
+        }
+        r = off ? file_pwrite(f, buf, m, *off) : file_write(f, buf, m);
+        if (r < 0) break;
+        if (off) *off += r;
+        tot += r;
+        if (r < m) break;
+    }
+    kfree(buf);
+    return tot ? tot : r;
+}
+
 ssize_t
 sys_read()
 {
     struct file* f;
-    uint64_t n;
-    char* p;
+    uint64_t p, n;
 
-    if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    if (argfd(0, 0, &f) < 0 || argint(1, &p) < 0 || argint(2, &n) < 0)
         return -1;
-    return file_read(f, p, n);
+    return uread(f, (char*)p, n, NULL);
 }
 
 ssize_t
 sys_write()
 {
     struct file* f;
-    uint64_t n;
-    char* p;
+    uint64_t p, n;
 
-    if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    if (argfd(0, 0, &f) < 0 || argint(1, &p) < 0 || argint(2, &n) < 0)
         return -1;
-    return file_write(f, p, n);
+    return uwrite(f, (char*)p, n, NULL);
 }
 
+/*
+ * pread64(fd, buf, count, offset), which reads at offset
+ * without moving the file offset, so readers don't share it.
+ */
 ssize_t
-sys_writev()
+sys_pread64()
 {
     struct file* f;
-    uint64_t fd, iovcnt;
-    struct iovec* iov;
-    if (argfd(0, &fd, &f) < 0 || argint(2, &iovcnt) < 0
-        || argptr(1, (char**)&iov, iovcnt * sizeof(struct iovec)) < 0) {
+    uint64_t p, n, off;
+
+    if (argfd(0, 0, &f) < 0 || argint(1, &p) < 0 || argint(2, &n) < 0
+        || argint(3, &off) < 0)
         return -1;
-    }
+    if (f->type == FD_PIPE) return -ESPIPE;
+    return uread(f, (char*)p, n, &off);
+}
 
-    size_t tot = 0;
-    for (struct iovec* p = iov; p < iov + iovcnt; ++p) {
-        tot += file_write(f, p->iov_base, p->iov_len);
+/*
+ * pwrite64(fd, buf, count, offset)
+ */
+ssize_t
+sys_pwrite64()
+{
+    struct file* f;
+    uint64_t p, n, off;
+
+    if (argfd(0, 0, &f) < 0 || argint(1, &p) < 0 || argint(2, &n) < 0
+        || argint(3, &off) < 0)
+        return -1;
+    if (f->type == FD_PIPE) return -ESPIPE;
+    return uwrite(f, (char*)p, n, &off);
+}
+
+/*
+ * Read or write the iovcnt vectors at uiov from or to file f.
+ */
+static ssize_t
+iov_rw(struct file* f, uint64_t uiov, uint64_t iovcnt, int write)
+{
+    // Copy the vectors in a few at a time.
+    struct iovec iov[8];
+    ssize_t tot = 0;
+    for (uint64_t i = 0; i < iovcnt; i += ARRAY_SIZE(iov)) {
+        uint64_t n = MIN(iovcnt - i, ARRAY_SIZE(iov));
+        if (copy_from_user(iov, (struct iovec*)uiov + i, n * sizeof(*iov)))
+            return -EFAULT;
+        for (struct iovec* p = iov; p < iov + n; ++p) {
+            ssize_t r = write ? uwrite(f, p->iov_base, p->iov_len, NULL)
+                              : uread(f, p->iov_base, p->iov_len, NULL);
+            if (r < 0) return tot ? tot : r;
+            tot += r;
+            if (r < p->iov_len) return tot;
+        }
     }
     return tot;
 }
 
+ssize_t
+sys_writev()
+{
+    struct file* f;
+    uint64_t uiov, iovcnt;
+    if (argfd(0, 0, &f) < 0 || argint(1, &uiov) < 0 || argint(2, &iovcnt) < 0)
+        return -1;
+    return iov_rw(f, uiov, iovcnt, 1);
+}
+
+/*
+ * Copy the offset at uoff in, if uoff isn't NULL.
+ */
+static int
+fetchoff(uint64_t uoff, size_t* off)
+{
+    return uoff ? copy_from_user(off, (void*)uoff, sizeof(*off)) : 0;
+}
+
+/*
+ * Copy the offset back out to uoff, if uoff isn't NULL.
+ */
+static int
+storeoff(uint64_t uoff, size_t off)
+{
+    return uoff ? copy_to_user((void*)uoff, &off, sizeof(off)) : 0;
+}
+
+/*
+ * Move data between a pipe and a file, or two pipes, without copying
+ * it through user memory; see file_splice_read() and
+ * file_splice_write(). Offsets are only taken for files that aren't
+ * pipes, and the file offset is used and advanced when one is NULL.
+ */
+ssize_t
+sys_splice()
+{
+    struct file *in, *out;
+    uint64_t uoffin, uoffout, n;
+    size_t off;
+    if (argfd(0, 0, &in) < 0 || argint(1, &uoffin) < 0
+        || argfd(2, 0, &out) < 0 || argint(3, &uoffout) < 0
+        || argint(4, &n) < 0)
+        return -1;
+
+    if (!in->readable || !out->writable) return -1;
+    ssize_t r;
+    if (in->type == FD_PIPE) {
+        if (uoffin || (out->type == FD_PIPE && uoffout)) return -1;
+        if (out->type == FD_PIPE && out->pipe == in->pipe) return -1;
+        if (fetchoff(uoffout, &off) < 0) return -EFAULT;
+        r = file_splice_write(in->pipe, out, uoffout ? &off : &out->off, n);
+        if (r > 0 && storeoff(uoffout, off) < 0) return -EFAULT;
+    } else if (out->type == FD_PIPE) {
+        if (uoffout) return -1;
+        if (fetchoff(uoffin, &off) < 0) return -EFAULT;
+        r = file_splice_read(in, uoffin ? &off : &in->off, out->pipe, n);
+        if (r > 0 && storeoff(uoffin, off) < 0) return -EFAULT;
+    } else {
+        return -1;
+    }
+    return r;
+}
+
+/*
+ * Write user memory to a pipe, or read a pipe into user memory.
+ * The data is copied, as by writev() and readv(): a user page
+ * carries no reference count, so it can't be lent to the pipe.
+ */
+ssize_t
+sys_vmsplice()
+{
+    struct file* f;
+    uint64_t uiov, iovcnt;
+    if (argfd(0, 0, &f) < 0 || argint(1, &uiov) < 0 || argint(2, &iovcnt) < 0)
+        return -1;
+    if (f->type != FD_PIPE) return -1;
+    return iov_rw(f, uiov, iovcnt, f->writable);
+}
+
+/*
+ * Copy a file to another straight from the page cache, see
+ * file_sendfile(). Reads at the offset at uoff and updates it, or at
+ * and advancing the file offset if uoff is NULL.
+ */
+ssize_t
+sys_sendfile()
+{
+    struct file *out, *in;
+    uint64_t uoff, n;
+    size_t off;
+    if (argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &uoff) < 0
+        || argint(3, &n) < 0)
+        return -1;
+    if (fetchoff(uoff, &off) < 0) return -EFAULT;
+
+    ssize_t r = file_sendfile(out, in, uoff ? &off : &in->off, n);
+    if (r > 0 && storeoff(uoff, off) < 0) return -EFAULT;
+    return r;
+}
+
+ssize_t
+sys_getdents64()
+{
+    struct file* f;
+    uint64_t p, n;
+
+    if (argfd(0, 0, &f) < 0 || argint(1, &p) < 0 || argint(2, &n) < 0)
+        return -1;
+    if (f->type != FD_INODE || !f->readable) return -1;
+
+    // Fill a kernel page and copy it out, as uread() does.
+    char* buf = kalloc();
+    if (!buf) return -ENOMEM;
+    ilock(f->ip);
+    ssize_t r = getdents(f->ip, buf, &f->off, MIN(n, PGSIZE));
+    iunlock(f->ip);
+    if (r > 0 && copy_to_user((char*)p, buf, r) < 0) r = -EFAULT;
+    kfree(buf);
+    return r;
+}
+
 int
 sys_close()
 {
     uint64_t fd;
     struct file* f;
-    struct proc* p = thisproc();
 
-    if (argfd(0, &fd, &f) < 0) return -1;
-    p->ofile[fd] = 0;
+    if (argfd(0, &fd, &f) < 0 || !(f = fdfree(fd))) return -1;
     file_close(f);
     return 0;
 }
@@ -129,22 +383,23 @@ int
 sys_fstat()
 {
     struct file* f;
-    struct stat* st;  // user pointer to struct stat
+    uint64_t ust;  // user pointer to struct stat
+    struct stat st;
 
-    if (argfd(0, 0, &f) < 0 || argptr(1, (char**)&st, sizeof(*st)) < 0)
-        return -1;
-    return file_stat(f, st);
+    if (argfd(0, 0, &f) < 0 || argint(1, &ust) < 0) return -1;
+    if (file_stat(f, &st) < 0) return -1;
+    return copy_to_user((void*)ust, &st, sizeof(st)) < 0 ? -EFAULT : 0;
 }
 
 int
 sys_fstatat()
 {
-    uint64_t dirfd, flags;
-    char* path;
-    struct stat* st;
+    uint64_t dirfd, ust, flags;
+    char path[MAXPATH];
+    struct stat st;
 
-    if (argint(0, &dirfd) < 0 || argstr(1, &path) < 0
-        || argptr(2, (char**)&st, sizeof(*st)) < 0 || argint(3, &flags) < 0)
+    if (argint(0, &dirfd) < 0 || argstr(1, path, sizeof(path)) < 0
+        || argint(2, &ust) < 0 || argint(3, &flags) < 0)
         return -1;
 
     if (dirfd != AT_FDCWD) {
@@ -163,11 +418,11 @@ sys_fstatat()
         return -1;
     }
     ilock(ip);
-    stati(ip, st);
+    stati(ip, &st);
     iunlockput(ip);
     end_op();
 
-    return 0;
+    return copy_to_user((void*)ust, &st, sizeof(st)) < 0 ? -EFAULT : 0;
 }
 
 static struct inode*
@@ -201,6 +456,7 @@ create(char* path, short type, short major, short minor)
     if (type == T_DIR) {
         dp->nlink++;
         iupdate(dp);
+        dirinit(ip);
         if (dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0) {
             panic("\tcreate: . .. failed.\n");
         }
@@ -214,10 +470,11 @@ create(char* path, short type, short major, short minor)
 int
 sys_openat()
 {
-    char* path;
+    char path[MAXPATH];
     uint64_t dirfd, omode;
 
-    if (argint(0, &dirfd) < 0 || argstr(1, &path) < 0 || argint(2, &omode) < 0)
+    if (argint(0, &dirfd) < 0 || argstr(1, path, sizeof(path)) < 0
+        || argint(2, &omode) < 0)
         return -1;
 
     if (dirfd != AT_FDCWD) {
@@ -245,7 +502,7 @@ sys_openat()
             return -1;
         }
         ilock(ip);
-        if (ip->type == T_DIR && omode != (O_RDONLY | O_LARGEFILE)) {
+        if (ip->type == T_DIR && (omode & (O_WRONLY | O_RDWR))) {
             iunlockput(ip);
             end_op();
             return -1;
@@ -253,7 +510,7 @@ sys_openat()
     }
 
     struct file* f = file_alloc();
-    int fd = fdalloc(f);
+    int fd = f ? fdalloc(f, omode) : -1;
     if (!f || fd < 0) {
         if (f) file_close(f);
         iunlockput(ip);
@@ -275,9 +532,10 @@ int
 sys_mkdirat()
 {
     uint64_t dirfd, mode;
-    char* path;
+    char path[MAXPATH];
 
-    if (argint(0, &dirfd) < 0 || argstr(1, &path) < 0 || argint(2, &mode) < 0)
+    if (argint(0, &dirfd) < 0 || argstr(1, path, sizeof(path)) < 0
+        || argint(2, &mode) < 0)
         return -1;
     if (dirfd != AT_FDCWD) {
         cprintf("sys_mkdirat: dirfd unimplemented.\n");
@@ -302,11 +560,11 @@ sys_mkdirat()
 int
 sys_mknodat()
 {
-    char* path;
+    char path[MAXPATH];
     uint64_t dirfd, major, minor;
 
-    if (argint(0, &dirfd) < 0 || argstr(1, &path) < 0 || argint(2, &major) < 0
-        || argint(3, &minor))
+    if (argint(0, &dirfd) < 0 || argstr(1, path, sizeof(path)) < 0
+        || argint(2, &major) < 0 || argint(3, &minor))
         return -1;
 
     if (dirfd != AT_FDCWD) {
@@ -326,15 +584,67 @@ sys_mknodat()
     return 0;
 }
 
+int
+sys_pipe2()
+{
+    uint64_t ufd, flags;
+    if (argint(0, &ufd) < 0 || argint(1, &flags) < 0) return -1;
+    if (flags & ~O_CLOEXEC) {
+        cprintf("sys_pipe2: flags unimplemented.\n");
+        return -1;
+    }
+
+    struct file *rf, *wf;
+    if (pipe_alloc(&rf, &wf) < 0) return -1;
+
+    int fd[2] = {-1, -1};
+    if ((fd[0] = fdalloc(rf, flags)) < 0 || (fd[1] = fdalloc(wf, flags)) < 0
+        || copy_to_user((void*)ufd, fd, sizeof(fd)) < 0) {
+        for (int i = 0; i < 2; ++i)
+            if (fd[i] >= 0) fdfree(fd[i]);
+        file_close(rf);
+        file_close(wf);
+        return -1;
+    }
+    return 0;
+}
+
+int
+sys_fcntl()
+{
+    struct file* f;
+    struct fdtable* ft = thisproc()->files;
+    uint64_t fd, cmd, arg;
+    if (argfd(0, &fd, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+        return -1;
+
+    switch (cmd) {
+    case F_GETFD: return ft->cloexec >> fd & 1 ? FD_CLOEXEC : 0;
+    case F_SETFD:
+        acquire(&ft->lock);
+        ft->cloexec &= ~(1U << fd);
+        if (arg & FD_CLOEXEC) ft->cloexec |= 1U << fd;
+        release(&ft->lock);
+        return 0;
+    case F_GETPIPE_SZ:
+        if (f->type != FD_PIPE) return -1;
+        return pipe_size(f->pipe);
+    case F_SETPIPE_SZ:
+        if (f->type != FD_PIPE) return -1;
+        return pipe_resize(f->pipe, arg);
+    default: cprintf("sys_fcntl: cmd %d unimplemented.\n", cmd); return -1;
+    }
+}
+
 int
 sys_chdir()
 {
-    char* path;
+    char path[MAXPATH];
     struct proc* p = thisproc();
 
     begin_op();
     struct inode* ip;
-    if (argstr(0, &path) < 0 || (ip = namei(path)) == 0) {
+    if (argstr(0, path, sizeof(path)) < 0 || (ip = namei(path)) == 0) {
         end_op();
         return -1;
     }
@@ -1,48 +1,71 @@
+#include <errno.h>
 #include <stdint.h>
 #include <syscall.h>
+#include <time.h>
 
 #include "console.h"
+#include "kalloc.h"
+#include "mmu.h"
 #include "proc.h"
 #include "string.h"
 #include "syscall1.h"
 #include "trap.h"
 #include "types.h"
+#include "uaccess.h"
 
 int
 sys_exec()
 {
-    char* path;
+    char path[MAXPATH];
     char* argv[MAXARG];
     uint64_t uargv;
     int64_t uarg;
 
-    if (argstr(0, &path) < 0 || argint(1, &uargv) < 0) {
+    if (argstr(0, path, sizeof(path)) < 0 || argint(1, &uargv) < 0) {
         cprintf("sys_exec: invalid arguments.\n");
         return -1;
     }
     cprintf("sys_exec: exec '%s' uargv %lld\n", path, uargv);
 
+    // Copy the argument strings in, a page each,
+    // since the user memory holding them is going away.
+    int r = -1;
     memset(argv, 0, sizeof(argv));
     for (int i = 0;; ++i) {
         if (i >= ARRAY_SIZE(argv)) {
             cprintf("sys_exec: too many arguments.\n");
-            return -1;
+            goto out;
         }
         if (fetchint(uargv + sizeof(uint64_t) * i, &uarg) < 0) {
             cprintf("sys_exec: failed to fetch uarg.\n");
-            return -1;
+            goto out;
         }
-        if (!uarg) {
-            argv[i] = NULL;
-            break;
-        }
-        if (fetchstr(uarg, &argv[i]) < 0) {
+        if (!uarg) break;
+        if (!(argv[i] = kalloc()) || fetchstr(uarg, argv[i], PGSIZE) < 0) {
             cprintf("sys_exec: failed to fetch argument.\n");
-            return -1;
+            goto out;
         }
         cprintf("sys_exec: argv[%d] = '%s'\n", i, argv[i]);
     }
-    return execve(path, argv, NULL);
+    r = execve(path, argv, NULL);
+
+out:
+    for (int i = 0; i < ARRAY_SIZE(argv) && argv[i]; ++i) kfree(argv[i]);
+    return r;
+}
+
+/*
+ * Every clock is the system counter, which starts at boot.
+ */
+int
+sys_clock_gettime()
+{
+    uint64_t clk, uts, f, t = timestamp();
+    if (argint(0, &clk) < 0 || argint(1, &uts) < 0) return -1;
+
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+    struct timespec ts = {t / f, t % f * 1000000000 / f};
+    return copy_to_user((void*)uts, &ts, sizeof(ts));
 }
 
 int
@@ -57,21 +80,36 @@ sys_brk()
 {
     uint64_t n;
     if (argint(0, &n) < 0) return -1;
-    uint64_t addr = thisproc()->sz;
+    uint64_t addr = thisproc()->mm->sz;
     if (growproc(n) < 0) return -1;
     return addr;
 }
 
+/*
+ * fork(), vfork() as posix_spawn() does it, and pthread_create(),
+ * which passes CLONE_VM, CLONE_FILES and CLONE_THREAD among others.
+ * The flags for what we don't have, signal handlers and System V
+ * semaphores, are accepted and ignored. Only SIGCHLD may be sent at
+ * exit, and it isn't.
+ */
 int
 sys_clone()
 {
-    uint64_t flag, childstk;
-    if (argint(0, &flag) < 0 || argint(1, &childstk) < 0) return -1;
-    if (flag != 17) {
-        cprintf("sys_clone: flags other than SIGCHLD are not supported.\n");
+    uint64_t flags, stack, ptid, tls, ctid;
+    if (argint(0, &flags) < 0 || argint(1, &stack) < 0 || argint(2, &ptid) < 0
+        || argint(3, &tls) < 0 || argint(4, &ctid) < 0)
+        return -1;
+
+    uint64_t known = CSIGNAL | CLONE_VM | CLONE_FS | CLONE_FILES
+                     | CLONE_SIGHAND | CLONE_VFORK | CLONE_THREAD
+                     | CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID
+                     | CLONE_CHILD_CLEARTID | CLONE_DETACHED;
+    if ((flags & ~known) || ((flags & CSIGNAL) && (flags & CSIGNAL) != 17)
+        || ((flags & CLONE_THREAD) && !(flags & CLONE_VM))) {
+        cprintf("sys_clone: flags 0x%llx are not supported.\n", flags);
         return -1;
     }
-    return fork();
+    return clone(flags, stack, ptid, tls, ctid);
 }
 
 int
@@ -83,19 +121,38 @@ sys_wait4()
         || argint(3, &rusage) < 0)
         return -1;
 
-    if (pid != -1 || wstatus != 0 || opt != 0 || rusage != 0) {
+    if ((int)pid < -1 || !(int)pid || opt != 0 || rusage != 0) {
         cprintf(
-            "\tsys_wait4: unimplemented. pid %d, wstatus 0x%p, opt 0x%x, rusage 0x%p\n",
-            pid, wstatus, opt, rusage);
+            "\tsys_wait4: unimplemented. pid %d, opt 0x%x, rusage 0x%p\n",
+            pid, opt, rusage);
         return -1;
     }
 
-    return wait();
+    int status = 0;
+    int r = wait(pid, &status);
+    status = (status & 0xff) << 8;  // Exited normally, see WEXITSTATUS()
+    if (r > 0 && wstatus && copy_to_user((void*)wstatus, &status, 4) < 0)
+        return -EFAULT;
+    return r;
 }
 
+/*
+ * Exit the calling thread only. Its process exits with the last.
+ */
 int
 sys_exit()
 {
-    exit(0);
+    uint64_t status;
+    if (argint(0, &status) < 0) status = 1;
+    exit(status);
+    return 0;
+}
+
+int
+sys_exit_group()
+{
+    uint64_t status;
+    if (argint(0, &status) < 0) status = 1;
+    exit_group(status);
     return 0;
 }
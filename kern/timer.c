@@ -1,33 +1,240 @@
+/*
+ * One-shot timers on each CPU's physical timer.
+ *
+ * Each CPU keeps its timers in a list sorted by expiry, and has its
+ * timer fire at the first, or never if there is none. Preemption is
+ * one of them: the scheduler starts a tick of one quantum as it
+ * switches to a process, and cancels it when the process gives the
+ * CPU back, so that a CPU with nothing to run takes no interrupts at
+ * all until a timer or a device wants it.
+ */
+
 #include "timer.h"
 
+#include <errno.h>
+#include <time.h>
+
 #include "arm.h"
+#include "console.h"
 #include "peripherals/irq.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "syscall1.h"
+#include "sysregs.h"
+#include "uaccess.h"
 
-#include "console.h"
+#define TIMER_ABSTIME 1  // clock_nanosleep() flag, as in Linux
+
+static struct {
+    struct spinlock lock;
+    struct hrtimer* head;     // Sorted by expiry
+    struct hrtimer* running;  // Whose fn is being called
+} __attribute__((aligned(64))) queues[NCPU];
 
-static int dt = 19200000;
+static struct hrtimer ticks[NCPU];
+static uint64_t quantum = QUANTUM_US;  // Microseconds
+static struct spinlock sleep_lock;     // Held by nanosleep() to sleep
+
+/* Set this CPU's timer to the first expiry on its list. */
+static void
+timer_program(int cpu)
+{
+    struct hrtimer* t = queues[cpu].head;
+    uint64_t cval = t ? t->expires : UINT64_MAX;
+    asm volatile("msr cntp_cval_el0, %[x]" : : [x] "r"(cval));
+}
+
+static void
+tick(void* arg)
+{
+    thiscpu->resched = 1;
+}
 
 void
 timer_init()
 {
+    int c = cpuid();
+    if (c == 0) initlock(&sleep_lock, "nanosleep");
+    initlock(&queues[c].lock, "hrtimer");
+    ticks[c] = (struct hrtimer)HRTIMER_INIT(tick, NULL);
+    timer_program(c);
     asm volatile("msr cntp_ctl_el0, %[x]" : : [x] "r"(1));
-    asm volatile("msr cntp_tval_el0, %[x]" : : [x] "r"(dt));
-    put32(CORE_TIMER_CTRL(cpuid()), CORE_TIMER_ENABLE);
-    cprintf("timer_init: success at CPU %d.\n", cpuid());
+    asm volatile("msr cntkctl_el1, %[x]" : : [x] "r"(CNTKCTL_VALUE));
+    put32(CORE_TIMER_CTRL(c), CORE_TIMER_ENABLE);
+    cprintf("timer_init: success at CPU %d.\n", c);
+}
+
+/*
+ * Start t, which must not be pending, to fire on this CPU when the
+ * system counter reaches expires.
+ */
+void
+hrtimer_start(struct hrtimer* t, uint64_t expires)
+{
+    int self = cpuid();
+    t->expires = expires;
+    acquire(&queues[self].lock);
+    struct hrtimer** pt = &queues[self].head;
+    while (*pt && (*pt)->expires <= expires) pt = &(*pt)->next;
+    t->next = *pt;
+    *pt = t;
+    t->cpu = self;
+    if (queues[self].head == t) timer_program(self);
+    release(&queues[self].lock);
+}
+
+/*
+ * Stop t if it is pending, or wait for its fn to return if it is
+ * running, so that the caller may reuse or free it after. Must not
+ * be called holding a lock that t's fn takes. Cancelling the first
+ * timer of this CPU sets its timer for the next, so tick_stop() leaves
+ * an idle CPU quiet; a CPU whose first timer is cancelled from
+ * elsewhere takes one spurious interrupt.
+ */
+void
+hrtimer_cancel(struct hrtimer* t)
+{
+    int c;
+    while ((c = __atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE)) >= 0) {
+        acquire(&queues[c].lock);
+        if (t->cpu == c && queues[c].running != t) {
+            struct hrtimer** pt = &queues[c].head;
+            while (*pt != t) pt = &(*pt)->next;
+            *pt = t->next;
+            t->cpu = -1;
+            if (pt == &queues[c].head && c == cpuid()) timer_program(c);
+        }
+        release(&queues[c].lock);
+    }
 }
 
+/*
+ * Call the functions of the timers that have expired on this CPU,
+ * and set its timer for the next. Called on its timer interrupt.
+ */
 void
-timer_reset()
+hrtimer_run()
 {
-    asm volatile("msr cntp_tval_el0, %[x]" : : [x] "r"(dt));
+    int self = cpuid();
+    acquire(&queues[self].lock);
+    struct hrtimer* t;
+    while ((t = queues[self].head) && t->expires <= timestamp()) {
+        queues[self].head = t->next;
+        queues[self].running = t;
+        release(&queues[self].lock);
+        t->fn(t->arg);
+        acquire(&queues[self].lock);
+        queues[self].running = NULL;
+        __atomic_store_n(&t->cpu, -1, __ATOMIC_RELEASE);
+    }
+    timer_program(self);
+    release(&queues[self].lock);
 }
 
 /*
- * This is a per-cpu non-stable version of clock, frequency of
- * which is determined by cpu clock (may be tuned for power saving).
+ * Give the process about to run on this CPU one quantum, after which
+ * it is preempted on its next interrupt from user mode.
  */
 void
-timer()
+tick_start()
+{
+    uint64_t f, q = __atomic_load_n(&quantum, __ATOMIC_RELAXED);
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+    thiscpu->resched = 0;
+    hrtimer_start(&ticks[cpuid()], timestamp() + q * f / 1000000);
+}
+
+void
+tick_stop()
+{
+    hrtimer_cancel(&ticks[cpuid()]);
+}
+
+/*
+ * Set the quantum to us microseconds, unless it is 0, and return it.
+ */
+uint64_t
+timer_quantum(uint64_t us)
+{
+    if (us) __atomic_store_n(&quantum, us, __ATOMIC_RELAXED);
+    return __atomic_load_n(&quantum, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sleep until the system counter reaches deadline, on an hrtimer of
+ * this CPU. If killed first, return -EINTR, and store the time left
+ * at user address urem unless that is 0.
+ */
+static int
+nanosleep_until(uint64_t deadline, uint64_t urem)
+{
+    struct proc* p = thisproc();
+    acquire(&sleep_lock);
+    while (timestamp() < deadline) {
+        if (p->killed) {
+            release(&sleep_lock);
+            if (urem) {
+                uint64_t f, left = deadline - timestamp();
+                asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+                struct timespec ts = {left / f, left % f * 1000000000 / f};
+                if (copy_to_user((void*)urem, &ts, sizeof(ts)) < 0)
+                    return -EFAULT;
+            }
+            return -EINTR;
+        }
+        sleep_until(&deadline, &sleep_lock, deadline);
+    }
+    release(&sleep_lock);
+    return 0;
+}
+
+/*
+ * Read the time at user address uts as a count of the system counter,
+ * setting *err to -EFAULT or -EINVAL if it is bad.
+ */
+static uint64_t
+timespec_ticks(uint64_t uts, int* err)
+{
+    struct timespec ts;
+    uint64_t f;
+    *err = 0;
+    if (copy_from_user(&ts, (void*)uts, sizeof(ts)) < 0)
+        *err = -EFAULT;
+    else if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+        *err = -EINVAL;
+    if (*err) return 0;
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+    return ts.tv_sec * f + ts.tv_nsec * f / 1000000000;
+}
+
+/*
+ * nanosleep(req, rem)
+ */
+int
+sys_nanosleep()
+{
+    uint64_t ureq, urem;
+    int err;
+    if (argint(0, &ureq) < 0 || argint(1, &urem) < 0) return -EINVAL;
+    uint64_t t = timespec_ticks(ureq, &err);
+    if (err) return err;
+    return nanosleep_until(timestamp() + t, urem);
+}
+
+/*
+ * clock_nanosleep(clock, flags, req, rem), which musl's nanosleep()
+ * calls. Every clock is the system counter, as for clock_gettime().
+ */
+int
+sys_clock_nanosleep()
 {
-    cprintf("timer: CPU %d timer.\n", cpuid());
+    uint64_t clk, flags, ureq, urem;
+    int err;
+    if (argint(0, &clk) < 0 || argint(1, &flags) < 0 || argint(2, &ureq) < 0
+        || argint(3, &urem) < 0)
+        return -EINVAL;
+    uint64_t t = timespec_ticks(ureq, &err);
+    if (err) return err;
+    if (flags & TIMER_ABSTIME) return nanosleep_until(t, 0);
+    return nanosleep_until(timestamp() + t, urem);
 }
@@ -5,14 +5,135 @@
 #include "arm.h"
 #include "clock.h"
 #include "console.h"
+#include "file.h"
+#include "ipi.h"
+#include "kalloc.h"
 #include "mmu.h"
 #include "peripherals/irq.h"
 #include "proc.h"
 #include "sd.h"
+#include "softirq.h"
+#include "string.h"
 #include "syscall1.h"
 #include "sysregs.h"
 #include "timer.h"
+#include "types.h"
+#include "uaccess.h"
 #include "uart.h"
+#include "vm.h"
+
+extern struct exentry ex_table[], eex_table[];
+
+/*
+ * The GPU can send its interrupts, the UART's and the SD card's, to
+ * just one core, as can the local timer. As the kernel runs with
+ * interrupts masked, they are taken late by a core busy in the
+ * kernel, so by default the GPU's follow the idle cores: the last to
+ * enter wfi takes them, and passes them on when it leaves. Writing
+ * "gpu n", "gpu idle" or "clock n" to device IRQSTAT_MAJOR routes
+ * them, and "quantum n" sets the time slice to n microseconds; writing
+ * anything else clears the counts read from it.
+ */
+#define ROUTE_IDLE -1
+
+struct irqstat irqstat[NCPU];
+
+static int gpu_route = ROUTE_IDLE, clock_route;
+
+/*
+ * Print the routes and the quantum, then each CPU's interrupts by
+ * source, and how late its timer interrupts and tasklets ran, in
+ * microseconds, into page, and return the length.
+ */
+static size_t
+irqstat_print(char* page)
+{
+    static char h1[] =
+        "cpu     timer     clock       ipi      uart        sd     other\n";
+    static char h2[] =
+        "cpu  late avg  late max  tasklets delay avg delay max\n";
+    uint64_t f;
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+    f = MAX(f / 1000000, 1);
+
+    char* p = page;
+    put_str(&p, "gpu to cpu ", 11);
+    if (gpu_route == ROUTE_IDLE)
+        put_str(&p, "idle", 4);
+    else
+        put_num(&p, gpu_route, 1);
+    put_str(&p, ", clock to cpu ", 15);
+    put_num(&p, clock_route, 1);
+    put_str(&p, ", quantum ", 10);
+    put_num(&p, timer_quantum(0), 1);
+    put_str(&p, " us\n", 4);
+
+    put_str(&p, h1, sizeof(h1) - 1);
+    for (int c = 0; c < NCPU; c++) {
+        put_num(&p, c, 3);
+        for (int i = 0; i < NISRC; i++) put_num(&p, irqstat[c].count[i], 10);
+        *p++ = '\n';
+    }
+    put_str(&p, h2, sizeof(h2) - 1);
+    for (int c = 0; c < NCPU; c++) {
+        struct irqstat* s = &irqstat[c];
+        uint64_t n = MAX(s->count[ISRC_TIMER], 1), t = MAX(s->tasklets, 1);
+        put_num(&p, c, 3);
+        put_num(&p, s->late / n / f, 10);
+        put_num(&p, s->maxlate / f, 10);
+        put_num(&p, s->tasklets, 10);
+        put_num(&p, s->delay / t / f, 10);
+        put_num(&p, s->maxdelay / f, 10);
+        *p++ = '\n';
+    }
+    return p - page;
+}
+
+static ssize_t
+irqstat_read(struct inode* ip, char* dst, size_t off, ssize_t n)
+{
+    char* page = kalloc();
+    if (!page) return -1;
+    size_t len = irqstat_print(page);
+    n = off < len ? MIN(n, len - off) : 0;
+    memmove(dst, page + off, n);
+    kfree(page);
+    return n;
+}
+
+static ssize_t
+irqstat_write(struct inode* ip, char* src, ssize_t n)
+{
+    char buf[16], *end;
+    int len = MIN(n, sizeof(buf) - 1);
+    memmove(buf, src, len);
+    buf[len] = '\0';
+
+    if (!strncmp(buf, "gpu idle", 8)) {
+        gpu_route = ROUTE_IDLE;
+        return n;
+    }
+    if (!strncmp(buf, "gpu ", 4) || !strncmp(buf, "clock ", 6)) {
+        int c = strtol(strfind(buf, ' '), &end, 10);
+        if (end == strfind(buf, ' ') || c < 0 || c >= NCPU) return -1;
+        if (buf[0] == 'g') {
+            gpu_route = c;
+            put32(GPU_INT_ROUTE, GPU_IRQ2CORE(c));
+        } else {
+            clock_route = c;
+            put32(TIMER_ROUTE, TIMER_IRQ2CORE(c));
+        }
+        return n;
+    }
+    if (!strncmp(buf, "quantum ", 8)) {
+        long us = strtol(buf + 8, &end, 10);
+        if (end == buf + 8 || us <= 0) return -1;
+        timer_quantum(us);
+        return n;
+    }
+    memset(irqstat, 0, sizeof(struct irqstat) * NCPU);
+    return n;
+}
 
 void
 irq_init()
@@ -21,35 +142,110 @@ irq_init()
     put32(ENABLE_IRQS_1, AUX_INT);
     put32(ENABLE_IRQS_2, VC_ARASANSDIO_INT);
     put32(GPU_INT_ROUTE, GPU_IRQ2CORE(0));
+    devsw[IRQSTAT_MAJOR].read = irqstat_read;
+    devsw[IRQSTAT_MAJOR].write = irqstat_write;
     cprintf("irq_init: success.\n");
 }
 
+/*
+ * Take the GPU interrupts on entering wfi if they follow the idle
+ * cores, and pass them to another idle core, if any, on leaving it.
+ */
 void
-interrupt(struct trapframe* tf)
+irq_idle(int enter)
+{
+    int self = cpuid();
+    if (__atomic_load_n(&gpu_route, __ATOMIC_RELAXED) != ROUTE_IDLE) return;
+    if (enter) {
+        put32(GPU_INT_ROUTE, GPU_IRQ2CORE(self));
+        return;
+    }
+    if ((get32(GPU_INT_ROUTE) & 3) != GPU_IRQ2CORE(self)) return;
+    for (int i = 0; i < NCPU; i++) {
+        if (i != self && __atomic_load_n(&cpus[i].idle, __ATOMIC_RELAXED)) {
+            put32(GPU_INT_ROUTE, GPU_IRQ2CORE(i));
+            return;
+        }
+    }
+}
+
+/*
+ * Handle every interrupt pending on this CPU and return their sources
+ * in IRQ_SRC_CORE. Called on an interrupt from user mode, and by the
+ * scheduler after wfi, as the kernel otherwise runs with them masked.
+ */
+int
+irq_handle()
 {
-    int src = get32(IRQ_SRC_CORE(cpuid()));
+    int self = cpuid();
+    struct irqstat* s = &irqstat[self];
+    int src = get32(IRQ_SRC_CORE(self));
     if (src & IRQ_CNTPNSIRQ) {
-        timer_reset();
-        // timer();
-        yield();
-    } else if (src & IRQ_TIMER) {
+        uint64_t cval, late;
+        asm volatile("mrs %[x], cntp_cval_el0" : [x] "=r"(cval));
+        late = timestamp() - cval;
+        s->count[ISRC_TIMER]++;
+        s->late += late;
+        s->maxlate = MAX(s->maxlate, late);
+        hrtimer_run();
+    }
+    if (src & IRQ_TIMER) {
+        s->count[ISRC_CLOCK]++;
         clock_reset();
         // clock();
-    } else if (src & IRQ_GPU) {
+    }
+    if (src & IRQ_MBOX(0)) {
+        s->count[ISRC_IPI]++;
+        ipi_handle();
+    }
+    if (src & IRQ_GPU) {
         int p1 = get32(IRQ_PENDING_1);
         int p2 = get32(IRQ_PENDING_2);
         if (p1 & AUX_INT) {
+            s->count[ISRC_UART]++;
             uart_intr();
         } else if (p2 & VC_ARASANSDIO_INT) {
+            s->count[ISRC_SD]++;
             sd_intr();
         } else {
+            s->count[ISRC_OTHER]++;
             cprintf(
                 "interrupt: unexpected gpu intr p1 %x, p2 %x, sd %d, omitted.\n",
                 p1, p2, p2 & VC_ARASANSDIO_INT);
         }
-    } else {
+    }
+    return src;
+}
+
+void
+interrupt(struct trapframe* tf)
+{
+    int src = irq_handle();
+    softirq_run();
+    if (thiscpu->resched)
+        yield();
+    else if (!src)
         cprintf("interrupt: unexpected interrupt at CPU %d\n", cpuid());
+}
+
+/*
+ * A data abort taken in the kernel is expected only from a user
+ * access in kern/uaccess.S, which resumes at its fixup unless the
+ * fault came from a block being split and the access is retried.
+ */
+static void
+kernel_fault(struct trapframe* tf, int iss)
+{
+    if (uvm_split_fault(iss)) return;
+    for (struct exentry* e = ex_table; e < eex_table; ++e) {
+        if (e->insn == tf->elr_el1) {
+            tf->elr_el1 = e->fixup;
+            return;
+        }
     }
+    panic(
+        "\tkernel_fault: data abort at 0x%llx, address 0x%llx.\n",
+        tf->elr_el1, rfar());
 }
 
 void
@@ -67,8 +263,18 @@ trap(struct trapframe* tf)
             cprintf("trap: unexpected svc iss 0x%x\n", iss);
         }
         break;
+    case EC_DABORT_EL1: kernel_fault(tf, iss); return;
+    case EC_DABORT:
+    case EC_IABORT:
+        // A user access may only have hit a block being split.
+        if (uvm_split_fault(iss)) break;
+        // fall through
     default: panic("\ttrap: unexpected irq.\n");
     }
+
+    // On the way back to user space, exit if exit_group() killed us.
+    struct proc* p = thisproc();
+    if (p && p->killed) exit(p->xstate);
 }
 
 void
@@ -0,0 +1,117 @@
+/*
+ * Benchmark of the user access routines in uaccess.S against the
+ * bounds checks and direct accesses system calls made before.
+ * Build with `make UACCESS_TEST=1` to run it at boot.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "arm.h"
+#include "console.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "string.h"
+#include "syscall1.h"
+#include "uaccess.h"
+#include "vm.h"
+
+#define ROUNDS 256  // Calls timed per case
+
+static inline uint64_t
+cycles()
+{
+    uint64_t t;
+    asm volatile("isb; mrs %[cnt], pmccntr_el0" : [cnt] "=r"(t));
+    return t;
+}
+
+static void
+report(char* name, uint64_t t)
+{
+    cprintf("uaccess_test: %s: %lld cycles\n", name, t / ROUNDS);
+}
+
+/*
+ * Time what fetching an int, a path and eight iovecs, and writing a
+ * stat-sized result, costs a system call, on a process of four pages
+ * whose third page is a stack guard page. Check that bad pointers
+ * come back as -EFAULT.
+ */
+void
+uaccess_test()
+{
+    uint64_t ttbr0, sz = 4 * PGSIZE, t;
+    uint64_t* pgdir = pgdir_init();
+    if (!pgdir || uvm_alloc(pgdir, 0, sz) != sz)
+        panic("\tuaccess_test: out of memory.\n");
+    uvm_clear(pgdir, (char*)(2 * PGSIZE));
+    asm volatile("mrs %[x], ttbr0_el1" : [x] "=r"(ttbr0));
+    lttbr0(V2P(pgdir));
+
+    // Enable the cycle counter, counting at EL1.
+    asm volatile("msr pmccfiltr_el0, xzr");
+    asm volatile("msr pmcntenset_el0, %[x]" : : [x] "r"(1UL << 31));
+    asm volatile("msr pmcr_el0, %[x]" : : [x] "r"(1UL));
+
+    char* path = (char*)0x100;
+    uint64_t* words = (uint64_t*)0x400;
+    char* out = (char*)0x800;
+    memmove(path, "/usr/share/doc/README", 22);
+    for (int i = 0; i < 16; i++) words[i] = i * 0x1234567;
+
+    int64_t x;
+    char buf[MAXPATH];
+    uint64_t iov[16];
+
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) {
+        if ((uint64_t)words + 8 > sz) panic("\tuaccess_test: bounds.\n");
+        x = *(volatile int64_t*)words;
+    }
+    report("int, checked load", cycles() - t);
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) copy_from_user(&x, words, sizeof(x));
+    report("int, copy_from_user", cycles() - t);
+
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        for (volatile char* s = path; s < (char*)sz && *s; ++s)
+            ;
+    report("path, checked scan", cycles() - t);
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) strncpy_from_user(buf, path, MAXPATH);
+    report("path, strncpy_from_user", cycles() - t);
+
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) copy_from_user(iov, words, sizeof(iov));
+    report("8 iovecs, copy_from_user", cycles() - t);
+
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) copyout(pgdir, (uint64_t)out, buf, 128);
+    report("128 B, copyout", cycles() - t);
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++) copy_to_user(out, buf, 128);
+    report("128 B, copy_to_user", cycles() - t);
+
+    if (strncmp(buf, path, MAXPATH) || memcmp(iov, words, sizeof(iov))
+        || memcmp(out, buf, 128))
+        panic("\tuaccess_test: wrong data.\n");
+
+    t = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        if (copy_from_user(&x, (void*)sz, sizeof(x)) != -EFAULT)
+            panic("\tuaccess_test: unmapped address.\n");
+    report("fault", cycles() - t);
+
+    if (copy_from_user(&x, (void*)(2 * PGSIZE), 8) != -EFAULT
+        || copy_to_user((void*)(2 * PGSIZE), &x, 8) != -EFAULT
+        || copy_from_user(&x, buf, 8) != -EFAULT
+        || copy_from_user(iov, (char*)(2 * PGSIZE) - 8, 16) != -EFAULT
+        || strncpy_from_user(buf, (char*)sz, MAXPATH) != -EFAULT)
+        panic("\tuaccess_test: bad pointer accepted.\n");
+
+    lttbr0(ttbr0);
+    vm_free(pgdir);
+    cprintf("uaccess_test: passed.\n");
+}
@@ -1,11 +1,30 @@
+#include <stddef.h>
 #include <stdint.h>
 
 #include "arm.h"
 #include "console.h"
 #include "peripherals/gpio.h"
 #include "peripherals/mini_uart.h"
+#include "softirq.h"
+#include "spinlock.h"
 #include "uart.h"
 
+#define RXBUF 256  // Received characters awaiting the console, a power of 2
+
+/*
+ * The interrupt handler only moves what the UART received into rx,
+ * and leaves the console's line editing and echo, which waits on the
+ * UART for every character, to a tasklet.
+ */
+static struct {
+    struct spinlock lock;
+    char buf[RXBUF];
+    uint32_t r, w;
+} rx;
+
+static void uart_rx(void*);
+static struct tasklet rx_tasklet = TASKLET_INIT(uart_rx, NULL);
+
 void
 uart_putchar(int c)
 {
@@ -21,10 +40,32 @@ uart_getchar()
     return get32(AUX_MU_IO_REG) & 0xFF;
 }
 
+/* Take the next character out of rx, or return -1. */
+static int
+rx_getchar()
+{
+    int c = -1;
+    acquire(&rx.lock);
+    if (rx.r != rx.w) c = rx.buf[rx.r++ % RXBUF];
+    release(&rx.lock);
+    return c;
+}
+
+static void
+uart_rx(void* arg)
+{
+    console_intr(rx_getchar);
+}
+
 void
 uart_intr()
 {
-    console_intr(uart_getchar);
+    int c;
+    acquire(&rx.lock);
+    while ((c = uart_getchar()) >= 0)
+        if (rx.w - rx.r < RXBUF) rx.buf[rx.w++ % RXBUF] = c;
+    release(&rx.lock);
+    tasklet_schedule(&rx_tasklet);
 }
 
 void
@@ -32,6 +73,8 @@ uart_init()
 {
     uint32_t selector, enables;
 
+    initlock(&rx.lock, "uart");
+
     /* initialize UART */
     enables = get32(AUX_ENABLES);
     enables |= 1;
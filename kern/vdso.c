@@ -0,0 +1,59 @@
+/*
+ * The vDSO: user/vdso.S, linked as a shared object and built into the
+ * kernel, is copied into a page at boot, which every address space
+ * maps read-only at VDSOBASE. The C library finds its functions
+ * through AT_SYSINFO_EHDR, which exec() points at VDSOBASE, and calls
+ * them instead of trapping. They need no data of their own: the clock
+ * is the system counter, and the scheduler leaves the thread group ID
+ * in TPIDRRO_EL0, which is per task, for getpid().
+ */
+
+#include "vdso.h"
+
+#include "console.h"
+#include "kalloc.h"
+#include "mmap.h"
+#include "mmu.h"
+#include "proc.h"
+#include "string.h"
+#include "vm.h"
+
+static char* text;  // The image, shared by every address space
+
+void
+vdso_init()
+{
+    extern char _binary_obj_user_vdso_start[];
+    extern char _binary_obj_user_vdso_size[];
+    uint64_t sz = (uint64_t)_binary_obj_user_vdso_size;
+    if (sz > PGSIZE) panic("\tvdso_init: image larger than a page.\n");
+    if (!(text = kalloc_zeroed())) panic("\tvdso_init: no memory.\n");
+    memmove(text, _binary_obj_user_vdso_start, sz);
+
+    // Make the code visible to instruction fetches.
+    for (char* p = text; p < text + PGSIZE; p += 64)
+        asm volatile("dc cvau, %[p]" : : [p] "r"(p));
+    asm volatile("dsb ish; ic ialluis; dsb ish; isb");
+    cprintf("vdso_init: success.\n");
+}
+
+/*
+ * Map the vDSO into mm. Returns -1 if memory runs out.
+ */
+int
+vdso_map(struct mm* mm)
+{
+    int perm = PTE_USER | PTE_RO | PTE_PAGE;
+    if (map_region(mm->pgdir, (void*)VDSOBASE, PGSIZE, (uint64_t)text, perm))
+        return -1;
+    return 0;
+}
+
+/*
+ * Unmap the shared image from mm, so that vm_free() doesn't free it.
+ */
+void
+vdso_unmap(struct mm* mm)
+{
+    uvm_unmap_page(mm->pgdir, VDSOBASE, NULL);
+}
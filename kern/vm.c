@@ -8,10 +8,104 @@
 #include "kalloc.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "pcache.h"
 #include "string.h"
 #include "types.h"
 
-extern uint64_t* kpgdir;
+#define TLB_RANGE 64  // Most pages worth dropping one at a time
+
+#define FSC_MASK  0x3c  // Fault status code, without the level
+#define FSC_TRANS 0x04  // Translation fault
+
+extern uint64_t kpgdir[];
+
+/* Bumped as a block split starts and ends, so odd while one runs. */
+static uint64_t splitseq;
+
+/*
+ * User memory may be mapped by 2 MiB level-2 block entries as well as
+ * by pages. A block is used wherever uvm_alloc() can fill an aligned
+ * 2 MiB with a block from kalloc_huge(), and is split back into pages
+ * when only part of it is unmapped.
+ *
+ * The text of a program is mapped by uvm_share() from the page cache,
+ * as mmap() maps a read-only file: such pages carry PTE_SHARED, hold
+ * a reference on their page, and are never blocks.
+ */
+
+/*
+ * Drop the TLB entries of every CPU, including cached table walks,
+ * after an entry has been removed or changed. Threads sharing a page
+ * table may be running on any of them.
+ */
+void
+flush_tlb()
+{
+    asm volatile("dsb ishst; tlbi vmalle1is; dsb ish; isb");
+}
+
+/*
+ * Drop the TLB entries of every CPU for user addresses start to end,
+ * after their entries have been removed or changed. The inner
+ * shareable TLBI is broadcast to the other cores by the hardware, so
+ * no IPI is needed; past TLB_RANGE pages, dropping them all is faster.
+ */
+void
+tlb_shootdown(uint64_t start, uint64_t end)
+{
+    if (end - start > TLB_RANGE * PGSIZE) {
+        flush_tlb();
+        return;
+    }
+    asm volatile("dsb ishst");
+    for (uint64_t va = ROUNDDOWN(start, PGSIZE); va < end; va += PGSIZE)
+        asm volatile("tlbi vaae1is, %[x]" : : [x] "r"(va >> 12));
+    asm volatile("dsb ish; isb");
+}
+
+/* Is the leaf entry pte a 2 MiB block rather than a page? */
+static inline int
+is_block(uint64_t pte)
+{
+    return (pte & (PTE_P | PTE_TABLE)) == PTE_P;
+}
+
+/* Return the kernel address of the block mapped by the entry pte. */
+static inline char*
+block_addr(uint64_t pte)
+{
+    return P2V(ROUNDDOWN(PTE_ADDR(pte), BKSIZE));
+}
+
+/* Return the kernel address of the page holding va, given its leaf entry. */
+static char*
+leaf_page(uint64_t pte, uint64_t va)
+{
+    if (is_block(pte)) return block_addr(pte) + ROUNDDOWN(va % BKSIZE, PGSIZE);
+    return P2V(PTE_ADDR(pte));
+}
+
+/*
+ * Give back the page mapped by the level-3 entry pte: its page cache
+ * reference if it is shared, else the page itself.
+ */
+static void
+page_free(uint64_t pte)
+{
+    char* page = P2V(PTE_ADDR(pte & ~PTE_SHARED));
+    if (pte & PTE_SHARED)
+        pcache_unpin(page);
+    else
+        kfree(page);
+}
+
+/* Return a level-3 entry mapping the page at kernel address page. */
+static inline uint64_t
+page_entry(void* page, int64_t perm)
+{
+    return V2P(page) | perm | PTE_P | PTE_TABLE | (MT_NORMAL << 2) | PTE_AF
+           | PTE_SH;
+}
 
 /*
  * If the page is invalid, then allocate a new one. Return NULL if failed.
@@ -21,14 +115,66 @@ pde_validate(uint64_t* pde, int64_t alloc)
 {
     if (!(*pde & PTE_P)) {  // if the page is invalid
         if (!alloc) return NULL;
-        char* p = kalloc();
+        char* p = kalloc_zeroed();
         if (!p) return NULL;  // allocation failed
-        memset(p, 0, PGSIZE);
         *pde = V2P(p) | PTE_P | PTE_PAGE | PTE_USER | PTE_RW;
     }
     return pde;
 }
 
+/*
+ * Replace the block entry *pde by a table of pages mapping the same
+ * memory, which become ordinary pages. Returns -1 if no page is left
+ * for the table.
+ *
+ * Other threads of the process may touch the block meanwhile, from
+ * user code or through a user access in the kernel, and fault while
+ * the entry is empty; uvm_split_fault() has them try again.
+ */
+static int
+block_split(uint64_t* pde)
+{
+    uint64_t* pt = (uint64_t*)kalloc();
+    if (!pt) return -1;
+    uint64_t pa = V2P(block_addr(*pde));
+    uint64_t flags = PTE_FLAGS(*pde) | PTE_PAGE;
+    for (int i = 0; i < ENTRYSZ; ++i) pt[i] = (pa + i * PGSIZE) | flags;
+
+    // Break before make: the old entry must leave the TLB first.
+    // Keep interrupts off so that the entry stays empty only briefly.
+    uint64_t daif;
+    asm volatile("mrs %[x], daif; msr daifset, #2" : [x] "=r"(daif));
+    __atomic_fetch_add(&splitseq, 1, __ATOMIC_SEQ_CST);
+    *pde = 0;
+    flush_tlb();
+    *pde = V2P(pt) | PTE_P | PTE_PAGE | PTE_USER | PTE_RW;
+    asm volatile("dsb ishst; isb");
+    __atomic_fetch_add(&splitseq, 1, __ATOMIC_RELEASE);
+    asm volatile("msr daif, %[x]" : : [x] "r"(daif));
+    return 0;
+}
+
+/*
+ * Return whether the current process should simply retry the access
+ * that took a fault with syndrome iss, as a translation fault may
+ * have hit a block while block_split() had its entry empty. Waits for
+ * any split under way to finish. A process retries once for each
+ * split begun since its last fault, so a real fault is retried at
+ * most once and then reported.
+ */
+int
+uvm_split_fault(uint32_t iss)
+{
+    struct proc* p = thisproc();
+    if (!p || (iss & FSC_MASK) != FSC_TRANS) return 0;
+
+    uint64_t seq;
+    while ((seq = __atomic_load_n(&splitseq, __ATOMIC_ACQUIRE)) & 1) {}
+    if (p->splitseq == seq) return 0;
+    p->splitseq = seq;
+    return 1;
+}
+
 /*
  * Given 'pgdir', a pointer to a page directory, pgdir_walk returns
  * a pointer to the page table entry (PTE) for virtual address 'va'.
@@ -40,6 +186,9 @@ pde_validate(uint64_t* pde, int64_t alloc)
  *   - If the allocation fails, pgdir_walk returns NULL.
  *   - Otherwise, the new page is cleared, and pgdir_walk returns
  *     a pointer into the new page table page.
+ *
+ * If va lies in a 2 MiB block, pgdir_walk returns the block's entry,
+ * unless alloc is set, in which case it splits the block into pages.
  */
 static uint64_t*
 pgdir_walk(uint64_t* pgdir, const void* va, int64_t alloc)
@@ -50,12 +199,84 @@ pgdir_walk(uint64_t* pgdir, const void* va, int64_t alloc)
     uint64_t* pde = pgdir;
     for (int level = 0; level < 3; ++level) {
         pde = &pde[PTX(level, va)];  // get pde at the next level
+        if (level == 2 && is_block(*pde)) {
+            if (!alloc) return pde;
+            if (block_split(pde)) return NULL;
+        }
         if (!(pde = pde_validate(pde, alloc))) return NULL;
         pde = (uint64_t*)P2V(PTE_ADDR(*pde));
     }
     return &pde[PTX(3, va)];
 }
 
+/*
+ * Range walks.
+ * pt_range() finds the entry for va and tells the caller how far the
+ * page table holding it goes, so that a walk over [va, end) descends
+ * from the root once per page table and then steps through the
+ * entries in a row:
+ *
+ *     for (uint64_t va = start, next; va < end;) {
+ *         uint64_t* pte = pt_range(pgdir, va, end, 0, &next);
+ *         if (!pte) { va = next; continue; }
+ *         for (; va < next; va += PGSIZE, ++pte) ...
+ *     }
+ *
+ * For a 2 MiB block, the block's entry is returned and next is the
+ * end of the block; the caller must not step past it.
+ */
+static uint64_t*
+pt_range(uint64_t* pgdir, uint64_t va, uint64_t end, int alloc, uint64_t* next)
+{
+    uint64_t* pde = pgdir;
+    for (int level = 0; level < 3; ++level) {
+        uint64_t span = 1UL << (L0SHIFT - 9 * level);  // Covered by one pde
+        pde = &pde[PTX(level, va)];
+        if (level == 2 && is_block(*pde)) {
+            if (!alloc) {
+                *next = MIN(end, ROUNDDOWN(va, span) + span);
+                return pde;
+            }
+            if (block_split(pde)) return NULL;
+        }
+        if (!pde_validate(pde, alloc)) {
+            // Nothing is mapped anywhere under this pde.
+            *next = MIN(end, ROUNDDOWN(va, span) + span);
+            return NULL;
+        }
+        pde = (uint64_t*)P2V(PTE_ADDR(*pde));
+    }
+    *next = MIN(end, ROUNDDOWN(va, BKSIZE) + BKSIZE);
+    return &pde[PTX(3, va)];
+}
+
+/*
+ * Free the page tables on the way to va that have no entries left,
+ * from the level-3 table up. The root stays.
+ */
+static void
+pt_prune(uint64_t* pgdir, uint64_t va)
+{
+    uint64_t* pde[3];
+    uint64_t* pt = pgdir;
+    int level = 0;
+    for (; level < 3; ++level) {
+        pde[level] = &pt[PTX(level, va)];
+        if (!(*pde[level] & PTE_P) || is_block(*pde[level])) break;
+        pt = (uint64_t*)P2V(PTE_ADDR(*pde[level]));
+    }
+
+    // pde[0] to pde[level - 1] point to tables.
+    while (--level >= 0) {
+        pt = (uint64_t*)P2V(PTE_ADDR(*pde[level]));
+        for (int i = 0; i < ENTRYSZ; ++i)
+            if (pt[i]) return;
+        *pde[level] = 0;
+        flush_tlb();  // Before the table can be reused
+        kfree((char*)pt);
+    }
+}
+
 /*
  * Look up a virtual address, return the physical address,
  * or 0 if not mapped.
@@ -68,7 +289,18 @@ addr_walk(uint64_t* pgdir, const void* va)
     if (!pte) return 0;
     if (!(*pte & PTE_P)) return 0;
     if (!(*pte & PTE_USER)) return 0;
-    return (uint64_t)P2V(PTE_ADDR(*pte));
+    return (uint64_t)leaf_page(*pte, (uint64_t)va);
+}
+
+/*
+ * Return the kernel address of the byte that user code reaches at va,
+ * or NULL if it can't reach it.
+ */
+char*
+uvm_addr(uint64_t* pgdir, uint64_t va)
+{
+    uint64_t page = addr_walk(pgdir, (void*)ROUNDDOWN(va, PGSIZE));
+    return page ? (char*)page + va % PGSIZE : NULL;
 }
 
 /*
@@ -78,15 +310,47 @@ addr_walk(uint64_t* pgdir, const void* va)
  * Use permission bits perm|PTE_P|PTE_TABLE|(MT_NORMAL << 2)|PTE_AF|PTE_SH for
  * the entries.
  */
-static int
+int
 map_region(uint64_t* pgdir, void* va, uint64_t size, uint64_t pa, int64_t perm)
 {
-    for (uint64_t i = 0; i < size; i += PGSIZE) {
-        uint64_t* pte = pgdir_walk(pgdir, (void*)va + i, 1);
+    uint64_t a = (uint64_t)va, end = a + size, next;
+    while (a < end) {
+        uint64_t* pte = pt_range(pgdir, a, end, 1, &next);
         if (!pte) return 1;
-        *pte = V2P(PTE_ADDR(pa + i)) | perm | PTE_P | PTE_TABLE
-               | (MT_NORMAL << 2) | PTE_AF | PTE_SH;
+        for (; a < next; a += PGSIZE, pa += PGSIZE)
+            *pte++ = page_entry((void*)PTE_ADDR(pa), perm);
+    }
+    return 0;
+}
+
+/*
+ * Map the BKSIZE bytes at kernel address block at va, which must be
+ * BKSIZE aligned, by a single block entry.
+ * Returns -1 if there is no memory for the tables, or if anything
+ * is mapped there already. An empty page table left by earlier
+ * unmapping is freed.
+ */
+static int
+map_block(uint64_t* pgdir, uint64_t va, char* block, int64_t perm)
+{
+    uint64_t* pde = pgdir;
+    for (int level = 0; level < 2; ++level) {
+        pde = &pde[PTX(level, va)];
+        if (!(pde = pde_validate(pde, 1))) return -1;
+        pde = (uint64_t*)P2V(PTE_ADDR(*pde));
+    }
+    pde = &pde[PTX(2, va)];
+    if (*pde & PTE_P) {
+        if (is_block(*pde)) return -1;
+        uint64_t* pt = (uint64_t*)P2V(PTE_ADDR(*pde));
+        for (int i = 0; i < ENTRYSZ; ++i)
+            if (pt[i]) return -1;
+        *pde = 0;
+        flush_tlb();
+        kfree((char*)pt);
     }
+    *pde = V2P(block) | perm | PTE_P | PTE_BLOCK | (MT_NORMAL << 2) | PTE_AF
+           | PTE_SH;
     return 0;
 }
 
@@ -94,42 +358,103 @@ map_region(uint64_t* pgdir, void* va, uint64_t size, uint64_t pa, int64_t perm)
  * Remove npages of mappings starting from va. va must be
  * page-aligned. The mappings must exist.
  * Optionally free the physical memory.
+ * Page tables left empty are freed too.
+ * A block only partly in the range is split first, which fails with
+ * -1 if memory is short. Only the first block can be partly in the
+ * range of a caller shrinking memory, so nothing is unmapped then.
  */
-static void
+static int
 uvm_unmap(uint64_t* pgdir, uint64_t va, uint64_t npages, int do_free)
 {
     if (va % PGSIZE) panic("\tuvm_unmap: not aligned.\n");
 
-    uint64_t size = npages * PGSIZE;
-    for (uint64_t i = 0; i < size; i += PGSIZE) {
-        uint64_t* pte = pgdir_walk(pgdir, (void*)va + i, 0);
-        if (!pte) panic("\tuvmunmap: pgdir_walk error.\n");
-        if (!(*pte & PTE_P)) panic("\tuvmunmap: not mapped.\n");
-        if (PTE_FLAGS(*pte) == PTE_P) panic("\tuvmunmap: not a leaf.\n");
-        if (do_free) kfree((char*)V2P(PTE_ADDR(*pte)));
-        *pte = 0;
+    for (uint64_t end = va + npages * PGSIZE, next; va < end;) {
+        uint64_t* pte = pt_range(pgdir, va, end, 0, &next);
+        if (!pte || !(*pte & PTE_P)) panic("\tuvmunmap: not mapped.\n");
+        if (is_block(*pte)) {
+            if (va % BKSIZE == 0 && next == va + BKSIZE) {
+                if (do_free) kfree_huge(block_addr(*pte));
+                *pte = 0;
+                pt_prune(pgdir, va);
+                va = next;
+                continue;
+            }
+            if (!(pte = pt_range(pgdir, va, end, 1, &next))) return -1;
+        }
+
+        uint64_t start = va;
+        for (; va < next; va += PGSIZE, ++pte) {
+            if (!(*pte & PTE_P)) panic("\tuvmunmap: not mapped.\n");
+            if (PTE_FLAGS(*pte) == PTE_P) panic("\tuvmunmap: not a leaf.\n");
+            if (do_free) page_free(*pte);
+            *pte = 0;
+        }
+        pt_prune(pgdir, start);
+    }
+    return 0;
+}
+
+/*
+ * Return the kernel address of the page mapped at va, or NULL if
+ * there is none. If pte isn't NULL, the entry is stored in *pte.
+ */
+char*
+uvm_page(uint64_t* pgdir, uint64_t va, uint64_t* pte)
+{
+    uint64_t* p = pgdir_walk(pgdir, (void*)va, 0);
+    if (!p || !(*p & PTE_P)) return NULL;
+    if (pte) *pte = *p;
+    return P2V(PTE_ADDR(*p & ~PTE_SHARED));
+}
+
+/*
+ * Like uvm_page(), but also remove the mapping.
+ * The page itself is left to the caller.
+ */
+char*
+uvm_unmap_page(uint64_t* pgdir, uint64_t va, uint64_t* pte)
+{
+    uint64_t* p = pgdir_walk(pgdir, (void*)va, 0);
+    if (!p || !(*p & PTE_P)) return NULL;
+    if (pte) *pte = *p;
+    char* page = P2V(PTE_ADDR(*p & ~PTE_SHARED));
+    *p = 0;
+    return page;
+}
+
+/*
+ * Free the table pt at the given level, and all the tables and
+ * memory under it that map [va, end).
+ */
+static void
+pt_free(uint64_t* pt, int level, uint64_t va, uint64_t end)
+{
+    uint64_t span = 1UL << (L0SHIFT - 9 * level);  // Covered by one entry
+    for (uint64_t next; va < end; va = next) {
+        next = MIN(end, ROUNDDOWN(va, span) + span);
+        uint64_t e = pt[PTX(level, va)];
+        if (!(e & PTE_P)) continue;
+        if (level == 3)
+            page_free(e);
+        else if (is_block(e))
+            kfree_huge(block_addr(e));
+        else
+            pt_free((uint64_t*)P2V(PTE_ADDR(e)), level + 1, va, next);
     }
+    kfree((char*)pt);
 }
 
 /*
- * Free a page table.
+ * Free a user page table and the memory it maps.
+ * Only entries below VDSOTOP, the top of user memory, are looked at.
+ * Page cache pages left mapped, as by uvm_share(), are unpinned.
  */
 void
-vm_free(uint64_t* pgdir, int level)
+vm_free(uint64_t* pgdir)
 {
-    if (!pgdir || level < 0) return;
+    if (!pgdir) return;
     if (PTE_FLAGS(pgdir)) panic("\tvm_free: invalid pgdir.\n");
-    if (!level) {
-        kfree((char*)pgdir);
-        return;
-    }
-    for (uint64_t i = 0; i < ENTRYSZ; ++i) {
-        if (pgdir[i] & PTE_P) {
-            uint64_t* v = (uint64_t*)P2V(PTE_ADDR(pgdir[i]));
-            vm_free(v, level - 1);
-        }
-    }
-    kfree((char*)pgdir);
+    pt_free(pgdir, 0, 0, VDSOTOP);
 }
 
 /*
@@ -139,8 +464,7 @@ uint64_t*
 pgdir_init()
 {
     uint64_t* pgdir;
-    if (!(pgdir = (uint64_t*)kalloc())) return NULL;
-    memset(pgdir, 0, PGSIZE);
+    if (!(pgdir = (uint64_t*)kalloc_zeroed())) return NULL;
     return pgdir;
 }
 
@@ -156,7 +480,7 @@ uvm_init(uint64_t* pgdir, char* binary, uint64_t sz)
     char* mem;
     if (sz >= PGSIZE) panic("\tuvm_init: sz must be less than a page.\n");
     if (!(mem = kalloc())) panic("\tuvm_init: not enough memory.\n");
-    memset(mem, 0, PGSIZE);
+    clear_page(mem);
     map_region(
         pgdir, (void*)0, PGSIZE, (uint64_t)mem, PTE_USER | PTE_RW | PTE_PAGE);
     memmove((void*)mem, (const void*)binary, sz);
@@ -172,41 +496,90 @@ uvm_load(
 {
     if ((uint64_t)addr % PGSIZE)
         panic("\tuvm_load: addr must be page aligned.\n");
-    for (uint64_t i = 0; i < sz; i += PGSIZE) {
-        uint64_t* pte = pgdir_walk(pgdir, (void*)addr + i, 0);
+    uint64_t va = (uint64_t)addr, end = va + sz, next;
+    while (va < end) {
+        uint64_t* pte = pt_range(pgdir, va, end, 0, &next);
         if (!pte) panic("uvm_load: address should exist");
-        uint64_t pa = PTE_ADDR(*pte);
-        uint64_t n = (sz - i < PGSIZE) ? sz - i : PGSIZE;
-        if (readi(ip, P2V(pa), offset + i, n) != n) return -1;
+        for (; va < next; va += PGSIZE) {
+            uint64_t n = MIN(end - va, PGSIZE);
+            if (readi(ip, leaf_page(*pte, va), offset, n) != n) return -1;
+            offset += n;
+            if (!is_block(*pte)) ++pte;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Map the sz bytes of ip at offset at addr, all page-aligned, by the
+ * page cache pages themselves, read-only, for program text that every
+ * process running it shares. Later writes to the file show through.
+ * Caller must hold ip's lock. Returns -1 on failure, leaving what was
+ * mapped for vm_free().
+ */
+int
+uvm_share(
+    uint64_t* pgdir, char* addr, struct inode* ip, uint64_t offset, uint64_t sz)
+{
+    if ((uint64_t)addr % PGSIZE || offset % PGSIZE || sz % PGSIZE)
+        panic("\tuvm_share: not page aligned.\n");
+    for (uint64_t va = (uint64_t)addr; va < (uint64_t)addr + sz;
+         va += PGSIZE, offset += PGSIZE) {
+        struct page* pg = readpage(ip, offset / PGSIZE);
+        if (!pg) return -1;
+        // The mapping keeps the reference.
+        if (map_region(
+                pgdir, (void*)va, PGSIZE, (uint64_t)pg->data,
+                PTE_USER | PTE_RO | PTE_PAGE | PTE_SHARED)) {
+            pcache_put(pg);
+            return -1;
+        }
     }
     return 0;
 }
 
 /*
  * Allocate PTEs and physical memory to grow process from oldsz to
- * newsz, which need not be page aligned.  Returns new size or 0 on error.
+ * newsz, which need not be page aligned. With huge set, use a block
+ * for every aligned 2 MiB while kalloc_huge() has one.
+ * Returns new size or 0 on error.
  */
-uint64_t
-uvm_alloc(uint64_t* pgdir, uint64_t oldsz, uint64_t newsz)
+static uint64_t
+uvm_grow(uint64_t* pgdir, uint64_t oldsz, uint64_t newsz, int huge)
 {
     if (newsz < oldsz) return oldsz;
 
-    for (uint64_t va = oldsz; va < newsz; va += PGSIZE) {
-        char* mem = kalloc();
-        if (!mem) {
-            uvm_dealloc(pgdir, va, oldsz);
-            return 0;
+    uint64_t va = ROUNDUP(oldsz, PGSIZE), end = ROUNDUP(newsz, PGSIZE), next;
+    while (va < end) {
+        char* mem;
+        if (huge && va % BKSIZE == 0 && va + BKSIZE <= end
+            && (mem = kalloc_huge())) {
+            for (int i = 0; i < BKSIZE; i += PGSIZE) clear_page(mem + i);
+            if (!map_block(pgdir, va, mem, PTE_USER | PTE_RW)) {
+                va += BKSIZE;
+                continue;
+            }
+            kfree_huge(mem);
         }
-        memset(mem, 0, PGSIZE);
-        if (map_region(
-                pgdir, (void*)va, PGSIZE, (uint64_t)mem,
-                PTE_USER | PTE_RW | PTE_PAGE)) {
-            kfree(mem);
-            uvm_dealloc(pgdir, va, oldsz);
-            return 0;
+
+        uint64_t* pte = pt_range(pgdir, va, end, 1, &next);
+        if (!pte) goto bad;
+        for (; va < next; va += PGSIZE, ++pte) {
+            if (!(mem = kalloc_zeroed())) goto bad;
+            *pte = page_entry(mem, PTE_USER | PTE_RW | PTE_PAGE);
         }
     }
     return newsz;
+
+bad:
+    uvm_dealloc(pgdir, va, oldsz);
+    return 0;
+}
+
+uint64_t
+uvm_alloc(uint64_t* pgdir, uint64_t oldsz, uint64_t newsz)
+{
+    return uvm_grow(pgdir, oldsz, newsz, NHUGEPAGE > 0);
 }
 
 /*
@@ -220,52 +593,75 @@ uvm_dealloc(uint64_t* pgdir, uint64_t oldsz, uint64_t newsz)
 {
     if (newsz >= oldsz) return oldsz;
 
-    int npages = (oldsz - newsz) / PGSIZE;
-    uvm_unmap(pgdir, newsz, npages, 1);
+    uint64_t start = ROUNDUP(newsz, PGSIZE), end = ROUNDUP(oldsz, PGSIZE);
+    if (start < end && uvm_unmap(pgdir, start, (end - start) / PGSIZE, 1))
+        return 0;
 
     return newsz;
 }
 
 /*
- * Switch to the process's own page table for execution of it.
+ * Switch to the process's own page table for execution of it, or to
+ * the kernel's, which maps nothing for user code, once it has exited.
  */
 void
 uvm_switch(struct proc* p)
 {
     if (!p) panic("\tuvm_switch: no process.\n");
     if (!p->kstack) panic("\tuvm_switch: no kstack.\n");
-    if (!p->pgdir) panic("\tuvm_switch: no pgdir.\n");
 
-    lttbr0(V2P(p->pgdir));  // switch to process's address space
+    lttbr0(V2P(p->mm ? p->mm->pgdir : kpgdir));
 }
 
 /*
  * Given a parent process's page table, copy its memory into a child's page
  * table. Copies both the page table and the physical memory. Returns 0 on
  * success, -1 on failure. Frees any allocated pages on failure.
+ * A block is copied to a block if kalloc_huge() has one, else to pages.
+ * Page cache pages are shared, not copied.
  */
 int
 uvm_copy(uint64_t* old, uint64_t* new, uint64_t sz)
 {
-    for (uint64_t i = 0; i < sz; i += PGSIZE) {
-        uint64_t* pte = pgdir_walk(old, (void*)i, 0);
+    uint64_t va = 0, next;
+    while (va < sz) {
+        uint64_t* pte = pt_range(old, va, sz, 0, &next);
         if (!pte) panic("\tuvm_copy: pte should exist.\n");
-        if (!(*pte & PTE_P)) panic("\tuvm_copy: page not present.\n");
-        uint64_t pa = V2P(PTE_ADDR(*pte));
-        uint64_t flags = PTE_FLAGS(*pte);
-        char* mem = kalloc();
-        if (!mem) {
-            uvm_unmap(new, 0, i / PGSIZE, 1);
-            return -1;
+        uint64_t flags = PTE_FLAGS(*pte) | PTE_PAGE;
+        char* block;
+        if (is_block(*pte) && va % BKSIZE == 0 && (block = kalloc_huge())) {
+            char* from = block_addr(*pte);
+            for (int i = 0; i < BKSIZE; i += PGSIZE)
+                copy_page(block + i, from + i);
+            if (!map_block(new, va, block, PTE_FLAGS(*pte))) {
+                va += BKSIZE;
+                continue;
+            }
+            kfree_huge(block);
         }
-        memmove(mem, (void*)pa, PGSIZE);
-        if (map_region(new, (void*)i, PGSIZE, (uint64_t)mem, flags) != 0) {
-            kfree(mem);
-            uvm_unmap(new, 0, i / PGSIZE, 1);
-            return -1;
+
+        // Copy page by page, out of a block if need be.
+        uint64_t* dst = pt_range(new, va, next, 1, &next);
+        if (!dst) goto bad;
+        for (; va < next; va += PGSIZE, ++dst) {
+            if (!(*pte & PTE_P)) panic("\tuvm_copy: page not present.\n");
+            if (*pte & PTE_SHARED) {
+                pcache_pin(P2V(PTE_ADDR(*pte & ~PTE_SHARED)));
+                *dst = *pte++;
+                continue;
+            }
+            char* mem = kalloc();
+            if (!mem) goto bad;
+            copy_page(mem, leaf_page(*pte, va));
+            *dst = V2P(mem) | flags;
+            if (!is_block(*pte)) ++pte;
         }
     }
     return 0;
+
+bad:
+    uvm_unmap(new, 0, va / PGSIZE, 1);
+    return -1;
 }
 
 /*
@@ -275,7 +671,7 @@ uvm_copy(uint64_t* old, uint64_t* new, uint64_t sz)
 void
 uvm_clear(uint64_t* pgdir, char* va)
 {
-    uint64_t* pte = pgdir_walk(pgdir, va, 0);
+    uint64_t* pte = pgdir_walk(pgdir, va, 1);  // Split any block
     if (!pte) panic("\tuvm_clear: failed to locate PTE.\n");
     *pte &= ~PTE_USER;
 }
@@ -315,6 +711,103 @@ check_map_region()
         panic("\tcheck_map_region: failed.\n");
     }
 
-    vm_free((uint64_t*)p, 4);
+    vm_free((uint64_t*)p);
     cprintf("check_vm_free: passed.\n");
 }
+
+/*
+ * Random accesses over 64 MiB of user memory, mapped by pages and
+ * then by blocks, and a check that splitting a block keeps its data.
+ */
+void
+check_huge_pages()
+{
+    uint64_t ttbr0, f;
+    uint64_t* pgdir = pgdir_init();
+    if (!pgdir) panic("\tcheck_huge_pages: out of memory.\n");
+    asm volatile("mrs %[x], ttbr0_el1" : [x] "=r"(ttbr0));
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+
+    uint64_t base = BKSIZE, size = 64 << 20, n = 1 << 20;
+    for (int huge = 0; huge < 2; ++huge) {
+        if (uvm_grow(pgdir, base, base + size, huge) != base + size)
+            panic("\tcheck_huge_pages: uvm_grow failed.\n");
+        lttbr0(V2P(pgdir));
+
+        volatile uint64_t* mem = (uint64_t*)base;
+        uint64_t x = 88172645463325252UL, t = timestamp();
+        for (uint64_t i = 0; i < n; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            mem[x % (size / 8)] += i;
+        }
+        t = timestamp() - t;
+        cprintf(
+            "check_huge_pages: %s: %lld random accesses in %lld us\n",
+            huge ? "2 MiB blocks" : "4 KiB pages", n, t * 1000000 / f);
+
+        // Shrink into the middle of a block; the rest must survive.
+        uint64_t top = base + BKSIZE + 5 * PGSIZE;
+        for (uint64_t va = base; va < top; va += PGSIZE)
+            *(volatile uint64_t*)va = va;
+        if (uvm_dealloc(pgdir, base + size, top) != top)
+            panic("\tcheck_huge_pages: uvm_dealloc failed.\n");
+        lttbr0(V2P(pgdir));
+        for (uint64_t va = base; va < top; va += PGSIZE)
+            assert(*(volatile uint64_t*)va == va);
+        uvm_dealloc(pgdir, top, base);
+    }
+
+    lttbr0(ttbr0);
+    vm_free(pgdir);
+    cprintf("check_huge_pages: passed.\n");
+}
+
+/*
+ * Time the page table work of exec, fork and exit on a 16 MiB
+ * process made of 4 KiB pages: uvm_grow(), uvm_copy() and vm_free().
+ */
+void
+check_uvm_range()
+{
+    uint64_t ttbr0, f, size = 16 << 20, t[3] = {0};
+    asm volatile("mrs %[x], ttbr0_el1" : [x] "=r"(ttbr0));
+    asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
+
+    int rounds = 8;
+    for (int i = 0; i < rounds; ++i) {
+        uint64_t *pgdir = pgdir_init(), *child = pgdir_init();
+        if (!pgdir || !child) panic("\tcheck_uvm_range: out of memory.\n");
+
+        uint64_t s = timestamp();
+        if (uvm_grow(pgdir, 0, size, 0) != size)
+            panic("\tcheck_uvm_range: uvm_grow failed.\n");
+        t[0] += timestamp() - s;
+
+        lttbr0(V2P(pgdir));
+        for (uint64_t va = 0; va < size; va += PGSIZE)
+            *(volatile uint64_t*)va = va + i;
+
+        s = timestamp();
+        if (uvm_copy(pgdir, child, size) < 0)
+            panic("\tcheck_uvm_range: uvm_copy failed.\n");
+        t[1] += timestamp() - s;
+
+        lttbr0(V2P(child));
+        for (uint64_t va = 0; va < size; va += PGSIZE)
+            assert(*(volatile uint64_t*)va == va + i);
+        lttbr0(ttbr0);
+
+        s = timestamp();
+        vm_free(child);
+        vm_free(pgdir);
+        t[2] += timestamp() - s;
+    }
+
+    cprintf(
+        "check_uvm_range: 16 MiB exec %lld us, fork %lld us, exit %lld us\n",
+        t[0] * 1000000 / f / rounds, t[1] * 1000000 / f / rounds,
+        t[2] * 1000000 / f / rounds);
+    cprintf("check_uvm_range: passed.\n");
+}
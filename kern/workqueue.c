@@ -0,0 +1,120 @@
+/*
+ * Workqueues: lists of work run by kernel threads.
+ *
+ * A workqueue has a list and a worker thread, kept on its CPU, for
+ * each CPU. queue_work() puts work on the list of the CPU it runs on,
+ * which keeps the data the work touches in that CPU's caches, and
+ * wakes its worker, which runs the list in order, one item at a
+ * time. system_wq serves work that needs no queue of its own.
+ */
+
+#include "workqueue.h"
+
+#include <stddef.h>
+
+#include "console.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "string.h"
+#include "types.h"
+
+#define NWORKQUEUE 4  // Workqueues, each taking NCPU process slots
+
+struct pool {
+    struct spinlock lock;
+    struct work* head;
+    struct work** tail;  // Where the next work goes
+} __attribute__((aligned(64)));
+
+struct workqueue {
+    char* name;
+    struct pool pool[NCPU];
+};
+
+static struct workqueue workqueues[NWORKQUEUE];
+static struct spinlock wq_lock;
+static int nworkqueue;
+
+struct workqueue* system_wq;
+
+static void
+worker(void* arg)
+{
+    struct pool* pool = arg;
+    acquire(&pool->lock);
+    while (1) {
+        while (!pool->head) sleep(pool, &pool->lock);
+        struct work* w = pool->head;
+        if (!(pool->head = w->next)) pool->tail = &pool->head;
+        // Cleared first, so that work queued while it runs runs again.
+        __atomic_store_n(&w->pending, 0, __ATOMIC_RELEASE);
+        release(&pool->lock);
+        w->fn(w->arg);
+        acquire(&pool->lock);
+    }
+}
+
+/*
+ * Create a workqueue called name, with a worker on each CPU. Returns
+ * NULL if the table, the process table or memory is full.
+ */
+struct workqueue*
+workqueue_create(char* name)
+{
+    acquire(&wq_lock);
+    struct workqueue* wq =
+        nworkqueue < NWORKQUEUE ? &workqueues[nworkqueue++] : NULL;
+    release(&wq_lock);
+    if (!wq) return NULL;
+
+    wq->name = name;
+    for (int c = 0; c < NCPU; c++) {
+        struct pool* pool = &wq->pool[c];
+        initlock(&pool->lock, "workqueue");
+        pool->tail = &pool->head;
+
+        // Named like "events/2".
+        char n[16];
+        int len = MIN(strlen(name), (int)sizeof(n) - 3);
+        memmove(n, name, len);
+        n[len] = '/';
+        n[len + 1] = '0' + c;
+        n[len + 2] = '\0';
+        if (!kthread_create(worker, pool, c, n)) return NULL;
+    }
+    return wq;
+}
+
+/*
+ * Queue w on wq for cpu's worker, unless it is queued already.
+ * Returns 1 if it was queued, 0 if it was already. May be called
+ * from interrupt handlers and tasklets.
+ */
+int
+queue_work_on(int cpu, struct workqueue* wq, struct work* w)
+{
+    if (__atomic_exchange_n(&w->pending, 1, __ATOMIC_ACQ_REL)) return 0;
+    struct pool* pool = &wq->pool[cpu];
+    w->next = NULL;
+    acquire(&pool->lock);
+    *pool->tail = w;
+    pool->tail = &w->next;
+    release(&pool->lock);
+    wakeup(pool);
+    return 1;
+}
+
+int
+queue_work(struct workqueue* wq, struct work* w)
+{
+    return queue_work_on(cpuid(), wq, w);
+}
+
+void
+workqueue_init()
+{
+    initlock(&wq_lock, "wq_lock");
+    if (!(system_wq = workqueue_create("events")))
+        panic("\tworkqueue_init: cannot start workers.\n");
+    cprintf("workqueue_init: success.\n");
+}
@@ -0,0 +1,34 @@
+/*
+ * Helpers shared by the benchmarks in user/src. Define BENCH to the
+ * program's name, which fail() prints, before including this file.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef BENCH
+#error "define BENCH to the benchmark's name"
+#endif
+
+/* Return the monotonic time in microseconds. */
+static inline long
+now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Report that what failed and exit. */
+static inline void
+fail(char* what)
+{
+    printf(BENCH ": %s failed.\n", what);
+    exit(1);
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Large directory benchmark: create NFILES empty files in /dirbench,
+ * reporting every STEP files the time per create() and the time to
+ * look up a name that is not there, which always scans the directory.
+ * Then stat() every file, most of them past the directory entry cache.
+ * Build the image with FS_DIRHASH=1 to time hashed directories.
+ *
+ * A hashed directory gives a block to its index and may leave the last
+ * block of each of its DXNBUCKET chains almost empty, and neither kind
+ * grows past MAXFILE blocks; NFILES is the largest multiple of STEP
+ * that fits either way, 3000 with 14-byte names. There is no unlink,
+ * so a second run finds the files there and times create() of names
+ * that exist.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "dirbench"
+#include "bench.h"
+
+#include "../../../inc/fs.h"
+
+#define STEP   500  // Files created between reports
+#define NFILES (int)((MAXFILE - 1 - DXNBUCKET) * (DPB - 1) / STEP * STEP)
+#define MISSES 100  // Lookups of the missing name per report
+
+static char*
+name(int i)
+{
+    static char buf[32];
+    snprintf(buf, sizeof(buf), "/dirbench/f%d", i);
+    return buf;
+}
+
+/* Return the time of one lookup of a name not in the directory. */
+static long
+miss_us()
+{
+    struct stat st;
+    long t = now_us();
+    for (int i = 0; i < MISSES; i++)
+        if (stat("/dirbench/none", &st) == 0) fail("stat none");
+    return (now_us() - t) / MISSES;
+}
+
+int
+main()
+{
+    mkdir("/dirbench", 0755);
+    for (int n = 0; n < NFILES;) {
+        long t = now_us();
+        for (int end = n + STEP; n < end; n++) {
+            int fd = open(name(n), O_CREAT | O_RDWR, 0644);
+            if (fd < 0) fail("create");
+            close(fd);
+        }
+        t = now_us() - t;
+        printf(
+            "dirbench: %d entries: create %ld us, missing lookup %ld us\n",
+            n, t / STEP, miss_us());
+    }
+
+    struct stat st;
+    long t = now_us();
+    for (int i = 0; i < NFILES; i++)
+        if (stat(name(i), &st) < 0) fail("stat");
+    t = now_us() - t;
+    printf("dirbench: %d entries: lookup %ld us\n", NFILES, t / NFILES);
+    exit(0);
+}
@@ -0,0 +1,125 @@
+/*
+ * Futex benchmark: threads take turns on one lock to bump a shared
+ * counter, with a lock that sleeps in futex() when it is taken and
+ * one that calls sched_yield() until it is free, and with musl's
+ * pthread_mutex_t, which is built on futex() too. Reports lock
+ * acquisitions per second for 1 to 4 threads.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "futexbench"
+#include "bench.h"
+
+#define ROUNDS   20000  // Acquisitions per thread
+#define WORK     50     // Loop iterations in the critical section
+#define NTHREADS 4      // Most threads run at once
+
+#define FUTEX_WAIT_PRIVATE 128
+#define FUTEX_WAKE_PRIVATE 129
+
+enum { YIELD, FUTEX, PTHREAD };
+
+static char* names[] = {"yield", "futex", "pthread"};
+static int how;
+static int lock;  // 0 free, 1 taken, 2 taken with waiters for FUTEX
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile long counter;
+
+static int
+cas(int* p, int old, int new)
+{
+    __atomic_compare_exchange_n(
+        p, &old, new, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return old;
+}
+
+/* The mutex of Drepper's "Futexes Are Tricky", in three states. */
+static void
+futex_lock()
+{
+    int c = cas(&lock, 0, 1);
+    if (!c) return;
+    if (c != 2) c = __atomic_exchange_n(&lock, 2, __ATOMIC_ACQUIRE);
+    while (c) {
+        syscall(SYS_futex, &lock, FUTEX_WAIT_PRIVATE, 2, NULL);
+        c = __atomic_exchange_n(&lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void
+futex_unlock()
+{
+    if (__atomic_exchange_n(&lock, 0, __ATOMIC_RELEASE) == 2)
+        syscall(SYS_futex, &lock, FUTEX_WAKE_PRIVATE, 1);
+}
+
+static void
+yield_lock()
+{
+    while (__atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+static void
+yield_unlock()
+{
+    __atomic_store_n(&lock, 0, __ATOMIC_RELEASE);
+}
+
+static void*
+work(void* arg)
+{
+    for (int i = 0; i < ROUNDS; i++) {
+        switch (how) {
+        case YIELD: yield_lock(); break;
+        case FUTEX: futex_lock(); break;
+        default: pthread_mutex_lock(&mutex); break;
+        }
+        for (int j = 0; j < WORK; j++) counter++;
+        switch (how) {
+        case YIELD: yield_unlock(); break;
+        case FUTEX: futex_unlock(); break;
+        default: pthread_mutex_unlock(&mutex); break;
+        }
+    }
+    return NULL;
+}
+
+/* Run n threads, the caller being the first, and return the time. */
+static long
+run(int n)
+{
+    pthread_t tid[NTHREADS];
+    counter = 0;
+
+    long t = now_us();
+    for (int i = 1; i < n; i++)
+        if (pthread_create(&tid[i], NULL, work, NULL)) fail("create");
+    work(NULL);
+    for (int i = 1; i < n; i++)
+        if (pthread_join(tid[i], NULL)) fail("join");
+    t = now_us() - t;
+
+    if (counter != (long)n * ROUNDS * WORK) fail("count");
+    return t ? t : 1;
+}
+
+int
+main()
+{
+    for (how = YIELD; how <= PTHREAD; how++) {
+        for (int n = 1; n <= NTHREADS; n++) {
+            long t = run(n);
+            printf(
+                "futexbench: %s, %d threads: %ld locks/ms\n", names[how], n,
+                (long)n * ROUNDS * 1000 / t);
+        }
+    }
+    exit(0);
+}
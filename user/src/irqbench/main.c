@@ -0,0 +1,141 @@
+/*
+ * Interrupt benchmark: with the GPU interrupts routed to CPU 0, and
+ * then following the idle CPUs, run a disk load, a process rewriting
+ * a file with pwrite(), beside a console load, a process printing
+ * lines, and report the interrupts taken per second, how late the
+ * timer interrupts were handled and how long tasklets waited, from
+ * device /irq_stat, which it then prints whole.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "irqbench"
+#include "bench.h"
+
+#define DEV    "/irq_stat"
+#define MAJOR  3  // IRQSTAT_MAJOR in inc/trap.h
+#define NAME   "/irqbench.dat"
+#define CHUNK  4096  // Bytes per write
+#define NCHUNK 16    // Chunks in the file
+#define ROUNDS 32    // Times the disk load rewrites the file
+#define LINES  2000  // Lines the console load prints
+#define NCPU   4
+
+char buf[4096];
+
+static int
+open_dev(int mode)
+{
+    int fd = open(DEV, mode);
+    if (fd < 0 && mknod(DEV, S_IFCHR, MAJOR) == 0) fd = open(DEV, mode);
+    if (fd < 0) fail("open " DEV);
+    return fd;
+}
+
+static void
+control(char* cmd)
+{
+    int fd = open_dev(O_WRONLY);
+    if (write(fd, cmd, strlen(cmd)) != strlen(cmd)) fail(cmd);
+    close(fd);
+}
+
+static void
+disk()
+{
+    int fd = open(NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) fail("open " NAME);
+    memset(buf, 'x', CHUNK);
+    for (int i = 0; i < ROUNDS; i++)
+        for (int j = 0; j < NCHUNK; j++)
+            if (pwrite(fd, buf, CHUNK, (off_t)j * CHUNK) != CHUNK)
+                fail("pwrite");
+    close(fd);
+}
+
+static void
+console()
+{
+    for (int i = 0; i < LINES; i++)
+        printf("irqbench: console load line %d of %d\n", i, LINES);
+}
+
+static void
+spawn(void (*load)())
+{
+    int pid = fork();
+    if (pid < 0) fail("fork");
+    if (pid == 0) {
+        load();
+        exit(0);
+    }
+}
+
+/*
+ * Run the loads with the GPU interrupts routed by route, and print
+ * what the CPUs took.
+ */
+static void
+run(char* route)
+{
+    control(route);
+    control("clear");
+    long t = now_us();
+    spawn(disk);
+    spawn(console);
+    while (wait(NULL) > 0) {
+    }
+    t = now_us() - t;
+
+    int fd = open_dev(O_RDONLY);
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) fail("read " DEV);
+    buf[n] = '\0';
+
+    // Add up the counts, under the first header, and take the worst
+    // CPU's times, in microseconds, under the second.
+    long total = 0, late = 0, maxlate = 0, delay = 0, maxdelay = 0;
+    char* p = strstr(buf, "\ncpu");
+    for (int c = 0; c < NCPU && p && (p = strchr(p + 1, '\n')); c++) {
+        long v[7];
+        if (sscanf(p + 1, "%ld %ld %ld %ld %ld %ld %ld", &v[0], &v[1], &v[2],
+                   &v[3], &v[4], &v[5], &v[6]) != 7)
+            fail("parse");
+        for (int i = 1; i < 7; i++) total += v[i];
+    }
+    p = p ? strstr(p, "\ncpu") : NULL;
+    for (int c = 0; c < NCPU && p && (p = strchr(p + 1, '\n')); c++) {
+        long v[6];
+        if (sscanf(p + 1, "%ld %ld %ld %ld %ld %ld", &v[0], &v[1], &v[2],
+                   &v[3], &v[4], &v[5]) != 6)
+            fail("parse");
+        late = v[1] > late ? v[1] : late;
+        maxlate = v[2] > maxlate ? v[2] : maxlate;
+        delay = v[4] > delay ? v[4] : delay;
+        maxdelay = v[5] > maxdelay ? v[5] : maxdelay;
+    }
+
+    printf(
+        "irqbench: %s: %ld interrupts/s, timer late %ld us (max %ld), "
+        "tasklets %ld us (max %ld)\n",
+        route, total * 1000000 / (t ? t : 1), late, maxlate, delay,
+        maxdelay);
+    printf("%s", buf);
+}
+
+int
+main()
+{
+    run("gpu 0");
+    run("gpu idle");
+    exit(0);
+}
@@ -0,0 +1,76 @@
+/*
+ * lockstat: print the kernel's lock contention statistics, most
+ * contended first, with times in counter ticks. With -r, clear them;
+ * with a command, clear them, run it and print what it caused.
+ * Needs a kernel built with `make LOCKSTAT=1`.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DEV   "/lock_stat"
+#define MAJOR 2  // LOCKSTAT_MAJOR in inc/lockstat.h
+
+char buf[4096];
+
+static int
+open_dev(int mode)
+{
+    int fd = open(DEV, mode);
+    if (fd < 0 && mknod(DEV, S_IFCHR, MAJOR) == 0) fd = open(DEV, mode);
+    if (fd < 0) {
+        printf("lockstat: cannot open %s.\n", DEV);
+        _exit(1);
+    }
+    return fd;
+}
+
+static void
+clear()
+{
+    int fd = open_dev(O_WRONLY);
+    if (write(fd, "", 1) != 1) {
+        printf("lockstat: not counting, build with LOCKSTAT=1.\n");
+        _exit(1);
+    }
+    close(fd);
+}
+
+static void
+print()
+{
+    int fd = open_dev(O_RDONLY);
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) write(1, buf, n);
+    if (n < 0) printf("lockstat: not counting, build with LOCKSTAT=1.\n");
+    close(fd);
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "-r")) {
+        clear();
+        _exit(0);
+    }
+    if (argc > 1) {
+        clear();
+        int pid = fork();
+        if (pid < 0) {
+            printf("lockstat: fork failed.\n");
+            _exit(1);
+        }
+        if (pid == 0) {
+            execv(argv[1], argv + 1);
+            printf("lockstat: exec %s failed.\n", argv[1]);
+            _exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    print();
+    _exit(0);
+}
@@ -0,0 +1,55 @@
+/*
+ * Directory lookup benchmark: fill directories of 10, 100 and 1000
+ * entries under /lookupbench and time stat() of a name missing from
+ * each. The directory entry cache only holds names that exist, so
+ * every such lookup makes dirlookup() scan the whole directory, or
+ * one bucket of it if it is hashed. The files are kept for later runs.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "lookupbench"
+#include "bench.h"
+
+#define ROUNDS 1000  // Lookups per directory
+
+static int sizes[] = {10, 100, 1000};
+
+static void
+run(int n)
+{
+    char path[64];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "/lookupbench/d%d", n);
+    mkdir(path, 0755);
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "/lookupbench/d%d/f%d", n, i);
+        int fd = open(path, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) fail("create");
+        close(fd);
+    }
+
+    snprintf(path, sizeof(path), "/lookupbench/d%d/none", n);
+    long t = now_us();
+    for (int i = 0; i < ROUNDS; i++)
+        if (stat(path, &st) == 0) fail("stat none");
+    t = now_us() - t;
+    printf(
+        "lookupbench: %d entries: %ld ns per lookup\n", n,
+        t * 1000 / ROUNDS);
+}
+
+int
+main()
+{
+    mkdir("/lookupbench", 0755);
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        run(sizes[i]);
+    exit(0);
+}
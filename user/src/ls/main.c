@@ -1,12 +1,23 @@
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "../../../inc/fs.h"
 
+// Record returned by getdents64(2).
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
 char*
 fmtname(char* path)
 {
@@ -27,9 +38,9 @@ void
 ls(char* path)
 {
     char buf[512], *p;
-    int fd;
-    struct dirent de;
+    int fd, n;
     struct stat st;
+    static char dents[4096];
 
     if ((fd = open(path, O_RDONLY)) < 0) {
         fprintf(stderr, "ls: cannot open %s\n", path);
@@ -53,17 +64,20 @@ ls(char* path)
             strcpy(buf, path);
             p = buf + strlen(buf);
             *p++ = '/';
-            while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-                if (de.inum == 0) continue;
-                memmove(p, de.name, DIRSIZ);
-                p[DIRSIZ] = 0;
-                if (stat(buf, &st) < 0) {
-                    fprintf(stderr, "ls: cannot stat %s\n", buf);
-                    continue;
+            while ((n = syscall(SYS_getdents64, fd, dents, sizeof(dents)))
+                   > 0) {
+                for (int off = 0; off < n;) {
+                    struct linux_dirent64* de = (void*)(dents + off);
+                    off += de->d_reclen;
+                    strcpy(p, de->d_name);
+                    if (stat(buf, &st) < 0) {
+                        fprintf(stderr, "ls: cannot stat %s\n", buf);
+                        continue;
+                    }
+                    printf(
+                        "%s %x %ld %ld\n", fmtname(buf), st.st_mode,
+                        st.st_ino, st.st_size);
                 }
-                printf(
-                    "%s %x %ld %ld\n", fmtname(buf), st.st_mode, st.st_ino,
-                    st.st_size);
             }
         }
     }
@@ -25,7 +25,7 @@ typedef uint32_t uint;
         } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 5000  // Room for the directory benchmarks
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
@@ -41,6 +41,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+int dirhash;  // Build hashed directories (-H)
 
 void balloc(int);
 void wsect(uint, void*);
@@ -49,6 +50,9 @@ void rinode(uint inum, struct dinode* ip);
 void rsect(uint sec, void* buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void* p, int n);
+void dxinit(uint inum);
+void dxappend(uint inum, struct dirent* de);
+void dappend(uint inum, struct dirent* de);
 
 // convert to little-endian byte order
 ushort
@@ -84,8 +88,13 @@ main(int argc, char* argv[])
 
     static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+    if (argc > 1 && !strcmp(argv[1], "-H")) {
+        dirhash = 1;
+        argc--;
+        argv++;
+    }
     if (argc < 2) {
-        fprintf(stderr, "Usage: mkfs fs.img files...\n");
+        fprintf(stderr, "Usage: mkfs [-H] fs.img files...\n");
         exit(1);
     }
 
@@ -109,6 +118,7 @@ main(int argc, char* argv[])
     sb.logstart = xint(2);
     sb.inodestart = xint(2 + nlog);
     sb.bmapstart = xint(2 + nlog + ninodeblocks);
+    sb.features = xint((dirhash ? FEAT_DIRHASH : 0) | FEAT_DIRSIZ);
 
     printf(
         "nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
@@ -124,16 +134,17 @@ main(int argc, char* argv[])
 
     rootino = ialloc(T_DIR);
     assert(rootino == ROOTINO);
+    if (dirhash) dxinit(rootino);
 
     bzero(&de, sizeof(de));
     de.inum = xshort(rootino);
     strcpy(de.name, ".");
-    iappend(rootino, &de, sizeof(de));
+    dappend(rootino, &de);
 
     bzero(&de, sizeof(de));
     de.inum = xshort(rootino);
     strcpy(de.name, "..");
-    iappend(rootino, &de, sizeof(de));
+    dappend(rootino, &de);
 
     for (i = 2; i < argc; i++) {
         char* path = argv[i];
@@ -163,19 +174,21 @@ main(int argc, char* argv[])
         bzero(&de, sizeof(de));
         de.inum = xshort(inum);
         strncpy(de.name, argv[i], DIRSIZ);
-        iappend(rootino, &de, sizeof(de));
+        dappend(rootino, &de);
 
         while ((cc = read(fd, buf, sizeof(buf))) > 0) iappend(inum, buf, cc);
 
         close(fd);
     }
 
-    // fix size of root inode dir
-    rinode(rootino, &din);
-    off = xint(din.size);
-    off = ((off / BSIZE) + 1) * BSIZE;
-    din.size = xint(off);
-    winode(rootino, &din);
+    // fix size of root inode dir, hashed ones are always whole blocks
+    if (!dirhash) {
+        rinode(rootino, &din);
+        off = xint(din.size);
+        off = ((off / BSIZE) + 1) * BSIZE;
+        din.size = xint(off);
+        winode(rootino, &din);
+    }
 
     balloc(freeblock);
 
@@ -308,3 +321,85 @@ iappend(uint inum, void* xp, int n)
     din.size = xint(off);
     winode(inum, &din);
 }
+
+// Return the sector holding the already allocated block fbn of inum.
+uint
+fbmap(uint inum, uint fbn)
+{
+    struct dinode din;
+    uint indirect[NINDIRECT];
+
+    rinode(inum, &din);
+    assert(fbn < MAXFILE);
+    if (fbn < NDIRECT) return xint(din.addrs[fbn]);
+    rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+    return xint(indirect[fbn - NDIRECT]);
+}
+
+// Make the empty directory inum hashed, see inc/fs.h.
+void
+dxinit(uint inum)
+{
+    struct dxslot s[DPB];
+    struct dinode din;
+
+    bzero(s, sizeof(s));
+    s[0].ent[0] = xshort(DXMAGIC);
+    s[0].ent[1] = xshort(DXNBUCKET);
+    iappend(inum, s, sizeof(s));
+
+    rinode(inum, &din);
+    din.major = xshort(DIR_HASHED);
+    winode(inum, &din);
+}
+
+// Insert de into the bucket chain of the hashed directory inum.
+void
+dxappend(uint inum, struct dirent* de)
+{
+    struct dxslot root[DPB], blk[DPB];
+    struct dinode din;
+    uint h = dxhash(de->name), bn, last = 0, nb;
+    ushort* head;
+
+    rsect(fbmap(inum, 0), root);
+    head = &root[1 + h / DXSLOTN].ent[h % DXSLOTN];
+    for (bn = xshort(*head); bn; bn = xshort(blk[0].ent[0])) {
+        rsect(fbmap(inum, bn), blk);
+        for (int i = 1; i < DPB; i++) {
+            if (((struct dirent*)blk)[i].inum == 0) {
+                ((struct dirent*)blk)[i] = *de;
+                wsect(fbmap(inum, bn), blk);
+                return;
+            }
+        }
+        last = bn;
+    }
+
+    // Bucket is full, chain a new block at the end of the directory.
+    rinode(inum, &din);
+    nb = xint(din.size) / BSIZE;
+    bzero(blk, sizeof(blk));
+    blk[0].ent[1] = xshort(h);
+    ((struct dirent*)blk)[1] = *de;
+    iappend(inum, blk, sizeof(blk));
+
+    if (last) {
+        rsect(fbmap(inum, last), blk);
+        blk[0].ent[0] = xshort(nb);
+        wsect(fbmap(inum, last), blk);
+    } else {
+        *head = xshort(nb);
+        wsect(fbmap(inum, 0), root);
+    }
+}
+
+// Append a directory entry to inum in whichever format it uses.
+void
+dappend(uint inum, struct dirent* de)
+{
+    if (dirhash)
+        dxappend(inum, de);
+    else
+        iappend(inum, de, sizeof(*de));
+}
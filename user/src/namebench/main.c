@@ -0,0 +1,67 @@
+/*
+ * Path lookup benchmark: 1 to 4 processes stat() the same file, the
+ * last of DEPTH path elements starting at /namebench, over and over,
+ * and the time per lookup is reported. The first stat() walks the
+ * path with the inode locks and fills the directory entry cache;
+ * the rest should find every element there.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "namebench"
+#include "bench.h"
+
+#define DEPTH  10    // Elements in the path, the file included
+#define ROUNDS 5000  // Lookups per process
+#define NPROC  4     // Most processes run at once
+
+char path[64] = "/namebench";
+
+/* Look the path up with n processes and return the time. */
+static long
+run(int n)
+{
+    long t = now_us();
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) fail("fork");
+        if (pid == 0) {
+            struct stat st;
+            for (int j = 0; j < ROUNDS; j++)
+                if (stat(path, &st) < 0) fail("stat");
+            exit(0);
+        }
+    }
+    for (int i = 0; i < n; i++) wait(NULL);
+    t = now_us() - t;
+    return t ? t : 1;
+}
+
+int
+main()
+{
+    // Make /namebench/a/b/c/.../x, or find it there from a last run.
+    for (int i = 0; i < DEPTH - 1; i++) {
+        if (i) strcat(path, (char[]){'/', 'a' + i - 1, 0});
+        mkdir(path, 0755);
+    }
+    strcat(path, "/x");
+    int fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) fail("create");
+    close(fd);
+
+    for (int n = 1; n <= NPROC; n++) {
+        long t = run(n);
+        printf(
+            "namebench: %d processes, %d elements: %ld ns per lookup\n", n,
+            DEPTH, t * 1000 / ROUNDS);
+    }
+    exit(0);
+}
@@ -0,0 +1,83 @@
+/*
+ * Pipe benchmark: throughput from a child to its parent with the
+ * default ring and a 64 KiB one, and the round-trip latency of a byte
+ * bounced between two processes over two pipes. The scheduler picks
+ * the cores; with nothing else running the two sides run on two.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "pipebench"
+#include "bench.h"
+
+#define TOTAL  (16 << 20)  // Bytes through the pipe per run
+#define ROUNDS 1000        // Round trips timed
+
+char buf[65536];
+
+static void
+throughput(int size, int chunk)
+{
+    int p[2];
+    if (pipe(p) < 0) fail("pipe");
+    if (size && fcntl(p[1], F_SETPIPE_SZ, size) < 0) fail("F_SETPIPE_SZ");
+    size = fcntl(p[1], F_GETPIPE_SZ);
+
+    long t = now_us();
+    if (fork() == 0) {
+        close(p[0]);
+        for (int n = 0; n < TOTAL; n += chunk)
+            if (write(p[1], buf, chunk) != chunk) fail("write");
+        exit(0);
+    }
+    close(p[1]);
+    long got = 0;
+    for (int n; (n = read(p[0], buf, sizeof(buf))) > 0;) got += n;
+    close(p[0]);
+    wait(NULL);
+    t = now_us() - t;
+
+    if (got != TOTAL) fail("read");
+    printf(
+        "pipebench: %d B ring, %d B writes: %ld MB/s\n", size, chunk,
+        got / (t ? t : 1));
+}
+
+static void
+latency()
+{
+    int a[2], b[2];
+    char c = 0;
+    if (pipe(a) < 0 || pipe(b) < 0) fail("pipe");
+    if (fork() == 0) {
+        for (int i = 0; i < ROUNDS; i++)
+            if (read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+                fail("echo");
+        exit(0);
+    }
+
+    long t = now_us();
+    for (int i = 0; i < ROUNDS; i++)
+        if (write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1) fail("ping");
+    t = now_us() - t;
+    wait(NULL);
+    printf(
+        "pipebench: round trip %ld.%02ld us\n", t / ROUNDS,
+        t * 100 / ROUNDS % 100);
+}
+
+int
+main()
+{
+    throughput(0, 4096);
+    throughput(65536, 4096);
+    throughput(65536, 65536);
+    latency();
+    exit(0);
+}
@@ -0,0 +1,73 @@
+/*
+ * Read benchmark: 1 to 4 processes read the same file over and over
+ * with pread(), which the kernel serves from the page cache with the
+ * inode locked shared, and the total throughput is reported.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "readbench"
+#include "bench.h"
+
+#define FILESZ (64 << 10)  // Bytes in the file
+#define CHUNK  4096        // Bytes per call
+#define ROUNDS 64          // Times each process reads the file
+#define NPROC  4           // Most processes run at once
+#define NAME   "/readbench.dat"
+
+char buf[CHUNK];
+
+static void
+work(int fd)
+{
+    for (int i = 0; i < ROUNDS; i++)
+        for (long off = 0; off < FILESZ; off += CHUNK)
+            if (pread(fd, buf, CHUNK, off) != CHUNK) fail("pread");
+}
+
+/* Read with n processes, sharing one descriptor, and return the time. */
+static long
+run(int n)
+{
+    int fd = open(NAME, O_RDONLY);
+    if (fd < 0) fail("open");
+
+    long t = now_us();
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) fail("fork");
+        if (pid == 0) {
+            work(fd);
+            exit(0);
+        }
+    }
+    for (int i = 0; i < n; i++) wait(NULL);
+    t = now_us() - t;
+    close(fd);
+    return t ? t : 1;
+}
+
+int
+main()
+{
+    int fd = open(NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) fail("create");
+    for (int i = 0; i < CHUNK; i++) buf[i] = i;
+    for (long off = 0; off < FILESZ; off += CHUNK)
+        if (pwrite(fd, buf, CHUNK, off) != CHUNK) fail("write");
+    close(fd);
+
+    for (int n = 1; n <= NPROC; n++) {
+        long t = run(n);
+        printf(
+            "readbench: %d processes: %ld MB/s\n", n,
+            (long)n * ROUNDS * FILESZ / t);
+    }
+    exit(0);
+}
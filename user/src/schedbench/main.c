@@ -0,0 +1,150 @@
+/*
+ * Scheduler benchmark: for each of several time slices, set through
+ * device /irq_stat, keep every CPU busy with NHOGS spinning threads,
+ * and meanwhile measure the context switch latency, as half a round
+ * trip of a byte between two threads over pipes, and the interactive
+ * response, as how far past its deadline a nanosleep() of SLEEP_US
+ * returns. Restores the time slice it found.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "schedbench"
+#include "bench.h"
+
+#define DEV      "/irq_stat"
+#define MAJOR    3     // IRQSTAT_MAJOR in inc/trap.h
+#define NHOGS    8     // Spinning threads, twice the CPUs
+#define ROUNDS   100   // Round trips over the pipes
+#define SLEEPS   50    // Sleeps timed
+#define SLEEP_US 2000  // Length of each sleep
+
+static long quanta[] = {1000, 5000, 10000, 50000};
+static volatile int stop;
+static int ping[2], pong[2];
+
+static int
+open_dev(int mode)
+{
+    int fd = open(DEV, mode);
+    if (fd < 0 && mknod(DEV, S_IFCHR, MAJOR) == 0) fd = open(DEV, mode);
+    if (fd < 0) fail("open " DEV);
+    return fd;
+}
+
+/* Return the time slice, from the first line of the device. */
+static long
+get_quantum()
+{
+    char buf[256];
+    int fd = open_dev(O_RDONLY);
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) fail("read " DEV);
+    buf[n] = '\0';
+    char* p = strstr(buf, "quantum ");
+    if (!p) fail("parse");
+    return atol(p + 8);
+}
+
+static void
+set_quantum(long us)
+{
+    char cmd[32];
+    int n = snprintf(cmd, sizeof(cmd), "quantum %ld", us);
+    int fd = open_dev(O_WRONLY);
+    if (write(fd, cmd, n) != n) fail(cmd);
+    close(fd);
+}
+
+static void*
+hog(void* arg)
+{
+    while (!stop) {
+    }
+    return NULL;
+}
+
+/* Send back every byte received. */
+static void*
+echo(void* arg)
+{
+    char c;
+    for (int i = 0; i < ROUNDS; i++) {
+        if (read(ping[0], &c, 1) != 1) fail("read");
+        if (write(pong[1], &c, 1) != 1) fail("write");
+    }
+    return NULL;
+}
+
+/* Return the average time of half a round trip. */
+static long
+switch_us()
+{
+    pthread_t tid;
+    char c = 'x';
+    if (pthread_create(&tid, NULL, echo, NULL)) fail("create");
+    long t = now_us();
+    for (int i = 0; i < ROUNDS; i++) {
+        if (write(ping[1], &c, 1) != 1) fail("write");
+        if (read(pong[0], &c, 1) != 1) fail("read");
+    }
+    t = now_us() - t;
+    if (pthread_join(tid, NULL)) fail("join");
+    return t / ROUNDS / 2;
+}
+
+/* Return the average oversleep, and the worst in *max. */
+static long
+oversleep_us(long* max)
+{
+    struct timespec ts = {0, SLEEP_US * 1000};
+    long total = 0;
+    *max = 0;
+    for (int i = 0; i < SLEEPS; i++) {
+        long t = now_us();
+        if (nanosleep(&ts, NULL)) fail("nanosleep");
+        t = now_us() - t - SLEEP_US;
+        total += t;
+        *max = t > *max ? t : *max;
+    }
+    return total / SLEEPS;
+}
+
+static void
+run(long quantum)
+{
+    pthread_t tid[NHOGS];
+    set_quantum(quantum);
+    stop = 0;
+    for (int i = 0; i < NHOGS; i++)
+        if (pthread_create(&tid[i], NULL, hog, NULL)) fail("create");
+
+    long max, lat = switch_us(), over = oversleep_us(&max);
+    stop = 1;
+    for (int i = 0; i < NHOGS; i++)
+        if (pthread_join(tid[i], NULL)) fail("join");
+
+    printf(
+        "schedbench: quantum %ld us: switch %ld us, oversleep %ld us "
+        "(max %ld)\n",
+        quantum, lat, over, max);
+}
+
+int
+main()
+{
+    if (pipe(ping) < 0 || pipe(pong) < 0) fail("pipe");
+    long saved = get_quantum();
+    for (int i = 0; i < sizeof(quanta) / sizeof(quanta[0]); i++)
+        run(quanta[i]);
+    set_quantum(saved);
+    exit(0);
+}
@@ -1,6 +1,7 @@
 // Shell
 
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -52,22 +53,28 @@ struct backcmd {
     struct cmd* cmd;
 };
 
+char whitespace[] = " \t\r\n\v";
+char symbols[] = "<|>&;()";
+
 int fork1(void);  // Fork but panics on failure.
+int spawncmd(char*);
 void panic(char*);
 struct cmd* parsecmd(char*);
 
+extern char** environ;
+
+#define MAXN 10000
+static char mem[MAXN];
+static size_t nmem;  // Bytes of mem in use, reset for each command
+
 void*
 malloc1(size_t sz)
 {
-#define MAXN 10000
-    static char mem[MAXN];
-    static size_t i;
-    if ((i += sz) > MAXN) {
+    if ((nmem += sz) > MAXN) {
         fprintf(stderr, "malloc1: memory used out\n");
         exit(1);
     }
-    return &mem[i - sz];
-#undef MAXN
+    return &mem[nmem - sz];
 }
 
 // Execute cmd.  Never returns.
@@ -174,11 +181,44 @@ main()
             if (chdir(buf + 3) < 0) fprintf(stderr, "cannot cd %s\n", buf + 3);
             continue;
         }
-        if (fork1() == 0) runcmd(parsecmd(buf));
-        wait(NULL);
+        nmem = 0;
+        if (spawncmd(buf) < 0) {
+            if (fork1() == 0) runcmd(parsecmd(buf));
+            wait(NULL);
+        }
     }
 }
 
+// Run buf if it is a plain command, just words, with posix_spawn(),
+// which lends the child our memory until it has exec()ed rather than
+// copy it, and wait for it. Anything else is up to runcmd() in a
+// forked copy of the shell. Returns -1 if buf wasn't run.
+int
+spawncmd(char* buf)
+{
+    int words = 0;
+    for (char* s = buf; *s;) {
+        if (strchr(symbols, *s)) return -1;
+        if (strchr(whitespace, *s)) {
+            s++;
+            continue;
+        }
+        words++;
+        while (*s && !strchr(whitespace, *s) && !strchr(symbols, *s)) s++;
+    }
+    if (!words || words >= MAXARGS) return -1;
+
+    struct execcmd* ecmd = (struct execcmd*)parsecmd(buf);
+    pid_t pid;
+    int err = posix_spawn(&pid, ecmd->argv[0], NULL, NULL, ecmd->argv, environ);
+    if (err) {
+        fprintf(stderr, "exec %s failed\n", ecmd->argv[0]);
+        return 0;
+    }
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
 void
 panic(char* s)
 {
@@ -265,8 +305,6 @@ backcmd(struct cmd* subcmd)
 
 // Parsing
 
-char whitespace[] = " \t\r\n\v";
-char symbols[] = "<|>&;()";
 
 int
 gettoken(char** ps, char* es, char** q, char** eq)
@@ -0,0 +1,54 @@
+/*
+ * Shell benchmark: commands per second for a script of trivial
+ * commands, run by sh as plain commands, which it starts with
+ * posix_spawn(), and in parentheses, which it runs in a forked copy
+ * of itself as before.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "shbench"
+#include "bench.h"
+
+#define NCMD   200  // Commands per script
+#define SCRIPT "/shbench.sh"
+
+static void
+run(char* name, char* line)
+{
+    int fd = open(SCRIPT, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) fail("create");
+    for (int i = 0; i < NCMD; i++)
+        if (write(fd, line, strlen(line)) != strlen(line)) fail("write");
+    close(fd);
+
+    long t = now_us();
+    int pid = fork();
+    if (pid < 0) fail("fork");
+    if (pid == 0) {
+        close(0);
+        if (open(SCRIPT, O_RDONLY) != 0) fail("open");
+        execl("sh", "sh", NULL);
+        fail("exec");
+    }
+    waitpid(pid, NULL, 0);
+    t = now_us() - t;
+    printf(
+        "\nshbench: %s: %ld commands/s\n", name,
+        NCMD * 1000000L / (t ? t : 1));
+}
+
+int
+main()
+{
+    // Same length lines, so that one script overwrites the other.
+    run("posix_spawn", "true  \n");
+    run("fork", "(true)\n");
+    exit(0);
+}
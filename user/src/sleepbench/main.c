@@ -0,0 +1,61 @@
+/*
+ * Sleeplock benchmark: threads open the root directory and read its
+ * first entries over and over, so that they all take the lock of the
+ * same inode and of the same buffer cache block, which is always a
+ * hit. Reports reads per millisecond for 1 to 4 threads.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "sleepbench"
+#include "bench.h"
+
+#define ROUNDS   2000  // Reads per thread
+#define NTHREADS 4     // Most threads run at once
+
+static void*
+work(void* arg)
+{
+    char buf[256];
+    for (int i = 0; i < ROUNDS; i++) {
+        int fd = open("/", O_RDONLY);
+        if (fd < 0) fail("open");
+        if (syscall(SYS_getdents64, fd, buf, sizeof(buf)) <= 0)
+            fail("getdents64");
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Run n threads, the caller being the first, and return the time. */
+static long
+run(int n)
+{
+    pthread_t tid[NTHREADS];
+    long t = now_us();
+    for (int i = 1; i < n; i++)
+        if (pthread_create(&tid[i], NULL, work, NULL)) fail("create");
+    work(NULL);
+    for (int i = 1; i < n; i++)
+        if (pthread_join(tid[i], NULL)) fail("join");
+    t = now_us() - t;
+    return t ? t : 1;
+}
+
+int
+main()
+{
+    for (int n = 1; n <= NTHREADS; n++) {
+        long t = run(n);
+        printf(
+            "sleepbench: %d threads: %ld reads/ms\n", n,
+            (long)n * ROUNDS * 1000 / t);
+    }
+    exit(0);
+}
@@ -0,0 +1,126 @@
+/*
+ * Splice benchmark: a child pushes a file through a pipe to its
+ * parent, which reads and drops it, with read() and write(), with
+ * splice() and with sendfile(). Then the file is copied to another
+ * through the pipe with splice() at both ends, and the copy checked.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "splicebench"
+#include "bench.h"
+
+#define FILESZ (64 << 10)  // Bytes in the file, about the largest there is
+#define ROUNDS 256         // Times the file goes through the pipe
+#define IN     "/splicebench.in"
+#define OUT    "/splicebench.out"
+
+enum { READ_WRITE, SPLICE, SENDFILE };
+
+char buf[FILESZ];
+
+static char
+pattern(int i)
+{
+    return i * 7 + i / 4096;
+}
+
+/* Push the whole file into the pipe the given way. */
+static void
+push(int fd, int out, int how)
+{
+    for (long n = 0, r; n < FILESZ; n += r) {
+        switch (how) {
+        case READ_WRITE:
+            if ((r = read(fd, buf, FILESZ - n)) > 0 && write(out, buf, r) != r)
+                r = -1;
+            break;
+        case SPLICE: r = splice(fd, NULL, out, NULL, FILESZ - n, 0); break;
+        default: r = sendfile(out, fd, NULL, FILESZ - n); break;
+        }
+        if (r <= 0) fail("push");
+    }
+}
+
+static void
+throughput(char* name, int how)
+{
+    int p[2];
+    if (pipe(p) < 0 || fcntl(p[1], F_SETPIPE_SZ, 65536) < 0) fail("pipe");
+
+    long t = now_us();
+    if (fork() == 0) {
+        close(p[0]);
+        for (int i = 0; i < ROUNDS; i++) {
+            int fd = open(IN, O_RDONLY);
+            if (fd < 0) fail("open");
+            push(fd, p[1], how);
+            close(fd);
+        }
+        exit(0);
+    }
+    close(p[1]);
+    long got = 0;
+    for (int n; (n = read(p[0], buf, sizeof(buf))) > 0;) got += n;
+    close(p[0]);
+    wait(NULL);
+    t = now_us() - t;
+
+    if (got != (long)FILESZ * ROUNDS) fail("read");
+    printf("splicebench: %s: %ld MB/s\n", name, got / (t ? t : 1));
+}
+
+/* Copy IN to OUT through a pipe with splice() and check the copy. */
+static void
+copy()
+{
+    int p[2], in, out;
+    if (pipe(p) < 0 || fcntl(p[1], F_SETPIPE_SZ, 65536) < 0) fail("pipe");
+    if ((in = open(IN, O_RDONLY)) < 0) fail("open");
+    if ((out = open(OUT, O_CREAT | O_RDWR, 0644)) < 0) fail("create");
+
+    long t = now_us();
+    for (long n = 0, r; n < FILESZ; n += r) {
+        if ((r = splice(in, NULL, p[1], NULL, FILESZ - n, 0)) <= 0
+            || splice(p[0], NULL, out, NULL, r, 0) != r)
+            fail("copy");
+    }
+    t = now_us() - t;
+    close(in);
+    close(out);
+    close(p[0]);
+    close(p[1]);
+
+    if ((out = open(OUT, O_RDONLY)) < 0) fail("open");
+    memset(buf, 0, sizeof(buf));
+    for (long n = 0, r; n < FILESZ; n += r)
+        if ((r = read(out, buf + n, FILESZ - n)) <= 0) fail("read back");
+    close(out);
+    for (int i = 0; i < FILESZ; i++)
+        if (buf[i] != pattern(i)) fail("compare");
+    printf("splicebench: file to file: %ld us\n", t);
+}
+
+int
+main()
+{
+    int fd = open(IN, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) fail("create");
+    for (int i = 0; i < FILESZ; i++) buf[i] = pattern(i);
+    if (write(fd, buf, FILESZ) != FILESZ) fail("write");
+    close(fd);
+
+    throughput("read/write", READ_WRITE);
+    throughput("splice", SPLICE);
+    throughput("sendfile", SENDFILE);
+    copy();
+    exit(0);
+}
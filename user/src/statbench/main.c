@@ -0,0 +1,70 @@
+/*
+ * Stat benchmark: do what ls does to a directory, /dirbench unless
+ * another is given, reading it with getdents64() and stat()-ing every
+ * entry, but print only the time per entry. Run just after boot, the
+ * first pass reads the inode blocks from disk, each read filling the
+ * cached inodes of the whole block ahead of their stat(); the second
+ * pass finds every inode cached, which is as fast as read-ahead gets.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "statbench"
+#include "bench.h"
+
+#define PASSES 2
+
+// Record returned by getdents64(2).
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* Stat every entry of dir and return how many there were. */
+static int
+statdir(char* dir)
+{
+    static char dents[4096];
+    char buf[512];
+    struct stat st;
+    int fd, n, count = 0;
+
+    if ((fd = open(dir, O_RDONLY)) < 0) fail("open");
+    while ((n = syscall(SYS_getdents64, fd, dents, sizeof(dents))) > 0) {
+        for (int off = 0; off < n; count++) {
+            struct linux_dirent64* de = (void*)(dents + off);
+            off += de->d_reclen;
+            snprintf(buf, sizeof(buf), "%s/%s", dir, de->d_name);
+            if (stat(buf, &st) < 0) fail("stat");
+        }
+    }
+    if (n < 0) fail("getdents64");
+    close(fd);
+    return count;
+}
+
+int
+main(int argc, char* argv[])
+{
+    char* dir = argc > 1 ? argv[1] : "/dirbench";
+    for (int i = 1; i <= PASSES; i++) {
+        long t = now_us();
+        int n = statdir(dir);
+        t = now_us() - t;
+        printf(
+            "statbench: %s pass %d: %d entries, %ld ns per entry\n", dir, i,
+            n, n ? t * 1000 / n : 0);
+    }
+    exit(0);
+}
@@ -0,0 +1,85 @@
+/*
+ * Thread benchmark: count the primes below LIMIT by trial division
+ * with 1 to 4 threads, each taking every nth number, and report the
+ * time and the speedup over one thread. The threads share nothing
+ * but their result slots, so the speedup is up to the scheduler and
+ * the number of cores.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH "threadbench"
+#include "bench.h"
+
+#define LIMIT    200000  // Numbers tested
+#define NTHREADS 4       // Most threads run at once
+
+/* A cache line each, so that the threads don't share lines. */
+struct job {
+    int first;   // First number tested
+    int step;    // Distance between numbers tested
+    long count;  // Primes found
+} __attribute__((aligned(64)));
+
+struct job jobs[NTHREADS];
+
+static int
+isprime(int n)
+{
+    if (n < 2) return 0;
+    for (int d = 2; d * d <= n; d++)
+        if (n % d == 0) return 0;
+    return 1;
+}
+
+static void*
+work(void* arg)
+{
+    struct job* j = arg;
+    j->count = 0;
+    for (int n = j->first; n < LIMIT; n += j->step) j->count += isprime(n);
+    return NULL;
+}
+
+/* Count with n threads, the caller being the first. */
+static long
+run(int n, long* count)
+{
+    pthread_t tid[NTHREADS];
+    for (int i = 0; i < n; i++) jobs[i] = (struct job){i, n, 0};
+
+    long t = now_us();
+    for (int i = 1; i < n; i++)
+        if (pthread_create(&tid[i], NULL, work, &jobs[i])) fail("create");
+    work(&jobs[0]);
+    for (int i = 1; i < n; i++)
+        if (pthread_join(tid[i], NULL)) fail("join");
+    t = now_us() - t;
+
+    *count = 0;
+    for (int i = 0; i < n; i++) *count += jobs[i].count;
+    return t ? t : 1;
+}
+
+int
+main()
+{
+    long base = 0, count, want = 0;
+    for (int n = 1; n <= NTHREADS; n++) {
+        long t = run(n, &count);
+        if (n == 1) {
+            base = t;
+            want = count;
+        } else if (count != want) {
+            fail("count");
+        }
+        printf(
+            "threadbench: %d threads: %ld us, speedup %ld.%02ld\n", n, t,
+            base / t, base * 100 / t % 100);
+    }
+    printf("threadbench: %ld primes below %d\n", want, LIMIT);
+    exit(0);
+}
@@ -0,0 +1,122 @@
+/*
+ * Clock benchmark: call clock_gettime() ROUNDS times through the C
+ * library, which finds the kernel's vDSO through AT_SYSINFO_EHDR and
+ * reads the counter without a trap, then through the system call it
+ * falls back to, and gettimeofday(), which musl builds on the former.
+ * Then call getpid(), which musl always makes a system call, and the
+ * vDSO's __kernel_getpid(), looked up here. Reports nanoseconds per
+ * call.
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "timebench"
+#include "bench.h"
+
+#define ROUNDS 100000  // Calls timed
+
+enum { VDSO, SYSCALL, GETTIMEOFDAY, GETPID_VDSO, GETPID, NHOW };
+
+static char* names[] = {
+    "clock_gettime (vDSO)", "clock_gettime (syscall)",
+    "gettimeofday (vDSO)", "getpid (vDSO)", "getpid (syscall)"};
+
+static int (*vdso_getpid)();
+
+/*
+ * Return the address of the vDSO's symbol name, or NULL, looking it up
+ * through its DT_HASH table as musl does.
+ */
+static void*
+vdso_sym(char* name)
+{
+    Elf64_Ehdr* eh = (Elf64_Ehdr*)getauxval(AT_SYSINFO_EHDR);
+    if (!eh) return NULL;
+
+    char* base = NULL;
+    Elf64_Dyn* dyn = NULL;
+    for (int i = 0; i < eh->e_phnum; i++) {
+        Elf64_Phdr* ph =
+            (Elf64_Phdr*)((char*)eh + eh->e_phoff + i * eh->e_phentsize);
+        if (ph->p_type == PT_LOAD)
+            base = (char*)eh + ph->p_offset - ph->p_vaddr;
+        else if (ph->p_type == PT_DYNAMIC)
+            dyn = (Elf64_Dyn*)((char*)eh + ph->p_offset);
+    }
+    if (!base || !dyn) return NULL;
+
+    char* strings = NULL;
+    Elf64_Sym* syms = NULL;
+    Elf32_Word* hash = NULL;
+    for (; dyn->d_tag != DT_NULL; dyn++) {
+        char* p = base + dyn->d_un.d_ptr;
+        if (dyn->d_tag == DT_STRTAB) strings = p;
+        if (dyn->d_tag == DT_SYMTAB) syms = (Elf64_Sym*)p;
+        if (dyn->d_tag == DT_HASH) hash = (Elf32_Word*)p;
+    }
+    if (!strings || !syms || !hash) return NULL;
+
+    // hash[1] is the number of symbols.
+    for (Elf32_Word i = 0; i < hash[1]; i++)
+        if (syms[i].st_shndx && !strcmp(strings + syms[i].st_name, name))
+            return base + syms[i].st_value;
+    return NULL;
+}
+
+/* Return the time of ROUNDS calls the way how says. */
+static long
+run(int how)
+{
+    struct timespec ts, last = {0, 0};
+    struct timeval tv;
+    long t = now_us();
+    for (int i = 0; i < ROUNDS; i++) {
+        switch (how) {
+        case VDSO:
+            if (clock_gettime(CLOCK_MONOTONIC, &ts)) fail(names[how]);
+            break;
+        case SYSCALL:
+            if (syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts))
+                fail(names[how]);
+            break;
+        case GETTIMEOFDAY:
+            if (gettimeofday(&tv, NULL)) fail(names[how]);
+            break;
+        case GETPID_VDSO: vdso_getpid(); break;
+        default: syscall(SYS_getpid); break;
+        }
+        if (how <= SYSCALL) {
+            if (ts.tv_sec < last.tv_sec
+                || (ts.tv_sec == last.tv_sec && ts.tv_nsec < last.tv_nsec))
+                fail("monotonic");
+            last = ts;
+        }
+    }
+    t = now_us() - t;
+    return t ? t : 1;
+}
+
+int
+main()
+{
+    printf(
+        "timebench: vDSO %s\n",
+        getauxval(AT_SYSINFO_EHDR) ? "mapped" : "missing");
+    if (!(vdso_getpid = vdso_sym("__kernel_getpid")))
+        fail("vDSO __kernel_getpid lookup");
+    if (vdso_getpid() != getpid()) fail("vDSO getpid");
+    for (int how = 0; how < NHOW; how++) {
+        long t = run(how);
+        printf(
+            "timebench: %s: %ld ns/call\n", names[how], t * 1000 / ROUNDS);
+    }
+    exit(0);
+}
@@ -0,0 +1,7 @@
+// Do nothing, successfully.
+
+int
+main()
+{
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Wakeup benchmark: two processes pass a byte back and forth over a
+ * pair of pipes, and two threads pass a turn back and forth over a
+ * futex, so that every step is one sleeping task woken by another
+ * and run, on an idle CPU if there is one. Reports the time from
+ * wakeup to run, as the round trip time over two.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH "wakebench"
+#include "bench.h"
+
+#define ROUNDS 5000  // Round trips
+
+#define FUTEX_WAIT_PRIVATE 128
+#define FUTEX_WAKE_PRIVATE 129
+
+static int turn;  // Whose turn it is, 0 or 1
+
+static long
+pipes()
+{
+    int ping[2], pong[2];
+    char c = 0;
+    if (pipe(ping) < 0 || pipe(pong) < 0) fail("pipe");
+
+    int pid = fork();
+    if (pid < 0) fail("fork");
+    if (!pid) {
+        for (int i = 0; i < ROUNDS; i++)
+            if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+                fail("child");
+        exit(0);
+    }
+
+    long t = now_us();
+    for (int i = 0; i < ROUNDS; i++)
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+            fail("parent");
+    t = now_us() - t;
+
+    wait(NULL);
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+    return t;
+}
+
+/* Wait for our turn, and then give it to the other. */
+static void*
+pass(void* arg)
+{
+    int me = (long)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) != me)
+            syscall(SYS_futex, &turn, FUTEX_WAIT_PRIVATE, !me, NULL);
+        __atomic_store_n(&turn, !me, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &turn, FUTEX_WAKE_PRIVATE, 1);
+    }
+    return NULL;
+}
+
+static long
+futexes()
+{
+    pthread_t tid;
+    turn = 0;
+    long t = now_us();
+    if (pthread_create(&tid, NULL, pass, (void*)1)) fail("create");
+    pass((void*)0);
+    if (pthread_join(tid, NULL)) fail("join");
+    return now_us() - t;
+}
+
+int
+main()
+{
+    long t = pipes();
+    printf("wakebench: pipe: %ld ns a wakeup\n", t * 1000 / ROUNDS / 2);
+    t = futexes();
+    printf("wakebench: futex: %ld ns a wakeup\n", t * 1000 / ROUNDS / 2);
+    exit(0);
+}